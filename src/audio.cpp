@@ -0,0 +1,119 @@
+#include "audio.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+audio_output::audio_output()
+{
+    source = nullptr;
+    device = 0;
+    obtained = SDL_AudioSpec();
+    current = audio_state();
+    phase = 0.0;
+    beep_frequency = 440.0;
+    amplitude = 0;
+}
+
+audio_output::~audio_output()
+{
+    close();
+}
+
+//the audio subsystem is started here, so the emulator runs silent when there is no audio device
+bool audio_output::open(emulation_thread& emulation, const audio_settings& settings)
+{
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+    {
+        std::cerr << "Audio could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    source = &emulation;
+    beep_frequency = settings.beep_frequency;
+    amplitude = static_cast<int16_t>(32767 * std::min(std::max(settings.volume, 0), 100) / 100);
+
+    SDL_AudioSpec wanted = SDL_AudioSpec();
+    wanted.freq = settings.sample_rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = static_cast<Uint16>(settings.buffer_samples);
+    wanted.callback = callback;
+    wanted.userdata = this;
+
+    //SDL may pick another rate or buffer size, the callback makes whatever it is given
+    device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if(device == 0)
+    {
+        std::cerr << "Audio device could not be opened! SDL_Error: " << SDL_GetError() << std::endl;
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void audio_output::close()
+{
+    if(device != 0)
+    {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+}
+
+double audio_output::get_latency() const
+{
+    return obtained.freq != 0 ? static_cast<double>(obtained.samples) / obtained.freq : 0.0;
+}
+
+void SDLCALL audio_output::callback(void* userdata, Uint8* stream, int length)
+{
+    audio_output* output = static_cast<audio_output*>(userdata);
+    output->fill(reinterpret_cast<int16_t*>(stream), length / static_cast<int>(sizeof(int16_t)));
+}
+
+//take the frames queued since the last call, then make a square wave of the beep or the pattern,
+//carrying the phase on so a sound going on over several calls has no clicks
+void audio_output::fill(int16_t* samples, int count)
+{
+    audio_state state;
+    bool taken = false, any_on = false;
+    while(source->pop_audio(state))
+    {
+        current = state;
+        taken = true;
+        any_on |= state.on;
+    }
+    if(taken)
+    {
+        current.on = any_on;
+    }
+
+    if(!current.on)
+    {
+        std::fill(samples, samples + count, static_cast<int16_t>(0));
+        phase = 0.0;
+        return;
+    }
+
+    if(current.pattern)
+    {
+        //the 128 one bit samples of the pattern, looped at their rate
+        double step = current.rate / obtained.freq;
+        for(int i = 0; i < count; i++)
+        {
+            int bit = static_cast<int>(phase) & 127;
+            samples[i] = (current.samples[bit >> 3] >> (7 - (bit & 7)) & 1) ? amplitude : static_cast<int16_t>(-amplitude);
+            phase = std::fmod(phase + step, 128.0);
+        }
+    }else
+    {
+        double step = beep_frequency / obtained.freq;
+        for(int i = 0; i < count; i++)
+        {
+            samples[i] = phase < 0.5 ? amplitude : static_cast<int16_t>(-amplitude);
+            phase = std::fmod(phase + step, 1.0);
+        }
+    }
+}
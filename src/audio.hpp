@@ -0,0 +1,55 @@
+#pragma once
+
+#include <sdl2/sdl.h>
+#include <cstdint>
+
+#include "emulation_thread.hpp"
+
+//audio output
+//the SDL audio callback makes the sound from the frames the emulation thread sends, never taking a
+//lock: each call takes every frame queued since the last one and plays the newest until the next
+//call, a beep also sounding when any frame taken had the sound timer running, so a beep as short as
+//one frame is heard even when the emulation runs ahead of real speed. the callback always has a
+//sound to play, so it never runs dry whatever the speed of the emulation
+//
+//the latency is the frame waiting for the next call, at most one buffer, plus the buffer playing,
+//so a buffer of 256 samples at 48000 Hz keeps it around 10 ms
+struct audio_settings
+{
+    int sample_rate = 48000; // samples per second
+    int buffer_samples = 256; // samples per callback, a power of two
+    double beep_frequency = 440.0; // pitch of the beep in Hz
+    int volume = 25; // percent of full scale
+};
+
+class audio_output
+{
+    public:
+        audio_output(); // constructor
+
+        ~audio_output(); // destructor
+
+        audio_output(const audio_output&) = delete;
+        audio_output& operator=(const audio_output&) = delete;
+
+        bool open(emulation_thread& emulation, const audio_settings& settings); // open the audio device and start playing
+
+        void close(); // stop playing, before the emulation thread goes
+
+        double get_latency() const; // seconds of the buffer, the latency being up to twice that
+
+    private:
+        static void SDLCALL callback(void* userdata, Uint8* stream, int length); // called by SDL on its audio thread
+
+        void fill(int16_t* samples, int count); // make the next samples
+
+        emulation_thread* source;
+        SDL_AudioDeviceID device;
+        SDL_AudioSpec obtained;
+
+        //state of the audio thread only
+        audio_state current; // sound of the newest frame taken
+        double phase; // position in the beep period or the pattern, in samples of either
+        double beep_frequency;
+        int16_t amplitude;
+};
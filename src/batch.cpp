@@ -0,0 +1,158 @@
+#include "batch.hpp"
+#include <algorithm>
+
+#include "runner.hpp"
+
+batch_engine::batch_engine(size_t machines, size_t threads, bool pin_threads)
+    : machines(machines), statuses(machines, cycle_status::ok), pool(threads, pin_threads)
+{
+    for(chip8& machine : this->machines)
+    {
+        machine.chip8_init();
+        machine.set_dispatch_mode(dispatch_mode::table);
+    }
+}
+
+void batch_engine::reset(size_t index)
+{
+    chip8& machine = machines.at(index);
+    uint32_t ipf = machine.get_instructions_per_frame();
+    quirk_profile profile = machine.get_quirk_profile();
+    sprite_edge edge = machine.get_sprite_edge();
+    machine.reset();
+    machine.chip8_init();
+    machine.set_dispatch_mode(dispatch_mode::table);
+    machine.set_instructions_per_frame(ipf);
+    machine.set_quirk_profile(profile);
+    machine.set_sprite_edge(edge);
+    statuses[index] = cycle_status::ok;
+}
+
+//the rom is read once and copied into every machine
+bool batch_engine::load_rom(const std::string& rom_path)
+{
+    std::vector<uint8_t> image;
+    return read_rom_file(rom_path, image) && load_program(image.data(), image.size());
+}
+
+bool batch_engine::load_program(const uint8_t* data, size_t size)
+{
+    for(size_t i = 0; i < machines.size(); i++)
+    {
+        reset(i);
+        if(!machines[i].load_program(data, size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool batch_engine::load_rom(size_t index, const std::string& rom_path)
+{
+    reset(index);
+    return machines[index].load_rom(rom_path);
+}
+
+void batch_engine::set_instructions_per_frame(uint32_t count)
+{
+    for(chip8& machine : machines)
+    {
+        machine.set_instructions_per_frame(count);
+    }
+}
+
+void batch_engine::set_quirk_profile(quirk_profile profile)
+{
+    for(chip8& machine : machines)
+    {
+        machine.set_quirk_profile(profile);
+    }
+}
+
+void batch_engine::set_keypad_all(uint8_t key, uint8_t value)
+{
+    for(chip8& machine : machines)
+    {
+        machine.set_keypad(key, value);
+    }
+}
+
+void batch_engine::set_random_seed(uint32_t seed)
+{
+    for(size_t index = 0; index < machines.size(); index++)
+    {
+        machines[index].set_random_seed(machine_seed(seed, index));
+    }
+}
+
+void batch_engine::set_idle_skipping(bool skip)
+{
+    for(chip8& machine : machines)
+    {
+        machine.set_idle_skipping(skip);
+    }
+}
+
+void batch_engine::run(uint64_t cycles)
+{
+    size_t tasks = (machines.size() + machines_per_task - 1) / machines_per_task;
+    pool.run(tasks, [this, cycles](size_t task)
+    {
+        size_t end = std::min(machines.size(), (task + 1) * machines_per_task);
+        for(size_t i = task * machines_per_task; i < end; i++)
+        {
+            if(statuses[i] == cycle_status::ok)
+            {
+                statuses[i] = machines[i].run_cycles(cycles);
+            }
+        }
+    });
+}
+
+size_t batch_engine::get_faulted() const
+{
+    return static_cast<size_t>(std::count_if(statuses.begin(), statuses.end(), [](cycle_status status) {
+        return status != cycle_status::ok;
+    }));
+}
+
+uint64_t batch_engine::get_total_cycles() const
+{
+    uint64_t total = 0;
+    for(const chip8& machine : machines)
+    {
+        total += machine.get_cycle_count();
+    }
+    return total;
+}
+
+void batch_engine::copy_framebuffers(uint64_t* rows) const
+{
+    for(const chip8& machine : machines)
+    {
+        for(int y = 0; y < 32; y++)
+        {
+            *rows++ = machine.get_display_row(y);
+        }
+    }
+}
+
+void batch_engine::copy_registers(machine_registers* registers) const
+{
+    for(size_t i = 0; i < machines.size(); i++)
+    {
+        const chip8& machine = machines[i];
+        machine_registers& copy = registers[i];
+        for(uint8_t r = 0; r < 16; r++)
+        {
+            copy.V[r] = machine.get_V(r);
+        }
+        copy.I = machine.get_I();
+        copy.pc = machine.get_pc();
+        copy.delay_timer = machine.get_delay_timer();
+        copy.sound_timer = machine.get_sound_timer();
+        copy.status = statuses[i];
+        copy.cycle_count = machine.get_cycle_count();
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <string>
+
+#include "chip8.hpp"
+#include "thread_pool.hpp"
+
+//registers of one machine, as copied out in bulk by batch_engine::copy_registers
+struct machine_registers
+{
+    std::array<uint8_t, 16> V;
+    uint16_t I;
+    uint16_t pc;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    cycle_status status; // how the last run of the machine ended
+    uint64_t cycle_count;
+};
+
+//seed of machine index of an engine seeded with seed: machine 0 keeps the seed, so it runs as a lone
+//machine seeded alike, the others go through a splitmix64 step of the seed and the index so each
+//draws its own CXNN bytes
+inline uint32_t machine_seed(uint32_t seed, size_t index)
+{
+    if(index == 0)
+    {
+        return seed;
+    }
+    uint64_t z = (static_cast<uint64_t>(seed) << 32 | static_cast<uint32_t>(index)) + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+}
+
+//batch emulator
+//owns many independent machines in one contiguous pool and runs them on the table core, spread over
+//a work stealing thread pool in tasks of neighbouring machines. the machines share nothing but the
+//rom image they were loaded from, so a run scales with the workers
+//
+//a machine that faults stops for the rest of the run, its status is kept until it is reset or a
+//rom is loaded again
+class batch_engine
+{
+    public:
+        //machines of the pool, threads 0 for one per logical cpu, workers pinned one per cpu or not
+        batch_engine(size_t machines, size_t threads = 0, bool pin_threads = true);
+
+        static const size_t machines_per_task = 16; // machines run by one task of the thread pool
+
+        size_t size() const { return machines.size(); } // number of machines
+
+        chip8& get_machine(size_t index) { return machines.at(index); } // a machine of the pool
+
+        const chip8& get_machine(size_t index) const { return machines.at(index); } // a machine of the pool
+
+        bool load_rom(const std::string& rom_path); // reset every machine and load the same rom into all of them
+
+        bool load_program(const uint8_t* data, size_t size); // reset every machine and load a rom image already in memory
+
+        bool load_rom(size_t index, const std::string& rom_path); // reset one machine and load a rom into it
+
+        void reset(size_t index); // power the machine on again, without a rom
+
+        void set_instructions_per_frame(uint32_t count); // cycles per 60 Hz timer tick of every machine
+
+        void set_quirk_profile(quirk_profile profile); // select the quirks of every machine, the sprite edge follows
+
+        void set_keypad(size_t index, uint8_t key, uint8_t value) { machines.at(index).set_keypad(key, value); } // press or release a key of one machine
+
+        void set_keypad_all(uint8_t key, uint8_t value); // press or release a key of every machine
+
+        void set_random_seed(uint32_t seed); // seed the CXNN generator of machine i with machine_seed(seed, i), after loading the rom
+
+        void set_idle_skipping(bool skip); // retire idle loops at once on every machine, or run every cycle of them
+
+        void run(uint64_t cycles); // run every machine that has not faulted for count cycles, in parallel
+
+        cycle_status get_status(size_t index) const { return statuses.at(index); } // how the last run of a machine ended
+
+        size_t get_faulted() const; // machines stopped by a fault
+
+        uint64_t get_total_cycles() const; // cycles run by all machines together
+
+        void copy_framebuffers(uint64_t* rows) const; // 32 rows per machine, machine after machine
+
+        void copy_registers(machine_registers* registers) const; // one entry per machine
+
+        size_t get_thread_count() const { return pool.get_thread_count(); } // workers running the machines
+
+        bool is_pinned() const { return pool.is_pinned(); } // true when the workers are pinned
+
+    private:
+        std::vector<chip8> machines;
+        std::vector<cycle_status> statuses;
+        thread_pool pool;
+};
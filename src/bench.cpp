@@ -0,0 +1,476 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+
+#include "chip8.hpp"
+#include "runner.hpp"
+#include "batch.hpp"
+#include "lockstep.hpp"
+#include "rom_library.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+//benchmark
+//runs every rom of a directory on every core for a fixed number of instructions, with a fixed seed
+//for CXNN and a key script generated from the same seed, and reports the speed and the peak memory
+//of each run as json or csv
+//
+//with --instances N every rom also runs on N machines at once through the batch engine and the
+//lockstep engine, reported as cores "batch" and "lockstep" with the cycles of all machines together.
+//every machine then has its own key script and CXNN seed (machine_seed), so the lockstep lanes branch
+//apart as they would for independent players
+//
+//the idle loops a rom waits in are run instruction by instruction, so the speed is the one of the
+//instructions excuted. with --idle-skip on the table core retires them at once as the emulator does,
+//every cycle still counted, which measures how fast a rom plays rather than how fast the core runs
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "roms"
+#endif
+
+namespace
+{
+    struct bench_row
+    {
+        std::string rom;
+        std::string core;
+        run_result result;
+        uint64_t peak_rss_kb; // 0 when the host does not report it
+    };
+
+    //start a new peak memory measurement, only linux can reset the high water mark, elsewhere the
+    //peak is the one of the whole process so far
+    void reset_peak_rss()
+    {
+#if defined(__linux__)
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5";
+#endif
+    }
+
+    uint64_t peak_rss_kb()
+    {
+#if defined(__linux__)
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status, line))
+        {
+            if(line.compare(0, 6, "VmHWM:") == 0)
+            {
+                return std::strtoull(line.c_str() + 6, nullptr, 10);
+            }
+        }
+        return 0;
+#elif defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            return counters.PeakWorkingSetSize / 1024;
+        }
+        return 0;
+#elif defined(__unix__) || defined(__APPLE__)
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#if defined(__APPLE__)
+        return usage.ru_maxrss / 1024; // bytes on macos
+#else
+        return usage.ru_maxrss;
+#endif
+#else
+        return 0;
+#endif
+    }
+
+    //run cycles on every machine of a batch or lockstep engine, each machine with its own key script
+    //applied at the start of the slice its cycle falls in, so the engine runs in slices of a fixed length
+    template<typename engine>
+    run_result run_engine(engine& machines, const std::vector<std::vector<key_event>>& scripts, uint64_t cycles)
+    {
+        const uint64_t slice = 1000;
+        run_result result;
+        result.status = cycle_status::ok;
+        std::vector<size_t> next_event(scripts.size(), 0);
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t cycle = 0; cycle < cycles; cycle += slice)
+        {
+            uint64_t until = std::min(cycles, cycle + slice);
+            for(size_t index = 0; index < scripts.size(); index++)
+            {
+                const std::vector<key_event>& events = scripts[index];
+                for(size_t& next = next_event[index]; next < events.size() && events[next].cycle < until; next++)
+                {
+                    machines.set_keypad(index, events[next].key, events[next].value);
+                }
+            }
+            machines.run(until - cycle);
+        }
+        auto end = std::chrono::steady_clock::now();
+        result.cycles = machines.get_total_cycles();
+        result.seconds = std::chrono::duration<double>(end - start).count();
+        for(size_t index = 0; index < scripts.size() && result.status == cycle_status::ok; index++)
+        {
+            result.status = machines.get_status(index);
+        }
+        return result;
+    }
+
+    double mips(const run_result& result)
+    {
+        return result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0;
+    }
+
+    double ns_per_instruction(const run_result& result)
+    {
+        return result.cycles > 0 ? result.seconds * 1e9 / result.cycles : 0.0;
+    }
+
+    double frames_per_second(const run_result& result, uint32_t ipf)
+    {
+        return result.seconds > 0 ? result.cycles / static_cast<double>(ipf) / result.seconds : 0.0;
+    }
+
+    //quote a string for json, rom names are file names so only quotes, backslashes and control
+    //characters need escaping
+    std::string json_string(const std::string& text)
+    {
+        std::string quoted = "\"";
+        for(char c : text)
+        {
+            if(c == '"' || c == '\\')
+            {
+                quoted += '\\';
+                quoted += c;
+            }else if(static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }else
+            {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    //quote a csv field when it holds a separator or a quote
+    std::string csv_field(const std::string& text)
+    {
+        if(text.find_first_of(",\"\n") == std::string::npos)
+        {
+            return text;
+        }
+        std::string quoted = "\"";
+        for(char c : text)
+        {
+            if(c == '"')
+            {
+                quoted += '"';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    void write_json(std::ostream& out, const std::vector<bench_row>& rows, const std::string& label,
+                    uint64_t cycles, uint32_t seed, uint32_t ipf, quirk_profile quirks, size_t instances)
+    {
+        out << "{\n";
+        out << "  \"label\": " << json_string(label) << ",\n";
+        out << "  \"cycles\": " << cycles << ",\n";
+        out << "  \"instances\": " << instances << ",\n";
+        out << "  \"seed\": " << seed << ",\n";
+        out << "  \"instructions_per_frame\": " << ipf << ",\n";
+        out << "  \"quirks\": " << json_string(quirk_profile_name(quirks)) << ",\n";
+        out << "  \"results\": [";
+        for(size_t i = 0; i < rows.size(); i++)
+        {
+            const bench_row& row = rows[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {\"rom\": " << json_string(row.rom)
+                << ", \"core\": " << json_string(row.core)
+                << ", \"status\": " << json_string(cycle_status_name(row.result.status))
+                << ", \"cycles\": " << row.result.cycles
+                << ", \"seconds\": " << row.result.seconds
+                << ", \"mips\": " << mips(row.result)
+                << ", \"ns_per_instruction\": " << ns_per_instruction(row.result)
+                << ", \"frames_per_second\": " << frames_per_second(row.result, ipf)
+                << ", \"peak_rss_kb\": " << row.peak_rss_kb << "}";
+        }
+        out << "\n  ]\n}" << std::endl;
+    }
+
+    void write_csv(std::ostream& out, const std::vector<bench_row>& rows, const std::string& label, uint32_t ipf)
+    {
+        out << "label,rom,core,status,cycles,seconds,mips,ns_per_instruction,frames_per_second,peak_rss_kb\n";
+        for(const bench_row& row : rows)
+        {
+            out << csv_field(label) << ',' << csv_field(row.rom) << ',' << row.core << ','
+                << cycle_status_name(row.result.status) << ',' << row.result.cycles << ','
+                << row.result.seconds << ',' << mips(row.result) << ','
+                << ns_per_instruction(row.result) << ',' << frames_per_second(row.result, ipf) << ','
+                << row.peak_rss_kb << '\n';
+        }
+        out.flush();
+    }
+
+    void print_usage()
+    {
+        std::cout << "Usage: ./chip8_bench [options], options as --option value or --option=value" << std::endl;
+        std::cout << "  --roms DIR     directory of roms to run (default " << CHIP8_ROM_DIR << ")" << std::endl;
+        std::cout << "  --cycles N     instructions per run (default 2000000)" << std::endl;
+        std::cout << "  --seed S       seed of CXNN and of the generated key presses (default 1)" << std::endl;
+        std::cout << "  --ipf N        instructions per 60 Hz frame (default 10)" << std::endl;
+        std::cout << "  --quirks Q     quirk profile: modern (default), vip, chip48, schip or xochip" << std::endl;
+        std::cout << "  --cores LIST   comma separated cores (default reference,table,block,jit)" << std::endl;
+        std::cout << "  --repeat N     runs of each rom and core, the fastest is reported (default 1)" << std::endl;
+        std::cout << "  --format F     json or csv (default json)" << std::endl;
+        std::cout << "  --output FILE  write the results to FILE instead of the standard output" << std::endl;
+        std::cout << "  --instances N  also run N machines of each rom at once on the batch and lockstep engines" << std::endl;
+        std::cout << "  --threads N    workers of the engines (default one per logical cpu)" << std::endl;
+        std::cout << "  --label TEXT   label stored with the results, e.g. the commit measured" << std::endl;
+        std::cout << "  --idle-skip B  on to retire idle loops at once as the emulator does, off (default) to run them" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string rom_dir = CHIP8_ROM_DIR;
+    std::string output_path;
+    std::string format = "json";
+    std::string label;
+    uint64_t cycles = 2000000;
+    uint32_t seed = 1;
+    uint32_t repeat = 1;
+    size_t instances = 0;
+    size_t threads = 0;
+    run_settings settings;
+    settings.idle_skipping = false;
+    std::vector<std::string> cores(std::begin(core_names), std::end(core_names));
+
+    //parse the arguments, options take their value as the next argument or after '='
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string value;
+        size_t equals = arg.find('=');
+        if(equals != std::string::npos)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        }else if(arg != "-h" && arg != "--help")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "Missing value of " << arg << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+            value = argv[++i];
+        }
+
+        if(arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }else if(arg == "--roms")
+        {
+            rom_dir = value;
+        }else if(arg == "--cycles")
+        {
+            cycles = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--seed")
+        {
+            seed = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        }else if(arg == "--ipf")
+        {
+            settings.instructions_per_frame = static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(UINT32_MAX, std::strtoull(value.c_str(), nullptr, 10))));
+        }else if(arg == "--quirks")
+        {
+            if(!parse_quirk_profile(value, settings.quirks))
+            {
+                std::cerr << "Unknown quirk profile " << value << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+            settings.edge = quirks_of(settings.quirks).edge;
+        }else if(arg == "--repeat")
+        {
+            repeat = static_cast<uint32_t>(std::max<unsigned long>(1, std::strtoul(value.c_str(), nullptr, 10)));
+        }else if(arg == "--instances")
+        {
+            instances = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        }else if(arg == "--threads")
+        {
+            threads = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        }else if(arg == "--cores")
+        {
+            cores.clear();
+            std::istringstream list(value);
+            std::string core;
+            while(std::getline(list, core, ','))
+            {
+                if(!is_core(core))
+                {
+                    std::cerr << "Unknown core " << core << "(use -h to get help)" << std::endl;
+                    return 1;
+                }
+                cores.push_back(core);
+            }
+        }else if(arg == "--format")
+        {
+            format = value;
+            if(format != "json" && format != "csv")
+            {
+                std::cerr << "Unknown format " << format << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+        }else if(arg == "--output")
+        {
+            output_path = value;
+        }else if(arg == "--label")
+        {
+            label = value;
+        }else if(arg == "--idle-skip")
+        {
+            if(value != "on" && value != "off")
+            {
+                std::cerr << "--idle-skip takes on or off (use -h to get help)" << std::endl;
+                return 1;
+            }
+            settings.idle_skipping = value == "on";
+        }else
+        {
+            std::cerr << "Unknown argument " << arg << "(use -h to get help)" << std::endl;
+            return 1;
+        }
+    }
+
+    //the roms of the directory are mapped once and come in name order so runs line up
+    rom_library library;
+    if(!library.open(rom_dir) || library.size() == 0)
+    {
+        std::cerr << "No roms found in " << rom_dir << std::endl;
+        return 1;
+    }
+
+    std::vector<key_event> events = random_key_script(seed, cycles);
+    settings.random_seed = seed;
+
+    std::vector<bench_row> rows;
+
+    //instance i of the engines plays the key script of seed + i
+    std::vector<std::vector<key_event>> scripts;
+    for(size_t index = 0; index < instances; index++)
+    {
+        scripts.push_back(random_key_script(seed + static_cast<uint32_t>(index), cycles));
+    }
+    auto engine_row = [&](auto& engine, const rom_image& rom, const char* core)
+    {
+        bench_row row;
+        row.rom = rom.name;
+        row.core = core;
+        row.peak_rss_kb = 0;
+        for(uint32_t run = 0; run < repeat; run++)
+        {
+            reset_peak_rss();
+            engine.set_idle_skipping(settings.idle_skipping);
+            if(!engine.load_program(rom.data, rom.size))
+            {
+                std::cerr << "Failed to load " << rom.name << std::endl;
+                return false;
+            }
+            engine.set_random_seed(seed);
+            run_result result = run_engine(engine, scripts, cycles);
+            if(run == 0 || result.seconds < row.result.seconds)
+            {
+                row.result = result;
+            }
+            row.peak_rss_kb = std::max(row.peak_rss_kb, peak_rss_kb());
+        }
+        std::cerr << row.rom << " " << core << " of " << instances << " on " << engine.get_thread_count()
+                  << " threads: " << mips(row.result) << " MIPS" << std::endl;
+        rows.push_back(row);
+        return true;
+    };
+
+    for(size_t rom_index = 0; rom_index < library.size(); rom_index++)
+    {
+        const rom_image& rom = library.get(rom_index);
+        for(const std::string& core : cores)
+        {
+            bench_row row;
+            row.rom = rom.name;
+            row.core = core;
+            row.peak_rss_kb = 0;
+            settings.core = core;
+            for(uint32_t run = 0; run < repeat; run++)
+            {
+                chip8 machine;
+                run_result result;
+                reset_peak_rss();
+                if(!run_program(settings, rom.data, rom.size, events, cycles, nullptr, machine, result))
+                {
+                    std::cerr << "Failed to load " << rom.name << std::endl;
+                    return 1;
+                }
+                if(run == 0 || result.seconds < row.result.seconds)
+                {
+                    row.result = result;
+                }
+                row.peak_rss_kb = std::max(row.peak_rss_kb, peak_rss_kb());
+            }
+            std::cerr << row.rom << " " << row.core << ": " << mips(row.result) << " MIPS" << std::endl;
+            rows.push_back(row);
+        }
+
+        if(instances > 0)
+        {
+            batch_engine batch(instances, threads);
+            batch.set_instructions_per_frame(settings.instructions_per_frame);
+            batch.set_quirk_profile(settings.quirks);
+            lockstep_engine lockstep(instances, threads);
+            lockstep.set_instructions_per_frame(settings.instructions_per_frame);
+            lockstep.set_quirk_profile(settings.quirks);
+            if(!engine_row(batch, rom, "batch") || !engine_row(lockstep, rom, "lockstep"))
+            {
+                return 1;
+            }
+            std::cerr << "  " << lockstep.get_scalar_count() << " of " << instances << " on the scalar core, "
+                      << (lockstep.get_steps() > 0 ? static_cast<double>(lockstep.get_lane_instructions()) / lockstep.get_steps() : 0.0)
+                      << " lanes per lockstep step" << std::endl;
+        }
+    }
+
+    std::ofstream output_file;
+    if(!output_path.empty())
+    {
+        output_file.open(output_path);
+        if(!output_file.is_open())
+        {
+            std::cerr << "Error opening " << output_path << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output_path.empty() ? std::cout : output_file;
+    if(format == "json")
+    {
+        write_json(out, rows, label, cycles, seed, settings.instructions_per_frame, settings.quirks, instances);
+    }else
+    {
+        write_csv(out, rows, label, settings.instructions_per_frame);
+    }
+    return 0;
+}
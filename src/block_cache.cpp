@@ -0,0 +1,264 @@
+#include "block_cache.hpp"
+#include "fast_core.hpp"
+
+namespace
+{
+    //instructions that end a block: anything that moves the program counter other than straight
+    //ahead, the draw and the key wait, and the stores that may rewrite code
+    //skips do not end a block, a taken skip leaves it early instead
+    constexpr bool ends_block(uint8_t op)
+    {
+        switch(op)
+        {
+            case OP_00EE: case OP_1NNN: case OP_2NNN: case OP_BNNN: case OP_00FD:
+            case OP_DXYN: case OP_FX0A:
+            case OP_FX33: case OP_FX55:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    //cap on decoded instructions before the whole cache is flushed
+    const size_t max_cached_ops = 1 << 16;
+}
+
+//instruction fields of a pre-decoded block
+#define CHIP8_X (op->x)
+#define CHIP8_Y (op->y)
+#define CHIP8_N (op->n)
+#define CHIP8_NN (op->nn)
+#define CHIP8_NNN (op->nnn)
+
+//address just past the instruction being excuted
+#define CHIP8_NEXT_PC ((pc + 2 * (op - begin + 1)) & 0xFFF)
+
+//instructions of a block are retired together when it is left, only the timer instructions need
+//the instructions before them retired first
+#define CHIP8_SYNC_TIMERS() \
+    do { \
+        retire_instructions(static_cast<uint32_t>(op - retired)); \
+        retired = op; \
+    } while(0)
+
+//the cycles of a block are given out before it runs, so idle loops run instruction by instruction
+#define CHIP8_IDLE()
+#define CHIP8_POLL_DELAY(x)
+
+//a fault leaves the program counter just past the faulting instruction, which is not retired
+#undef CHIP8_FAULT
+#define CHIP8_FAULT(status) \
+    do { \
+        CHIP8_SYNC_TIMERS(); \
+        pc_counter = CHIP8_NEXT_PC; \
+        return cycle_status::status; \
+    } while(0)
+
+//a taken skip leaves the block, giving back the cycles of the instructions not run
+#define CHIP8_SKIP() \
+    do { \
+        pc_counter = (CHIP8_NEXT_PC + CHIP8_SKIP_LENGTH(CHIP8_NEXT_PC)) & 0xFFF; \
+        count += end - op - 1; \
+        end = op + 1; \
+        goto block_exit; \
+    } while(0)
+
+#if CHIP8_COMPUTED_GOTO
+#define CHIP8_DISPATCH(index) goto *labels[index];
+#define CHIP8_OP(name) label_##name:
+#define CHIP8_NEXT() \
+    if(++op == end) goto block_end; \
+    goto *labels[op->op]
+#else
+#define CHIP8_DISPATCH(index) switch(index)
+#define CHIP8_OP(name) case name:
+#define CHIP8_NEXT() break
+#endif
+
+//run count cycles from the blocks of cache without leaving the loop between blocks
+//only the last instruction of a block reads or moves the program counter, so it is set once per
+//block to the address after the last instruction that will run
+template<quirk_profile profile>
+cycle_status chip8::run_blocks(block_cache& cache, uint64_t count)
+{
+    constexpr quirk_set quirk = quirks_of(profile);
+
+#if CHIP8_COMPUTED_GOTO
+    CHIP8_LABEL_TABLE(labels);
+#endif
+
+    //the block being run, kept while the program keeps coming back to its start
+    uint16_t block_pc = 0xFFFF;
+    const decoded_op* block_ops = nullptr;
+    uint32_t block_length = 0;
+
+    const decoded_op* begin;
+    const decoded_op* retired;
+    const decoded_op* op;
+    const decoded_op* end;
+    uint16_t pc = pc_counter & 0xFFF;
+    while(count > 0)
+    {
+        if(pc != block_pc)
+        {
+            int32_t index = cache.block_at[pc];
+            if(index < 0)
+            {
+                index = cache.compile(*this, pc);
+            }
+            block_pc = pc;
+            block_ops = &cache.ops[cache.blocks[index].first];
+            block_length = cache.blocks[index].length;
+        }
+
+        uint32_t length = block_length < count ? block_length : static_cast<uint32_t>(count);
+        count -= length;
+        begin = retired = op = block_ops;
+        end = op + length;
+        pc_counter = (pc + 2 * length) & 0xFFF;
+
+        for(;;)
+        {
+            CHIP8_DISPATCH(op->op)
+            {
+#include "chip8_ops.inl"
+            }
+
+#if !CHIP8_COMPUTED_GOTO
+            if(++op == end)
+            {
+                goto block_end;
+            }
+#endif
+        }
+
+    block_end:
+        retire_instructions(static_cast<uint32_t>(end - retired));
+
+        //FX33 and FX55 only ever end a block, so a store can only come from the last instruction
+        if(end[-1].op == OP_FX33)
+        {
+            cache.invalidate(I, 3);
+            block_pc = 0xFFFF;
+        }else if(end[-1].op == OP_FX55)
+        {
+            cache.invalidate(I - index_advance(quirk, end[-1].x), end[-1].x + 1);
+            block_pc = 0xFFFF;
+        }
+
+        pc = pc_counter & 0xFFF;
+        continue;
+
+    block_exit:
+        retire_instructions(static_cast<uint32_t>(end - retired));
+        pc = pc_counter & 0xFFF;
+    }
+    return cycle_status::ok;
+}
+
+//the decoded blocks do not depend on the quirks, only the loop running them does
+//the blocks are keyed by 12 bit addresses, the 64 KB of XO-CHIP run on the table loop instead
+cycle_status chip8::run_blocks(block_cache& cache, uint64_t count)
+{
+    if(memory_size(quirks_of(quirks)) > block_cache::address_space)
+    {
+        return run_table(count);
+    }
+    idle = false;
+    return with_quirk_profile(quirks, [&](auto profile) {
+        return run_blocks<decltype(profile)::value>(cache, count);
+    });
+}
+
+block_cache::block_cache()
+{
+    compiled_blocks = 0;
+    invalidated_blocks = 0;
+    flush();
+}
+
+void block_cache::flush()
+{
+    block_at.fill(-1);
+    covered.fill(0);
+    blocks.clear();
+    ops.clear();
+}
+
+//decode the block starting at pc and return its index
+int32_t block_cache::compile(const chip8& machine, uint16_t pc)
+{
+    if(ops.size() + max_block_length > max_cached_ops)
+    {
+        flush();
+    }
+
+    block new_block;
+    new_block.first = static_cast<uint32_t>(ops.size());
+    new_block.start = pc;
+    new_block.length = 0;
+
+    //stop before wrapping around the end of memory so the block addresses stay increasing
+    uint16_t address = pc;
+    for(;;)
+    {
+        uint16_t instruction = (machine.memory[address] << 8) | machine.memory[(address + 1) & 0xFFF];
+        decoded_op decoded = decode_opcode(instruction);
+        ops.push_back(decoded);
+        new_block.length++;
+        address += 2;
+
+        if(ends_block(decoded.op) || new_block.length == max_block_length || address >= 0xFFF)
+        {
+            break;
+        }
+    }
+
+    for(uint32_t i = 0; i < new_block.length * 2u; i++)
+    {
+        covered[(pc + i) & 0xFFF]++;
+    }
+
+    int32_t index = static_cast<int32_t>(blocks.size());
+    blocks.push_back(new_block);
+    block_at[pc] = index;
+    compiled_blocks++;
+    return index;
+}
+
+//remove the block starting at start, its decoded instructions are reclaimed on the next flush
+void block_cache::drop(uint16_t start)
+{
+    const block& dropped = blocks[block_at[start]];
+    for(uint32_t i = 0; i < dropped.length * 2u; i++)
+    {
+        covered[(start + i) & 0xFFF]--;
+    }
+    block_at[start] = -1;
+    invalidated_blocks++;
+}
+
+//drop every block decoded from the bytes address .. address + length - 1
+void block_cache::invalidate(uint16_t address, uint16_t length)
+{
+    for(uint32_t i = 0; i < length; i++)
+    {
+        uint16_t written = (address + i) & 0xFFF;
+
+        //a block covering this byte starts at most 2 * max_block_length - 1 bytes before it
+        for(uint32_t back = 0; covered[written] != 0 && back < max_block_length * 2; back++)
+        {
+            uint16_t start = (written - back) & 0xFFF;
+            if(block_at[start] >= 0 && blocks[block_at[start]].length * 2u > back)
+            {
+                drop(start);
+            }
+        }
+    }
+}
+
+//run count cycles, stopping early on a fault
+cycle_status block_cache::run(chip8& machine, uint64_t count)
+{
+    return machine.run_blocks(*this, count);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "chip8.hpp"
+
+//decoded basic block cache
+//straight-line runs of instructions are decoded once, keyed by their start address, and replayed
+//through the fast core handlers until a branch, DXYN, FX0A or a memory store ends the block, or a
+//taken skip leaves it early
+//
+//blocks are kept for the 4 KB of CHIP-8 and SUPER-CHIP, a machine with the 64 KB of XO-CHIP is run
+//by the table loop
+//
+//the cache only sees the stores of the instructions it runs itself, so a machine must either be run
+//through one cache only, or the cache flushed after the machine ran elsewhere or loaded a rom
+class block_cache
+{
+    friend class chip8;
+
+    public:
+        block_cache(); // constructor
+
+        cycle_status run(chip8& machine, uint64_t count); // run count cycles from the cache
+
+        void invalidate(uint16_t address, uint16_t length); // drop the blocks decoded from the given bytes
+
+        void flush(); // drop every block
+
+        uint64_t get_compiled_blocks() const { return compiled_blocks; } // blocks decoded so far
+
+        uint64_t get_invalidated_blocks() const { return invalidated_blocks; } // blocks dropped by stores
+
+        static const uint32_t max_block_length = 64; // instructions per block at most
+
+        static const uint32_t address_space = 4096; // bytes of memory blocks are decoded from
+
+    private:
+        struct block
+        {
+            uint32_t first; // index of the first instruction in ops
+            uint16_t start; // address of the first instruction
+            uint16_t length; // number of instructions
+        };
+
+        int32_t compile(const chip8& machine, uint16_t pc); // decode the block starting at pc
+
+        void drop(uint16_t start); // remove the block starting at start
+
+        std::array<int32_t, address_space> block_at; // block starting at each address, -1 if none
+        std::array<uint8_t, address_space> covered; // number of blocks decoded from each byte
+        std::vector<block> blocks;
+        std::vector<decoded_op> ops;
+
+        uint64_t compiled_blocks;
+        uint64_t invalidated_blocks;
+};
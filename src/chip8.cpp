@@ -1,25 +1,85 @@
 #include "chip8.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <ostream>
+#include <stdexcept>
+#include <type_traits>
+
+//machines are copied with memcpy by snapshots and kept in contiguous pools
+static_assert(std::is_trivially_copyable<chip8>::value, "chip8 must stay trivially copyable");
+
+namespace
+{
+    //the 8x10 digits of the high resolution font (FX30), 0 to 9 from SUPER-CHIP and A to F from XO-CHIP
+    const std::array<uint8_t, 160> big_fontset = {
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+        0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    //a rom is loaded after the interpreter area and may fill the rest of the 64 KB of XO-CHIP
+    const size_t max_rom_size = chip8_memory_size - 512;
+}
 
 chip8::chip8()
 {
+    idle_skipping = true;
+    reset();
+}
 
+//the memory past the first 4 KB is left as it is, out of use, so a new machine only writes the bytes a
+//CHIP-8 or SUPER-CHIP machine has
+void chip8::reset()
+{
     //initialize the cpu registers
     pc_counter = 0x200;
     I = 0;
+    stack_memory.fill(0);
+    stack_pointer = 0;
     delay_timer = 0;
     sound_timer = 0;
     V.fill(0);
 
     //initialize the memory
-    memory.fill(0);
+    std::fill(memory.begin(), memory.begin() + chip8_base_memory_size, 0);
+    extended_memory = false;
 
     //initialize the display
-    // 0 represents black , 255 represents white
-    display.fill(0);
+    // 0 represents black , 1 represents white
+    for(auto& plane : display)
+    {
+        plane.fill(0);
+    }
+    high_resolution = false;
+    selected_planes = 1;
+    flags.fill(0);
+    audio_pattern.fill(0);
+    audio_pitch = 64;
+    edge = sprite_edge::wrap;
+    quirks = quirk_profile::modern;
 
-    bool draw_flag = false;
+    draw_flag = false;
+    random_state = default_random_state;
+    cycle_count = 0;
+    instructions_per_frame = default_instructions_per_frame;
+    timer_frame = 0;
+    dispatch = default_dispatch_mode;
+    idle = false;
 
     //initialize the keypad
     keypad.fill(0);
@@ -51,15 +111,17 @@ void chip8::chip8_init()
     //load the fontset into the memory
     for(int i = 0; i < 80; i++)
     {
-        memory[i+80] = fontset[i];
+        memory[i + font_address] = fontset[i];
     }
+    std::copy(big_fontset.begin(), big_fontset.end(), memory.begin() + big_font_address);
 }
 
-//fetch instruction
+//fetch instruction, the program counter wraps around the memory of the profile
 uint16_t chip8::fetch_instruction()
 {
-    uint16_t current_instruction = (memory[pc_counter] << 8) | memory[pc_counter + 1];
-    pc_counter += 2;
+    uint16_t mask = address_mask(quirks_of(quirks));
+    uint16_t current_instruction = (memory[pc_counter & mask] << 8) | memory[(pc_counter + 1) & mask];
+    pc_counter = (pc_counter + 2) & mask;
     return current_instruction;
 }
 
@@ -74,59 +136,158 @@ bool chip8::load_rom(const std::string rom_path)
         rom_file.seekg(0, std::ios::beg);
 
         //check if the rom file is too large
-        if(size > 4096 - 512)
+        if(size > static_cast<std::streamoff>(max_rom_size))
         {
             std::cerr << "Rom file too large" << std::endl;
             return false;
         }
 
-        std::array<uint8_t, 4096 - 512> buffer;
+        std::vector<uint8_t> buffer(static_cast<size_t>(size));
         if(!rom_file.read(reinterpret_cast<char*>(buffer.data()), size))
         {
             std::cerr << "Error reading rom file" << std::endl;
             return false;
         }
 
-        std::copy(buffer.begin(), buffer.end(), memory.begin() + 512);
-        return true;
-
+        return load_program(buffer.data(), static_cast<size_t>(size));
     }else{
         std::cerr << "Error opening rom file" << std::endl;
         return false;
     }
 }
 
+//the memory past the first 4 KB starts out zeroed the first time it is needed
+void chip8::extend_memory()
+{
+    if(!extended_memory)
+    {
+        std::fill(memory.begin() + chip8_base_memory_size, memory.end(), 0);
+        extended_memory = true;
+    }
+}
 
+//load a rom image to memory, after the interpreter area
+//a rom past 4 KB is only reached with the 64 KB of XO-CHIP
+bool chip8::load_program(const uint8_t* data, size_t size)
+{
+    if(size > max_rom_size)
+    {
+        std::cerr << "Rom file too large" << std::endl;
+        return false;
+    }
+
+    if(512 + size > chip8_base_memory_size)
+    {
+        extend_memory();
+    }
+    std::copy(data, data + size, memory.begin() + 512);
+    return true;
+}
 
 //decode and excute instruction
+//the SUPER-CHIP and XO-CHIP instructions only run with a profile that has them, otherwise the
+//instructions keep their CHIP-8 meaning
 void chip8::decode_excute(uint16_t instruction)
 {
     //get the first four bits of the instruction
     uint8_t first_nibble = helper_functions(instruction);
+    quirk_set quirk = quirks_of(quirks);
+    bool superchip = quirk.instructions != instruction_set::chip8;
+    bool xochip = quirk.instructions == instruction_set::xochip;
+
+    //fault unless the length bytes starting at I are in the memory of the profile
+    auto check_index = [&](uint32_t length)
+    {
+        if(I + length > memory_size(quirk))
+        {
+            throw std::out_of_range("I past the end of memory");
+        }
+    };
 
     switch(first_nibble)
     {
         //default = 0x0NNN 
         //fix command = 0x00E0, 0x00EE
+        //SUPER-CHIP = 0x00CN, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF, XO-CHIP = 0x00DN
         case 0x0:
         {
+            //scroll the display down N rows
+            if(superchip && (instruction & 0xFFF0) == 0x00C0)
+            {
+                scroll_down(instruction & 0x000F);
+                draw_flag = true;
+                break;
+            }
+
+            //scroll the display up N rows
+            if(xochip && (instruction & 0xFFF0) == 0x00D0)
+            {
+                scroll_up(instruction & 0x000F);
+                draw_flag = true;
+                break;
+            }
+
             switch(instruction)
             {
                 //clear the display
                 case 0x00E0:
-                    display.fill(0);
+                    clear_planes();
                     draw_flag = true;
                     break;
 
                 //return from a subroutine
                 case 0x00EE:
-                    pc_counter = stack_memory.top();
-                    stack_memory.pop();
+                    if(stack_pointer == 0)
+                    {
+                        throw std::underflow_error("stack underflow");
+                    }
+                    pc_counter = stack_memory[--stack_pointer];
                     break;
 
-                //implement the 0NNN command(not implemented)
+                //scroll the display 4 pixels right
+                case 0x00FB:
+                    if(superchip)
+                    {
+                        scroll_right();
+                        draw_flag = true;
+                    }
+                    break;
+
+                //scroll the display 4 pixels left
+                case 0x00FC:
+                    if(superchip)
+                    {
+                        scroll_left();
+                        draw_flag = true;
+                    }
+                    break;
+
+                //exit the interpreter, the machine stops on the instruction
+                case 0x00FD:
+                    if(superchip)
+                    {
+                        pc_counter -= 2;
+                    }
+                    break;
+
+                //low resolution, 64x32
+                case 0x00FE:
+                    if(superchip)
+                    {
+                        set_resolution(false);
+                    }
+                    break;
+
+                //high resolution, 128x64
+                case 0x00FF:
+                    if(superchip)
+                    {
+                        set_resolution(true);
+                    }
+                    break;
+
+                //0NNN runs a machine code routine of the COSMAC VIP, there is none to run so it is ignored
                 default:
-                    std::cerr << "0NNN command not implemented" << std::endl;
                     break;
             }
             break;
@@ -142,7 +303,11 @@ void chip8::decode_excute(uint16_t instruction)
         //call subroutine at NNN
         case 0x2:
         {
-            stack_memory.push(pc_counter);
+            if(stack_pointer == chip8_stack_depth)
+            {
+                throw std::overflow_error("stack overflow");
+            }
+            stack_memory[stack_pointer++] = pc_counter;
             pc_counter = instruction & 0x0FFF;
             break;
         }
@@ -153,7 +318,7 @@ void chip8::decode_excute(uint16_t instruction)
         {
             if(V.at((instruction & 0x0F00) >> 8) == (instruction & 0x00FF))
             {
-                pc_counter += 2;
+                pc_counter += skip_length(pc_counter);
             }
             break;
         }
@@ -164,18 +329,38 @@ void chip8::decode_excute(uint16_t instruction)
         {
             if(V.at((instruction & 0x0F00) >> 8) != (instruction & 0x00FF))
             {
-                pc_counter += 2;
+                pc_counter += skip_length(pc_counter);
             }
             break;
         }
 
         //5XY0
         //skip next instruction if VX == VY
+        //XO-CHIP 5XY2 and 5XY3, store VX..VY at I and load VX..VY from I, backwards when X > Y
         case 0x5:
         {
-            if(V.at((instruction & 0x0F00) >> 8) == V.at((instruction & 0x00F0) >> 4))
+            uint8_t x = (instruction & 0x0F00) >> 8;
+            uint8_t y = (instruction & 0x00F0) >> 4;
+            if(xochip && ((instruction & 0x000F) == 0x2 || (instruction & 0x000F) == 0x3))
+            {
+                int step = x <= y ? 1 : -1;
+                int count = (y - x) * step + 1;
+                check_index(count);
+                for(int i = 0; i < count; i++)
+                {
+                    if((instruction & 0x000F) == 0x2)
+                    {
+                        memory.at(I + i) = V.at(x + i * step);
+                    }else
+                    {
+                        V.at(x + i * step) = memory.at(I + i);
+                    }
+                }
+                break;
+            }
+            if(V.at(x) == V.at(y))
             {
-                pc_counter += 2;
+                pc_counter += skip_length(pc_counter);
             }
             break;
         }
@@ -214,7 +399,10 @@ void chip8::decode_excute(uint16_t instruction)
                 case(0x1):
                 {
                     V.at((instruction & 0x0F00) >> 8) |= V.at((instruction & 0x00F0) >> 4);
-                    V.at(0xF) = 0;
+                    if(quirks_of(quirks).logic_resets_vf)
+                    {
+                        V.at(0xF) = 0;
+                    }
                     break;
                 }
 
@@ -222,7 +410,10 @@ void chip8::decode_excute(uint16_t instruction)
                 case(0x2):
                 {
                     V.at((instruction & 0x0F00) >> 8) &= V.at((instruction & 0x00F0) >> 4);
-                    V.at(0xF) = 0;
+                    if(quirks_of(quirks).logic_resets_vf)
+                    {
+                        V.at(0xF) = 0;
+                    }
                     break;
                 }
 
@@ -230,7 +421,10 @@ void chip8::decode_excute(uint16_t instruction)
                 case(0x3):
                 {
                     V.at((instruction & 0x0F00) >> 8) ^= V.at((instruction & 0x00F0) >> 4);
-                    V.at(0xF) = 0;
+                    if(quirks_of(quirks).logic_resets_vf)
+                    {
+                        V.at(0xF) = 0;
+                    }
                     break;
                 }
 
@@ -252,10 +446,12 @@ void chip8::decode_excute(uint16_t instruction)
                 }
                 
                 //VX = VX >> 1, VY(just ignore),VF = least significant bit of VX
+                //VX = VY >> 1 with the shift_reads_vy quirk
                 case(0x6):
                 {
-                    V.at(0xF) = V.at((instruction & 0x0F00) >> 8) & 0x1;
-                    V.at((instruction & 0x0F00) >> 8) >>= 1;
+                    uint8_t source = V.at(quirks_of(quirks).shift_reads_vy ? (instruction & 0x00F0) >> 4 : (instruction & 0x0F00) >> 8);
+                    V.at(0xF) = source & 0x1;
+                    V.at((instruction & 0x0F00) >> 8) = source >> 1;
                     break;
                 }
                 
@@ -267,11 +463,13 @@ void chip8::decode_excute(uint16_t instruction)
                     break;
                 }
 
-                //VX = VX << 1, VY(just ignore),VF = least significant bit of VX
+                //VX = VX << 1, VY(just ignore),VF = most significant bit of VX
+                //VX = VY << 1 with the shift_reads_vy quirk
                 case(0xE):
                 {
-                    V.at(0xF) = V.at((instruction & 0x0F00) >> 8) >> 7;
-                    V.at((instruction & 0x0F00) >> 8) <<= 1;
+                    uint8_t source = V.at(quirks_of(quirks).shift_reads_vy ? (instruction & 0x00F0) >> 4 : (instruction & 0x0F00) >> 8);
+                    V.at(0xF) = source >> 7;
+                    V.at((instruction & 0x0F00) >> 8) = static_cast<uint8_t>(source << 1);
                     break;  
                 }
                 
@@ -290,7 +488,7 @@ void chip8::decode_excute(uint16_t instruction)
         {
             if(V.at((instruction & 0x0F00) >> 8) != V.at((instruction & 0x00F0) >> 4))
             {
-                pc_counter += 2;
+                pc_counter += skip_length(pc_counter);
             }
             break;
         }
@@ -304,10 +502,10 @@ void chip8::decode_excute(uint16_t instruction)
         }
 
         //BNNN
-        //jump to address NNN + V0
+        //jump to address NNN + V0, or NNN + VX with the jump_reads_vx quirk
         case(0xB):
         {
-            pc_counter = (instruction & 0x0FFF) + V.at(0);
+            pc_counter = (instruction & 0x0FFF) + V.at(quirks_of(quirks).jump_reads_vx ? (instruction & 0x0F00) >> 8 : 0);
             break;
         }
 
@@ -315,34 +513,32 @@ void chip8::decode_excute(uint16_t instruction)
         //set VX = random byte AND NN
         case(0xC):
         {
-            V.at((instruction & 0x0F00) >> 8) = (rand() % 256) & (instruction & 0x00FF);
+            V.at((instruction & 0x0F00) >> 8) = random_byte() & (instruction & 0x00FF);
             break;
         }
 
         //DXYN
         //display n-byte sprite starting at memory location I at (VX, VY), vf = collision
+        //with SUPER-CHIP DXY0 is a 16x16 sprite, with XO-CHIP the sprite of each selected plane follows the one before
         case(0xD):
         {
             uint8_t x = V.at((instruction & 0x0F00) >> 8);
             uint8_t y = V.at((instruction & 0x00F0) >> 4);
             uint8_t height = instruction & 0x000F;
-            V[0xF] = 0;
-            for(int yline = 0; yline < height; yline++)
+            if(superchip)
             {
-                uint8_t pixel = memory.at(I + yline);
-                for(int xline = 0; xline < 8; xline++)
+                if(I + sprite_length(height) > memory_size(quirk))
                 {
-                    //check if the current pixel is set to 1
-                    //if yes, then check if the display pixel is set to 1
-                    if((pixel & (0x80 >> xline)) != 0)
-                    {
-                        V.at(0xF) |= display.at(((x + xline + ((y + yline) * 64)) % 2048)) & 1;
-                        // xor the display pixel with 1(flip the bit)
-                        display.at(((x + xline + ((y + yline) * 64)) % 2048)) ^= 1;
-                    }
+                    throw std::out_of_range("sprite past the end of memory");
                 }
-                draw_flag = true;
+                draw_planes(x, y, height);
+                break;
             }
+            if(I + height > memory_size(quirk))
+            {
+                throw std::out_of_range("sprite past the end of memory");
+            }
+            draw_sprite(x, y, height);
             break;  
         }
 
@@ -353,12 +549,12 @@ void chip8::decode_excute(uint16_t instruction)
         {
             switch(instruction & 0x00FF)
             {
-                //EX9E
+                //EX9E, only the low 4 bits of VX name the key
                 case(0x9E):
                 {
-                    if(keypad.at(V.at((instruction & 0x0F00) >> 8)))
+                    if(keypad.at(V.at((instruction & 0x0F00) >> 8) & 0xF))
                     {
-                        pc_counter += 2;
+                        pc_counter += skip_length(pc_counter);
                     }
                     break;
                 }
@@ -366,9 +562,9 @@ void chip8::decode_excute(uint16_t instruction)
                 //EXA1
                 case(0xA1):
                 {
-                    if(! keypad.at(V.at((instruction & 0x0F00) >> 8)))
+                    if(! keypad.at(V.at((instruction & 0x0F00) >> 8) & 0xF))
                     {
-                        pc_counter += 2;
+                        pc_counter += skip_length(pc_counter);
                     }
                     break;
                 }
@@ -377,13 +573,57 @@ void chip8::decode_excute(uint16_t instruction)
         }
 
         //FX07, FX0A, FX15, FX18, FX1E, FX29, FX33, FX55, FX65
+        //SUPER-CHIP = FX30, FX75, FX85, XO-CHIP = F000, FN01, F002, FX3A
         case(0xF):
         {
             switch(instruction & 0x00FF)
             {
+                //F000 NNNN, I = NNNN, the word after the instruction
+                case(0x00):
+                {
+                    if(xochip && instruction == 0xF000)
+                    {
+                        uint16_t mask = address_mask(quirk);
+                        I = (memory[pc_counter & mask] << 8) | memory[(pc_counter + 1) & mask];
+                        pc_counter = (pc_counter + 2) & mask;
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
+                //select the planes of the display instructions, N as a mask
+                case(0x01):
+                {
+                    if(xochip)
+                    {
+                        selected_planes = (instruction & 0x0F00) >> 8 & 0x3;
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
+                //load the 16 bytes at I into the audio pattern
+                case(0x02):
+                {
+                    if(xochip && instruction == 0xF002)
+                    {
+                        check_index(16);
+                        std::copy(memory.begin() + I, memory.begin() + I + 16, audio_pattern.begin());
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
                 //Sets VX to the value of the delay timer
                 case(0x07):
                 {
+                    update_timers();
                     V.at((instruction & 0x0F00) >> 8) = delay_timer;
                     break;
                 }
@@ -410,6 +650,7 @@ void chip8::decode_excute(uint16_t instruction)
                 //Sets the delay timer to VX
                 case(0x15):
                 {
+                    update_timers();
                     delay_timer = V.at((instruction & 0x0F00) >> 8);
                     break;
                 }
@@ -417,6 +658,7 @@ void chip8::decode_excute(uint16_t instruction)
                 //Sets the sound timer to VX
                 case(0x18):
                 {
+                    update_timers();
                     sound_timer = V.at((instruction & 0x0F00) >> 8);
                     break;
                 }
@@ -424,8 +666,11 @@ void chip8::decode_excute(uint16_t instruction)
                 //Adds VX to I.
                 case(0x1E):
                 {
-                    int sum = I + V.at((instruction & 0x0F00) >> 8);
-                    V.at(0xF) = (sum > 0xFFF ? 1 : 0);
+                    if(quirks_of(quirks).add_index_sets_vf)
+                    {
+                        int sum = I + V.at((instruction & 0x0F00) >> 8);
+                        V.at(0xF) = (sum > 0xFFF ? 1 : 0);
+                    }
                     I += V.at((instruction & 0x0F00) >> 8);
                     break;
                 }
@@ -433,36 +678,101 @@ void chip8::decode_excute(uint16_t instruction)
                 //Sets I to the location of the sprite for the character in VX
                 case(0x29):
                 {
-                    I = V.at((instruction & 0x0F00) >> 8) * 0x5 + 80;
+                    I = V.at((instruction & 0x0F00) >> 8) * 0x5 + font_address;
+                    break;
+                }
+
+                //Sets I to the location of the high resolution sprite for the character in VX
+                case(0x30):
+                {
+                    if(superchip)
+                    {
+                        I = (V.at((instruction & 0x0F00) >> 8) & 0xF) * 10 + big_font_address;
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
+                //Sets the pitch of the audio pattern to VX
+                case(0x3A):
+                {
+                    if(xochip)
+                    {
+                        audio_pitch = V.at((instruction & 0x0F00) >> 8);
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
+                //Stores V0 to VX in the flag registers, V0 to V7 at most without XO-CHIP
+                case(0x75):
+                {
+                    if(superchip)
+                    {
+                        int last = std::min<int>((instruction & 0x0F00) >> 8, xochip ? 15 : 7);
+                        for(int i = 0; i <= last; i++)
+                        {
+                            flags.at(i) = V.at(i);
+                        }
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
+                    break;
+                }
+
+                //Loads V0 to VX from the flag registers
+                case(0x85):
+                {
+                    if(superchip)
+                    {
+                        int last = std::min<int>((instruction & 0x0F00) >> 8, xochip ? 15 : 7);
+                        for(int i = 0; i <= last; i++)
+                        {
+                            V.at(i) = flags.at(i);
+                        }
+                    }else
+                    {
+                        std::cerr << "Instruction not implemented" << std::endl;
+                    }
                     break;
                 }
 
                 //Stores the binary-coded decimal representation of VX in I, I+1, and I+2
                 case(0x33):
                 {
+                    check_index(3);
                     memory.at(I) = V.at((instruction & 0x0F00) >> 8) / 100;
                     memory.at(I + 1) = (V.at((instruction & 0x0F00) >> 8) / 10) % 10;
                     memory.at(I + 2) = V.at((instruction & 0x0F00) >> 8) % 10;
                     break;
                 }
 
-                //stores V0 to VX in memory starting at address I
+                //stores V0 to VX in memory starting at address I, then moves I as the quirks say
                 case(0x55):
                 {
+                    check_index(((instruction & 0x0F00) >> 8) + 1);
                     for(int i = 0; i <= ((instruction & 0x0F00) >> 8); i++)
                     {
-                        memory.at(I++) = V.at(i);
+                        memory.at(I + i) = V.at(i);
                     }
+                    I += index_advance(quirks_of(quirks), (instruction & 0x0F00) >> 8);
                     break;
                 }
 
-                //stores memory starting at address I into V0 to VX
+                //stores memory starting at address I into V0 to VX, then moves I as the quirks say
                 case(0x65):
                 {
+                    check_index(((instruction & 0x0F00) >> 8) + 1);
                     for(int i = 0; i <= ((instruction & 0x0F00) >> 8); i++)
                     {
-                        V.at(i) = memory.at(I++);
+                        V.at(i) = memory.at(I + i);
                     }
+                    I += index_advance(quirks_of(quirks), (instruction & 0x0F00) >> 8);
                     break;
                 }
                 
@@ -483,37 +793,421 @@ void chip8::decode_excute(uint16_t instruction)
     }
 }
 
-//get the screen pixels
-uint8_t chip8::get_screent_pixels(int x, int y)
+//xor the height rows of sprite data at I onto the display at (x, y)
+//VF = 1 when a lit pixel is erased, the caller checks the rows are in memory
+void chip8::draw_sprite(uint8_t x, uint8_t y, uint8_t height)
 {
-    return display.at(x + y * 64);
+    V[0xF] = xor_sprite(display[0].data(), &memory[I], x, y, height, edge) ? 1 : 0;
+    if(height > 0)
+    {
+        draw_flag = true;
+    }
 }
 
-//chip8 cycle
-void chip8::chip8_cycle()
+//a whole row at a time, the position wraps and the pixels past the edges wrap or are clipped
+bool xor_sprite(uint64_t* display, const uint8_t* rows, uint8_t x, uint8_t y, uint8_t height, sprite_edge edge)
 {
-    try
+    uint32_t column = x % 64;
+    uint32_t row = y % 32;
+    bool collision = false;
+    for(uint32_t line = 0; line < height; line++)
     {
-        uint16_t instruction = fetch_instruction();
-        if(instruction == 0x1394)std::cout << std::hex << instruction << std::endl;
-        decode_excute(instruction);
+        uint32_t target = row + line;
+        if(target >= 32)
+        {
+            if(edge == sprite_edge::clip)
+            {
+                break;
+            }
+            target -= 32;
+        }
+
+        //shift the sprite byte into place, the pixels past the right edge come back on the left when wrapping
+        uint64_t sprite = static_cast<uint64_t>(rows[line]) << 56;
+        uint64_t bits = sprite >> column;
+        if(edge == sprite_edge::wrap && column > 56)
+        {
+            bits |= sprite << (64 - column);
+        }
+
+        collision |= (display[target] & bits) != 0;
+        display[target] ^= bits;
+    }
+    return collision;
+}
+
+//the sprite of each selected plane follows the one before it, VF = 1 when a lit pixel of any plane
+//is erased. a 16x16 sprite (n = 0) is drawn in both resolutions, the caller checks the sprites are
+//in memory
+void chip8::draw_planes(uint8_t x, uint8_t y, uint8_t n)
+{
+    bool wide = n == 0;
+    const uint8_t* rows = &memory[I];
+    bool collision = false;
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(selected_planes & (1 << plane))
+        {
+            collision |= xor_plane_sprite(display[plane].data(), high_resolution, rows, x, y, wide ? 16 : n, wide, edge);
+            rows += wide ? 32 : n;
+        }
+    }
+    V[0xF] = collision ? 1 : 0;
+    draw_flag = true;
+}
+
+uint16_t chip8::sprite_length(uint8_t n) const
+{
+    return (n == 0 ? 32 : n) * ((selected_planes & 1) + (selected_planes >> 1));
+}
+
+//a row of up to 16 pixels is shifted into the one or two words it lands on, the pixels past the right
+//edge going to the first word of the row when wrapping
+bool xor_plane_sprite(uint64_t* plane, bool high, const uint8_t* rows, uint8_t x, uint8_t y, uint8_t height, bool wide,
+                      sprite_edge edge)
+{
+    uint32_t words = high ? 2 : 1;
+    uint32_t lines = high ? 64 : 32;
+    uint32_t column = x % (64 * words);
+    uint32_t row = y % lines;
+    uint32_t word = column / 64;
+    uint32_t shift = column % 64;
+    uint32_t width = wide ? 16 : 8;
+    bool collision = false;
+    for(uint32_t line = 0; line < height; line++)
+    {
+        uint32_t target = row + line;
+        if(target >= lines)
+        {
+            if(edge == sprite_edge::clip)
+            {
+                break;
+            }
+            target -= lines;
+        }
 
-        //decrement the delay timer and sound timer
-        if(delay_timer > 0)
+        uint64_t sprite = wide ? (static_cast<uint64_t>(rows[2 * line]) << 56) | (static_cast<uint64_t>(rows[2 * line + 1]) << 48)
+                               : static_cast<uint64_t>(rows[line]) << 56;
+        uint64_t bits[2] = {0, 0};
+        bits[word] = sprite >> shift;
+        if(shift + width > 64)
         {
-            delay_timer--;
+            uint64_t spill = sprite << (64 - shift);
+            if(word + 1 < words)
+            {
+                bits[word + 1] = spill;
+            }else if(edge == sprite_edge::wrap)
+            {
+                bits[0] |= spill;
+            }
         }
 
-        if(sound_timer > 0)
+        uint64_t* target_row = plane + target * words;
+        for(uint32_t w = 0; w < words; w++)
         {
-            sound_timer--;
+            collision |= (target_row[w] & bits[w]) != 0;
+            target_row[w] ^= bits[w];
         }
+    }
+    return collision;
+}
+
+void chip8::clear_planes()
+{
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(selected_planes & (1 << plane))
+        {
+            display[plane].fill(0);
+        }
+    }
+}
+
+//the rows change length with the resolution, so both planes are cleared
+void chip8::set_resolution(bool high)
+{
+    high_resolution = high;
+    for(auto& plane : display)
+    {
+        plane.fill(0);
+    }
+    draw_flag = true;
+}
+
+//the scrolls work on whole words: rows move with a single memmove, and the 4 pixel shifts carry the
+//bits leaving one word of a row into the next
+void chip8::scroll_down(uint8_t rows)
+{
+    size_t words = high_resolution ? 2 : 1;
+    size_t lines = high_resolution ? 64 : 32;
+    size_t moved = std::min<size_t>(rows, lines);
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(selected_planes & (1 << plane))
+        {
+            uint64_t* data = display[plane].data();
+            std::memmove(data + moved * words, data, (lines - moved) * words * sizeof(uint64_t));
+            std::fill(data, data + moved * words, 0);
+        }
+    }
+}
+
+void chip8::scroll_up(uint8_t rows)
+{
+    size_t words = high_resolution ? 2 : 1;
+    size_t lines = high_resolution ? 64 : 32;
+    size_t moved = std::min<size_t>(rows, lines);
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(selected_planes & (1 << plane))
+        {
+            uint64_t* data = display[plane].data();
+            std::memmove(data, data + moved * words, (lines - moved) * words * sizeof(uint64_t));
+            std::fill(data + (lines - moved) * words, data + lines * words, 0);
+        }
+    }
+}
+
+void chip8::scroll_right()
+{
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(!(selected_planes & (1 << plane)))
+        {
+            continue;
+        }
+        uint64_t* data = display[plane].data();
+        if(high_resolution)
+        {
+            for(size_t row = 0; row < 128; row += 2)
+            {
+                data[row + 1] = (data[row + 1] >> 4) | (data[row] << 60);
+                data[row] >>= 4;
+            }
+        }else
+        {
+            for(size_t row = 0; row < 32; row++)
+            {
+                data[row] >>= 4;
+            }
+        }
+    }
+}
+
+void chip8::scroll_left()
+{
+    for(int plane = 0; plane < 2; plane++)
+    {
+        if(!(selected_planes & (1 << plane)))
+        {
+            continue;
+        }
+        uint64_t* data = display[plane].data();
+        if(high_resolution)
+        {
+            for(size_t row = 0; row < 128; row += 2)
+            {
+                data[row] = (data[row] << 4) | (data[row + 1] >> 60);
+                data[row + 1] <<= 4;
+            }
+        }else
+        {
+            for(size_t row = 0; row < 32; row++)
+            {
+                data[row] <<= 4;
+            }
+        }
+    }
+}
+
+//with XO-CHIP a skip steps over the whole of the 4 byte F000 NNNN
+uint16_t chip8::skip_length(uint16_t address) const
+{
+    quirk_set quirk = quirks_of(quirks);
+    uint16_t mask = address_mask(quirk);
+    bool long_instruction = memory[address & mask] == 0xF0 && memory[(address + 1) & mask] == 0x00;
+    return quirk.instructions == instruction_set::xochip && long_instruction ? 4 : 2;
+}
+
+//a loop waiting on the delay timer: FX07 at address, then 3XNN or 4XNN on the same register, then a
+//jump back to the FX07. every iteration is 3 cycles reading the timer once, so the iterations whose
+//read falls before the frame the timer can end the loop at are retired at once, keeping a whole
+//iteration of count for the caller. the timers are up to date, and the instruction at address is
+//still to run: after the skip it reads the timer of the next iteration
+uint64_t chip8::skip_delay_poll(uint16_t address, uint8_t x, uint64_t count)
+{
+    uint16_t mask = address_mask(quirks_of(quirks));
+    uint16_t test = static_cast<uint16_t>(memory[(address + 2) & mask] << 8 | memory[(address + 3) & mask]);
+    uint16_t jump = static_cast<uint16_t>(memory[(address + 4) & mask] << 8 | memory[(address + 5) & mask]);
+    bool loops_while_different = (test & 0xF000) == 0x3000;
+    if(address >= 0x1000 || jump != (0x1000 | address) || (test >> 8 & 0xF) != x ||
+       !(loops_while_different || (test & 0xF000) == 0x4000) || count <= 3)
+    {
+        return 0;
+    }
+
+    //first cycle a read of the timer may end the loop at, none once it stays put
+    uint8_t value = test & 0xFF;
+    uint64_t leave = UINT64_MAX;
+    if(loops_while_different)
+    {
+        if(delay_timer == value)
+        {
+            return 0;
+        }
+        if(delay_timer > value)
+        {
+            leave = (timer_frame + delay_timer - value) * instructions_per_frame;
+        }
+    }else
+    {
+        if(delay_timer != value)
+        {
+            return 0;
+        }
+        if(value != 0)
+        {
+            leave = (timer_frame + 1) * instructions_per_frame;
+        }
+    }
+
+    uint64_t iterations = (count - 1) / 3;
+    if(leave != UINT64_MAX)
+    {
+        iterations = std::min(iterations, (leave - cycle_count + 2) / 3);
+    }
+    cycle_count += iterations * 3;
+    return iterations * 3;
+}
+
+//4000 samples per second at pitch 64, doubling every 48 steps up
+double chip8::get_audio_rate() const
+{
+    return 4000.0 * std::pow(2.0, (audio_pitch - 64) / 48.0);
+}
+
+//decrement the delay timer and sound timer once for every 60 Hz frame completed since the last update
+//a frame is instructions_per_frame cycles, so the timers only depend on the cycle count
+void chip8::update_timers()
+{
+    uint64_t frame = cycle_count / instructions_per_frame;
+    delay_timer = timer_after(delay_timer, frame);
+    sound_timer = timer_after(sound_timer, frame);
+    timer_frame = frame;
+}
+
+//value of a timer last updated at timer_frame once frame is reached
+uint8_t chip8::timer_after(uint8_t timer, uint64_t frame) const
+{
+    uint64_t ticks = frame - timer_frame;
+    return ticks < timer ? static_cast<uint8_t>(timer - ticks) : 0;
+}
+
+//the frame boundaries move with the new length, the ticks already due are applied first
+void chip8::set_instructions_per_frame(uint32_t count)
+{
+    update_timers();
+    instructions_per_frame = count > 0 ? count : 1;
+    timer_frame = cycle_count / instructions_per_frame;
+}
+
+//get the screen pixels, 0 to 3 with both planes
+uint8_t chip8::get_screent_pixels(int x, int y)
+{
+    uint8_t color = 0;
+    for(int plane = 0; plane < 2; plane++)
+    {
+        color |= ((get_display_word(plane, y, x / 64) >> (63 - (x & 63))) & 1) << plane;
+    }
+    return color;
+}
+
+//seeds go through the murmur3 finalizer so nearby seeds start far apart, it maps 0 to 0, the one
+//state xorshift cannot leave, which becomes the default state instead
+void chip8::set_random_seed(uint32_t seed)
+{
+    seed ^= seed >> 16;
+    seed *= 0x85EBCA6B;
+    seed ^= seed >> 13;
+    seed *= 0xC2B2AE35;
+    seed ^= seed >> 16;
+    random_state = seed != 0 ? seed : default_random_state;
+}
+
+//chip8 cycle
+cycle_status chip8::chip8_cycle()
+{
+    if(dispatch != dispatch_mode::reference)
+    {
+        return run_table(1);
+    }
+
+    try
+    {
+        uint16_t instruction = fetch_instruction();
+        decode_excute(instruction);
+        cycle_count++;
+    }catch(const std::underflow_error&)
+    {
+        return cycle_status::stack_underflow;
+    }catch(const std::overflow_error&)
+    {
+        return cycle_status::stack_overflow;
     }catch(const std::exception& e)
     {
         std::cerr << e.what() << std::endl;
+        return cycle_status::address_fault;
+    }
+    return cycle_status::ok;
+}
+
+
+const char* cycle_status_name(cycle_status status)
+{
+    switch(status)
+    {
+        case cycle_status::ok: return "ok";
+        case cycle_status::stack_underflow: return "stack underflow";
+        case cycle_status::stack_overflow: return "stack overflow";
+        case cycle_status::address_fault: return "address fault";
     }
+    return "unknown";
+}
+
+namespace
+{
+    const char* const quirk_profile_names[] = {"modern", "vip", "chip48", "schip", "xochip"};
 }
 
+const char* quirk_profile_name(quirk_profile profile)
+{
+    size_t index = static_cast<size_t>(profile);
+    return index < sizeof(quirk_profile_names) / sizeof(quirk_profile_names[0]) ? quirk_profile_names[index] : "unknown";
+}
+
+bool parse_quirk_profile(const std::string& name, quirk_profile& profile)
+{
+    for(size_t index = 0; index < sizeof(quirk_profile_names) / sizeof(quirk_profile_names[0]); index++)
+    {
+        if(name == quirk_profile_names[index])
+        {
+            profile = static_cast<quirk_profile>(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+//the sprite edge is part of the profile, set_sprite_edge afterwards to mix them
+void chip8::set_quirk_profile(quirk_profile profile)
+{
+    if(quirks_of(profile).instructions == instruction_set::xochip)
+    {
+        extend_memory();
+    }
+    quirks = profile;
+    edge = quirks_of(profile).edge;
+}
 
 //set the keypad
 void chip8::set_keypad(uint8_t key, uint8_t value)
@@ -1,28 +1,233 @@
 #pragma once
 
 #include <cstdint>
-#include <stack>
 #include <array>
 #include <cstdlib>
 #include <fstream>
- 
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "opcode.hpp"
+
+class block_cache;
+class jit_compiler;
+class opcode_profiler;
+class trace_recorder;
+struct trace_probe;
+struct chip8_snapshot;
+
+//how chip8_cycle decodes instructions
+//reference is the original nested switch in decode_excute, table is the dispatch in dispatch.cpp
+enum class dispatch_mode : uint8_t
+{
+    reference,
+    table
+};
+
+//result of running one or more cycles
+//a fault drops the faulting instruction (the program counter is already past it) and stops the run
+enum class cycle_status : uint8_t
+{
+    ok,
+    stack_underflow, // 00EE with an empty stack
+    stack_overflow, // 2NNN with every level of the stack in use
+    address_fault // memory access past the end of memory, or an exception in the reference switch
+};
+
+const char* cycle_status_name(cycle_status status);
+
+//what happens to the pixels of a sprite drawn across the right or bottom edge of the screen
+//the position of the sprite itself always wraps (VX % 64, VY % 32)
+enum class sprite_edge : uint8_t
+{
+    wrap, // the pixels come back on the opposite edge
+    clip // the pixels are dropped, as on the COSMAC VIP
+};
+
+//behaviors chip8 interpreters disagree on, as sets of the interpreters that had them
+//each profile is a template parameter of the fast cores, so a core is compiled per profile with no
+//test of the quirks left in its handlers, and a machine picks its profile when the rom is loaded
+enum class quirk_profile : uint8_t
+{
+    modern, // the behavior of this emulator so far, what most games are tested against today
+    cosmac_vip, // the original interpreter of the COSMAC VIP
+    chip48, // CHIP-48 on the HP-48
+    superchip, // SUPER-CHIP 1.1 on the HP-48
+    xochip // XO-CHIP as run by Octo
+};
+
+//instructions a profile runs on top of CHIP-8
+//without them the SUPER-CHIP and XO-CHIP instructions keep their CHIP-8 meaning, 00xx is an
+//ignored 0NNN, 5XY2 and 5XY3 are 5XY0 and the Fxxx ones are unknown instructions
+enum class instruction_set : uint8_t
+{
+    chip8,
+    superchip, // 128x64 high resolution, 00CN, 00FB, 00FC scrolls, DXY0 16x16 sprites, FX30, FX75, FX85 and 00FD
+    xochip // superchip with 64 KB of memory, two bit planes (FN01), 00DN, F000 NNNN, 5XY2, 5XY3 and audio patterns
+};
+
+//how far FX55 and FX65 move I
+enum class index_step : uint8_t
+{
+    x_plus_one, // I ends past the last register, as on the COSMAC VIP
+    x, // I ends on the last register, as on CHIP-48
+    none // I is left as it was
+};
+
+//the behaviors of a profile
+struct quirk_set
+{
+    bool logic_resets_vf; // 8XY1, 8XY2 and 8XY3 clear VF
+    bool shift_reads_vy; // 8XY6 and 8XYE shift VY into VX instead of shifting VX
+    index_step load_store; // where FX55 and FX65 leave I
+    bool jump_reads_vx; // BXNN jumps to XNN + VX instead of BNNN to NNN + V0
+    bool add_index_sets_vf; // FX1E sets VF when I goes past 0xFFF
+    sprite_edge edge; // sprite edge of a machine given the profile
+    instruction_set instructions; // instructions past CHIP-8
+};
+
+constexpr quirk_set quirks_of(quirk_profile profile)
+{
+    switch(profile)
+    {
+        case quirk_profile::cosmac_vip:
+            return {true, true, index_step::x_plus_one, false, false, sprite_edge::clip, instruction_set::chip8};
+        case quirk_profile::chip48:
+            return {false, false, index_step::x, true, false, sprite_edge::clip, instruction_set::chip8};
+        case quirk_profile::superchip:
+            return {false, false, index_step::none, true, false, sprite_edge::clip, instruction_set::superchip};
+        case quirk_profile::xochip:
+            return {false, true, index_step::x_plus_one, false, false, sprite_edge::wrap, instruction_set::xochip};
+        default:
+            return {true, false, index_step::x_plus_one, false, true, sprite_edge::wrap, instruction_set::chip8};
+    }
+}
+
+//bytes of memory a profile addresses, 4 KB or the 64 KB of XO-CHIP
+constexpr uint32_t memory_size(const quirk_set& quirks)
+{
+    return quirks.instructions == instruction_set::xochip ? 0x10000 : 0x1000;
+}
+
+//mask of the program counter and of the addresses of the fast core
+constexpr uint16_t address_mask(const quirk_set& quirks)
+{
+    return static_cast<uint16_t>(memory_size(quirks) - 1);
+}
+
+//how far FX55 and FX65 with registers V0..VX move I
+constexpr uint16_t index_advance(const quirk_set& quirks, uint8_t x)
+{
+    return quirks.load_store == index_step::x_plus_one ? x + 1 : (quirks.load_store == index_step::x ? x : 0);
+}
+
+//call function with the profile as a compile time constant, std::integral_constant<quirk_profile, ...>,
+//so a run picks the code of its profile once instead of testing the quirks on every instruction
+template<typename function>
+decltype(auto) with_quirk_profile(quirk_profile profile, function&& call)
+{
+    switch(profile)
+    {
+        case quirk_profile::cosmac_vip:
+            return call(std::integral_constant<quirk_profile, quirk_profile::cosmac_vip>());
+        case quirk_profile::chip48:
+            return call(std::integral_constant<quirk_profile, quirk_profile::chip48>());
+        case quirk_profile::superchip:
+            return call(std::integral_constant<quirk_profile, quirk_profile::superchip>());
+        case quirk_profile::xochip:
+            return call(std::integral_constant<quirk_profile, quirk_profile::xochip>());
+        default:
+            return call(std::integral_constant<quirk_profile, quirk_profile::modern>());
+    }
+}
+
+const char* quirk_profile_name(quirk_profile profile);
+
+bool parse_quirk_profile(const std::string& name, quirk_profile& profile); // false for an unknown name
+
+//xor height rows of sprite data onto a 64x32 display at (x, y), one word per row with bit 63 at x = 0
+//true when a lit pixel is erased
+bool xor_sprite(uint64_t* display, const uint8_t* rows, uint8_t x, uint8_t y, uint8_t height, sprite_edge edge);
+
+//the same on one bit plane of a machine display, 64x32 or 128x64 (high), with 8 pixel wide sprites
+//of one byte per row or 16 pixel wide ones (wide) of two bytes per row
+bool xor_plane_sprite(uint64_t* plane, bool high, const uint8_t* rows, uint8_t x, uint8_t y, uint8_t height, bool wide,
+                      sprite_edge edge);
+
+//bytes of memory, a whole 64 KB for XO-CHIP. the machines stay one size, but the memory past the
+//first 4 KB is only brought into use by XO-CHIP or a rom reaching past it (see chip8::extend_memory),
+//other machines never touch, copy or snapshot it
+constexpr size_t chip8_memory_size = 0x10000;
+
+//bytes of memory of a machine that has not brought the rest into use
+constexpr size_t chip8_base_memory_size = 0x1000;
+
+//addresses of the 5 byte font (FX29) and of the 10 byte high resolution font (FX30)
+constexpr uint16_t font_address = 80;
+constexpr uint16_t big_font_address = 160;
+
+//levels of the call stack, 16 as on most interpreters, build with CHIP8_STACK_DEPTH to change it
+#ifndef CHIP8_STACK_DEPTH
+#define CHIP8_STACK_DEPTH 16
+#endif
+constexpr size_t chip8_stack_depth = CHIP8_STACK_DEPTH;
+static_assert(chip8_stack_depth > 0 && chip8_stack_depth <= 255, "the stack pointer is a byte");
+
+//state of the CXNN random number generator of a new machine and of seed 0, never 0
+constexpr uint32_t default_random_state = 0x2545F491;
+
+//bytes of a rom, to tell the rom a save state or a movie was made with
+uint64_t rom_hash(const uint8_t* data, size_t size);
+
+inline uint64_t rom_hash(const std::vector<uint8_t>& rom) { return rom_hash(rom.data(), rom.size()); }
+
+//instructions per 60 Hz frame unless set otherwise, a 600 Hz cpu
+constexpr uint32_t default_instructions_per_frame = 10;
+
+//build with CHIP8_REFERENCE_DISPATCH to make the nested switch the default
+#ifdef CHIP8_REFERENCE_DISPATCH
+constexpr dispatch_mode default_dispatch_mode = dispatch_mode::reference;
+#else
+constexpr dispatch_mode default_dispatch_mode = dispatch_mode::table;
+#endif
 
 
 class chip8 
 {
+    friend class block_cache;
+    friend class jit_compiler;
+    friend class lockstep_engine;
+
     private:
         //cpu
         uint16_t pc_counter; // program counter
         uint16_t I; // index register
-        std::stack<uint16_t> stack_memory; // stack
+        std::array<uint16_t, chip8_stack_depth> stack_memory; // stack, kept inline so the machine is trivially copyable
+        uint8_t stack_pointer; // levels of stack_memory in use
         uint8_t delay_timer, sound_timer; // delay timer ,sound timer
         std::array<uint8_t, 16> V; // registers
 
-        //memory
-        std::array<uint8_t, 4096> memory;
+        //display, one bit plane per bit of the color of a pixel, rows of one word per 64 pixels with
+        //bit 63 of the first word the leftmost pixel: 32 rows of one word in low resolution, 64 rows
+        //of two words in high resolution
+        std::array<std::array<uint64_t, 128>, 2> display;
+
+        bool high_resolution; // 128x64 instead of 64x32 (00FF, 00FE)
+
+        uint8_t selected_planes; // bit planes drawn, cleared and scrolled (FN01), plane 1 unless changed
+
+        std::array<uint8_t, 16> flags; // registers saved by FX75 and loaded by FX85
 
-        //display
-        std::array<uint8_t, 64 * 32> display;
+        std::array<uint8_t, 16> audio_pattern; // 128 one bit samples played while the sound timer runs (F002)
+
+        uint8_t audio_pitch; // playback rate of the audio pattern (FX3A), 64 is 4000 samples per second
+
+        sprite_edge edge; // sprite pixels past the edge of the screen
+
+        quirk_profile quirks; // behavior of the instructions interpreters disagree on
 
         //keypad
         std::array<uint8_t, 16> keypad;
@@ -32,18 +237,115 @@ class chip8
 
         bool draw_flag; // draw flag
 
+        uint32_t random_state; // xorshift state behind CXNN, saved with the machine so runs can be replayed
+
+        uint64_t cycle_count; // number of cycles excuted since power on
+
+        uint32_t instructions_per_frame; // cycles per 60 Hz timer tick
+        uint64_t timer_frame; // frame the timers were last updated to
+
+        uint8_t random_byte(); // next byte of the CXNN generator
+
+        void update_timers(); // apply the timer ticks due at the current cycle
+
+        uint8_t timer_after(uint8_t timer, uint64_t frame) const; // value of a timer at a later frame
+
+        dispatch_mode dispatch; // instruction dispatch used by chip8_cycle
+
+        bool idle; // the last run ended in a loop only a key, or nothing, can leave
+
+        bool idle_skipping; // idle loops retire the rest of a run at once, kept over resets
+
+        bool extended_memory; // the memory past chip8_base_memory_size is in use, zeroed when it was brought into use
+
+        void extend_memory(); // bring the memory past the first 4 KB into use
+
+        static size_t base_snapshot_size(); // bytes of a machine up to the end of its first 4 KB of memory, in words
+
+        //memory, the last member so the bytes of a machine using only its first 4 KB end with them
+        std::array<uint8_t, chip8_memory_size> memory;
+
+        void draw_sprite(uint8_t x, uint8_t y, uint8_t height); // xor the sprite at I onto the display, set VF
+
+        void draw_planes(uint8_t x, uint8_t y, uint8_t n); // DXYN of SUPER-CHIP and XO-CHIP, on the selected planes
+
+        uint16_t sprite_length(uint8_t n) const; // bytes of sprite data read by draw_planes
+
+        void clear_planes(); // clear the selected planes
+
+        void set_resolution(bool high); // switch between 64x32 and 128x64, clearing the display
+
+        void scroll_down(uint8_t rows); // move the selected planes down, blank rows coming in at the top
+
+        void scroll_up(uint8_t rows); // move the selected planes up, blank rows coming in at the bottom
+
+        void scroll_right(); // move the selected planes 4 pixels right
+
+        void scroll_left(); // move the selected planes 4 pixels left
+
+        uint16_t skip_length(uint16_t address) const; // bytes a taken skip jumps over, 4 for F000 NNNN
+
+        void retire_instruction(); // count the cycle
+
+        void retire_instructions(uint64_t count); // count several cycles
+
+        uint64_t skip_delay_poll(uint16_t address, uint8_t x, uint64_t count); // retire the iterations of a loop polling the delay timer
+
+        cycle_status run_table(uint64_t count); // table driven dispatch loop, for the profile of the machine
+
+        cycle_status run_table(uint64_t count, opcode_profiler& profiler); // dispatch loop reporting every instruction to profiler
+
+        cycle_status run_table(uint64_t count, trace_probe& probe); // dispatch loop recording every instruction
+
+        template<quirk_profile profile, typename profiler_policy>
+        cycle_status run_table(uint64_t count, profiler_policy& profiler); // dispatch loop of one profile
+
+        template<typename profiler_policy>
+        cycle_status run_reference(uint64_t count, profiler_policy& profiler); // reference switch loop reporting to profiler
+
+        cycle_status run_blocks(block_cache& cache, uint64_t count); // run pre-decoded blocks of instructions
+
+        template<quirk_profile profile>
+        cycle_status run_blocks(block_cache& cache, uint64_t count); // block loop of one profile
+
     public:
         chip8(); // constructor
 
+        void reset(); // make the machine a new one again, without touching the memory past the first 4 KB
+
         void chip8_init(); // initialize the chip8
 
         bool load_rom(const std::string rom_path); // load the rom
 
+        bool load_program(const uint8_t* data, size_t size); // load a rom image already in memory
+
         uint16_t fetch_instruction(); // fetch instruction
 
         void decode_excute(uint16_t instruction); // decode and excute instruction
 
-        uint8_t get_screent_pixels(int x, int y); // get the screen pixels
+        uint8_t get_screent_pixels(int x, int y); // get the screen pixels, the bit of plane 1 and the bit of plane 2 above it
+
+        uint64_t get_display_row(int y) const { return display[0].at(y); } // get a row of the 64x32 screen, bit 63 is x = 0
+
+        uint64_t get_display_word(int plane, int y, int word) const { return display.at(plane).at(y * (high_resolution ? 2 : 1) + word); } // get 64 pixels of a plane
+
+        bool is_high_resolution() const { return high_resolution; } // true in 128x64
+
+        int get_display_width() const { return high_resolution ? 128 : 64; } // pixels per row
+
+        int get_display_height() const { return high_resolution ? 64 : 32; } // rows
+
+        const std::array<uint8_t, 16>& get_audio_pattern() const { return audio_pattern; } // samples of the sound, the first one in bit 7 of byte 0
+
+        double get_audio_rate() const; // samples of the audio pattern played per second
+
+        void set_sprite_edge(sprite_edge mode) { edge = mode; } // clip or wrap sprites at the screen edges
+
+        sprite_edge get_sprite_edge() const { return edge; } // get the sprite edge behavior
+
+        void set_quirk_profile(quirk_profile profile); // select the quirks, the sprite edge follows the profile
+
+        quirk_profile get_quirk_profile() const { return quirks; } // get the quirk profile
         
         void set_keypad(uint8_t key, uint8_t value); // set the keypad
 
@@ -51,8 +353,72 @@ class chip8
 
         void clear_draw_flag(); // clear the draw flag
 
-        void chip8_cycle(); // chip8 cycle
+        cycle_status chip8_cycle(); // chip8 cycle
+
+        cycle_status run_cycles(uint64_t count); // run count cycles back to back
+
+        bool is_idle() const { return idle; } // true when the last run ended waiting for a key or jumping to itself
+
+        void set_idle_skipping(bool skip) { idle_skipping = skip; } // retire idle loops at once or run every cycle of them
+
+        bool get_idle_skipping() const { return idle_skipping; } // true when idle loops are retired at once
+
+        cycle_status run_cycles(uint64_t count, opcode_profiler& profiler); // run count cycles, counting them in profiler
+
+        cycle_status run_cycles(uint64_t count, trace_recorder& tracer); // run count cycles, recording every instruction in tracer
+
+        void set_instructions_per_frame(uint32_t count); // cycles per 60 Hz timer tick, at least 1
+
+        uint32_t get_instructions_per_frame() const { return instructions_per_frame; } // get the cycles per frame
+
+        void save_snapshot(chip8_snapshot& snapshot) const; // copy the machine into snapshot, the first get_snapshot_size() bytes
+
+        size_t get_snapshot_size() const; // bytes of the machine in use, a whole number of words
+
+        void restore_snapshot(const chip8_snapshot& snapshot); // make the machine the one saved in snapshot
+
+        bool write_state(std::ostream& out, const std::vector<uint8_t>& rom) const; // save the machine in the state file format
+
+        bool read_state(std::istream& in, const std::vector<uint8_t>& rom); // restore a machine saved by write_state for the same rom
+
+        uint64_t state_hash() const; // hash of the machine, equal for equal machines whatever core ran them
+
+        uint64_t get_frame_count() const { return cycle_count / instructions_per_frame; } // frames completed
+
+        void set_dispatch_mode(dispatch_mode mode) { dispatch = mode; } // select the instruction dispatch
+
+        dispatch_mode get_dispatch_mode() const { return dispatch; } // get the instruction dispatch
 
         uint8_t helper_functions(uint16_t instruction); // get the first four bits of the instruction 
 
-};
\ No newline at end of file
+        //state accessors, used by the headless runner to dump the machine
+        uint16_t get_pc() const { return pc_counter; } // get the program counter
+        uint16_t get_I() const { return I; } // get the index register
+        uint8_t get_V(uint8_t index) const { return V.at(index); } // get register VX
+        uint8_t get_delay_timer() const { return timer_after(delay_timer, get_frame_count()); } // get the delay timer
+        uint8_t get_sound_timer() const { return timer_after(sound_timer, get_frame_count()); } // get the sound timer
+        uint64_t get_cycle_count() const { return cycle_count; } // get the number of excuted cycles
+        uint32_t get_random_state() const { return random_state; } // get the state of the CXNN generator
+
+        void set_random_seed(uint32_t seed); // restart the CXNN generator, the same seed gives the same bytes
+        uint8_t get_stack_pointer() const { return stack_pointer; } // get the levels of the stack in use
+        uint16_t get_stack_entry(uint8_t level) const { return stack_memory.at(level); } // get a return address, 0 is the oldest
+
+};
+
+//xorshift32, the top byte is used as the low bits are the weakest
+inline uint8_t chip8::random_byte()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return static_cast<uint8_t>(random_state >> 24);
+}
+
+//a whole machine, every register, the stack, timers, memory, display, keypad and random state
+//the machine is trivially copyable, so saving and restoring is a single copy of its bytes, only the
+//bytes in use: a machine without XO-CHIP memory stops 4 KB into its memory
+struct chip8_snapshot
+{
+    alignas(chip8) unsigned char bytes[sizeof(chip8)];
+};
@@ -0,0 +1,517 @@
+//instruction handlers of the fast core
+//not a standalone file: included inside the dispatch of a loop, see fast_core.hpp
+//skips go through CHIP8_SKIP so a loop can leave early when a skip is taken, and the timer
+//instructions call CHIP8_SYNC_TIMERS first so a loop may retire instructions lazily, the timers
+//being derived from the cycle count
+//a loop that would run on with nothing changing but the cycle count goes through CHIP8_IDLE, and
+//FX07 through CHIP8_POLL_DELAY, so a loop may retire the idle cycles at once
+//the loop also defines quirk, the quirk_set of the profile it is compiled for, so the tests of the
+//quirks are settled at compile time
+
+CHIP8_OP(OP_00E0)
+{
+    clear_planes();
+    draw_flag = true;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00EE)
+{
+    if(stack_pointer == 0)
+    {
+        CHIP8_FAULT(stack_underflow);
+    }
+    pc_counter = stack_memory[--stack_pointer];
+    CHIP8_NEXT();
+}
+
+//0NNN (machine code routine) is not supported, same as the reference switch
+CHIP8_OP(OP_0NNN)
+{
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_1NNN)
+{
+    //a jump to itself runs for ever
+    if(CHIP8_NNN == ((CHIP8_NEXT_PC - 2) & address_mask(quirk)))
+    {
+        CHIP8_IDLE();
+    }
+    pc_counter = CHIP8_NNN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_2NNN)
+{
+    if(stack_pointer == chip8_stack_depth)
+    {
+        CHIP8_FAULT(stack_overflow);
+    }
+    stack_memory[stack_pointer++] = pc_counter;
+    pc_counter = CHIP8_NNN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_3XNN)
+{
+    if(CHIP8_V(CHIP8_X) == CHIP8_NN)
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_4XNN)
+{
+    if(CHIP8_V(CHIP8_X) != CHIP8_NN)
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_5XY0)
+{
+    if(CHIP8_V(CHIP8_X) == CHIP8_V(CHIP8_Y))
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_6XNN)
+{
+    CHIP8_V(CHIP8_X) = CHIP8_NN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_7XNN)
+{
+    CHIP8_V(CHIP8_X) += CHIP8_NN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY0)
+{
+    CHIP8_V(CHIP8_X) = CHIP8_V(CHIP8_Y);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY1)
+{
+    CHIP8_V(CHIP8_X) |= CHIP8_V(CHIP8_Y);
+    if constexpr(quirk.logic_resets_vf)
+    {
+        CHIP8_V(0xF) = 0;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY2)
+{
+    CHIP8_V(CHIP8_X) &= CHIP8_V(CHIP8_Y);
+    if constexpr(quirk.logic_resets_vf)
+    {
+        CHIP8_V(0xF) = 0;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY3)
+{
+    CHIP8_V(CHIP8_X) ^= CHIP8_V(CHIP8_Y);
+    if constexpr(quirk.logic_resets_vf)
+    {
+        CHIP8_V(0xF) = 0;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY4)
+{
+    uint16_t sum = CHIP8_V(CHIP8_X) + CHIP8_V(CHIP8_Y);
+    CHIP8_V(0xF) = (sum > 0xFF ? 1 : 0);
+    CHIP8_V(CHIP8_X) = sum & 0xFF;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY5)
+{
+    CHIP8_V(0xF) = (CHIP8_V(CHIP8_X) >= CHIP8_V(CHIP8_Y) ? 1 : 0);
+    CHIP8_V(CHIP8_X) -= CHIP8_V(CHIP8_Y);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY6)
+{
+    uint8_t source = quirk.shift_reads_vy ? CHIP8_V(CHIP8_Y) : CHIP8_V(CHIP8_X);
+    CHIP8_V(0xF) = source & 0x1;
+    CHIP8_V(CHIP8_X) = source >> 1;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XY7)
+{
+    CHIP8_V(0xF) = (CHIP8_V(CHIP8_Y) >= CHIP8_V(CHIP8_X) ? 1 : 0);
+    CHIP8_V(CHIP8_X) = CHIP8_V(CHIP8_Y) - CHIP8_V(CHIP8_X);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_8XYE)
+{
+    uint8_t source = quirk.shift_reads_vy ? CHIP8_V(CHIP8_Y) : CHIP8_V(CHIP8_X);
+    CHIP8_V(0xF) = source >> 7;
+    CHIP8_V(CHIP8_X) = static_cast<uint8_t>(source << 1);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_9XY0)
+{
+    if(CHIP8_V(CHIP8_X) != CHIP8_V(CHIP8_Y))
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_ANNN)
+{
+    I = CHIP8_NNN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_BNNN)
+{
+    pc_counter = CHIP8_NNN + CHIP8_V(quirk.jump_reads_vx ? CHIP8_X : 0);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_CXNN)
+{
+    CHIP8_V(CHIP8_X) = random_byte() & CHIP8_NN;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_DXYN)
+{
+    if constexpr(quirk.instructions == instruction_set::chip8)
+    {
+        uint8_t height = CHIP8_N;
+        CHIP8_CHECK_I(height);
+        draw_sprite(CHIP8_V(CHIP8_X), CHIP8_V(CHIP8_Y), height);
+    }else
+    {
+        CHIP8_CHECK_I(sprite_length(CHIP8_N));
+        draw_planes(CHIP8_V(CHIP8_X), CHIP8_V(CHIP8_Y), CHIP8_N);
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_EX9E)
+{
+    if(keypad[CHIP8_V(CHIP8_X) & 0xF])
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_EXA1)
+{
+    if(! keypad[CHIP8_V(CHIP8_X) & 0xF])
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX07)
+{
+    CHIP8_SYNC_TIMERS();
+    update_timers();
+    CHIP8_POLL_DELAY(CHIP8_X);
+    CHIP8_V(CHIP8_X) = delay_timer;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX0A)
+{
+    pc_counter -= 2;
+    bool pressed = false;
+    for(uint8_t key = 0; key < 16; key++)
+    {
+        if(keypad[key] != 0)
+        {
+            CHIP8_V(CHIP8_X) = key;
+            pc_counter += 2;
+            pressed = true;
+            break;
+        }
+    }
+    //the keys only change between runs, so with none pressed the wait takes the rest of the run
+    if(!pressed)
+    {
+        CHIP8_IDLE();
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX15)
+{
+    CHIP8_SYNC_TIMERS();
+    update_timers();
+    delay_timer = CHIP8_V(CHIP8_X);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX18)
+{
+    CHIP8_SYNC_TIMERS();
+    update_timers();
+    sound_timer = CHIP8_V(CHIP8_X);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX1E)
+{
+    if constexpr(quirk.add_index_sets_vf)
+    {
+        int sum = I + CHIP8_V(CHIP8_X);
+        CHIP8_V(0xF) = (sum > 0xFFF ? 1 : 0);
+    }
+    I += CHIP8_V(CHIP8_X);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX29)
+{
+    I = CHIP8_V(CHIP8_X) * 0x5 + font_address;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX33)
+{
+    CHIP8_CHECK_I(3);
+    uint8_t value = CHIP8_V(CHIP8_X);
+    CHIP8_MEM(I) = value / 100;
+    CHIP8_MEM(I + 1) = (value / 10) % 10;
+    CHIP8_MEM(I + 2) = value % 10;
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX55)
+{
+    CHIP8_CHECK_I(CHIP8_X + 1);
+    for(int i = 0; i <= CHIP8_X; i++)
+    {
+        CHIP8_MEM(I + i) = CHIP8_V(i);
+    }
+    I += index_advance(quirk, CHIP8_X);
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX65)
+{
+    CHIP8_CHECK_I(CHIP8_X + 1);
+    for(int i = 0; i <= CHIP8_X; i++)
+    {
+        CHIP8_V(i) = CHIP8_MEM(I + i);
+    }
+    I += index_advance(quirk, CHIP8_X);
+    CHIP8_NEXT();
+}
+
+//SUPER-CHIP and XO-CHIP instructions, the profiles without them get the CHIP-8 meaning instead:
+//00xx is an ignored 0NNN, 5XY2 and 5XY3 are 5XY0 and the Fxxx ones are unknown instructions
+CHIP8_OP(OP_00CN)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        scroll_down(CHIP8_N);
+        draw_flag = true;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00DN)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        scroll_up(CHIP8_N);
+        draw_flag = true;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00FB)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        scroll_right();
+        draw_flag = true;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00FC)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        scroll_left();
+        draw_flag = true;
+    }
+    CHIP8_NEXT();
+}
+
+//exit the interpreter, there being nothing to return to the machine stops on the instruction
+CHIP8_OP(OP_00FD)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        pc_counter -= 2;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00FE)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        set_resolution(false);
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_00FF)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        set_resolution(true);
+    }
+    CHIP8_NEXT();
+}
+
+//store VX..VY at I, in reverse order when X > Y, I is left as it was
+CHIP8_OP(OP_5XY2)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        int step = CHIP8_X <= CHIP8_Y ? 1 : -1;
+        int count = (CHIP8_Y - CHIP8_X) * step + 1;
+        CHIP8_CHECK_I(count);
+        for(int i = 0; i < count; i++)
+        {
+            CHIP8_MEM(I + i) = CHIP8_V(CHIP8_X + i * step);
+        }
+    }else if(CHIP8_V(CHIP8_X) == CHIP8_V(CHIP8_Y))
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+//load VX..VY from I, in reverse order when X > Y, I is left as it was
+CHIP8_OP(OP_5XY3)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        int step = CHIP8_X <= CHIP8_Y ? 1 : -1;
+        int count = (CHIP8_Y - CHIP8_X) * step + 1;
+        CHIP8_CHECK_I(count);
+        for(int i = 0; i < count; i++)
+        {
+            CHIP8_V(CHIP8_X + i * step) = CHIP8_MEM(I + i);
+        }
+    }else if(CHIP8_V(CHIP8_X) == CHIP8_V(CHIP8_Y))
+    {
+        CHIP8_SKIP();
+    }
+    CHIP8_NEXT();
+}
+
+//I = NNNN, the word after the instruction, which is stepped over
+CHIP8_OP(OP_F000)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        uint16_t address = CHIP8_NEXT_PC;
+        I = (CHIP8_MEM(address) << 8) | CHIP8_MEM((address + 1) & address_mask(quirk));
+        pc_counter = (address + 2) & address_mask(quirk);
+    }
+    CHIP8_NEXT();
+}
+
+//select the bit planes of the display instructions, X as a mask
+CHIP8_OP(OP_FN01)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        selected_planes = CHIP8_X & 0x3;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_F002)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        CHIP8_CHECK_I(16);
+        for(int i = 0; i < 16; i++)
+        {
+            audio_pattern[i] = CHIP8_MEM(I + i);
+        }
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX30)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        I = (CHIP8_V(CHIP8_X) & 0xF) * 10 + big_font_address;
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX3A)
+{
+    if constexpr(quirk.instructions == instruction_set::xochip)
+    {
+        audio_pitch = CHIP8_V(CHIP8_X);
+    }
+    CHIP8_NEXT();
+}
+
+//V0..VX to the flag registers, SUPER-CHIP has 8 of them and XO-CHIP 16
+CHIP8_OP(OP_FX75)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        int last = quirk.instructions == instruction_set::xochip || CHIP8_X < 8 ? CHIP8_X : 7;
+        for(int i = 0; i <= last; i++)
+        {
+            flags[i] = CHIP8_V(i);
+        }
+    }
+    CHIP8_NEXT();
+}
+
+CHIP8_OP(OP_FX85)
+{
+    if constexpr(quirk.instructions != instruction_set::chip8)
+    {
+        int last = quirk.instructions == instruction_set::xochip || CHIP8_X < 8 ? CHIP8_X : 7;
+        for(int i = 0; i <= last; i++)
+        {
+            CHIP8_V(i) = flags[i];
+        }
+    }
+    CHIP8_NEXT();
+}
+
+//unknown instructions are skipped silently
+CHIP8_OP(OP_INVALID)
+{
+    CHIP8_NEXT();
+}
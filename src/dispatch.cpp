@@ -0,0 +1,214 @@
+#include "chip8.hpp"
+#include "fast_core.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+
+//table driven dispatch
+//every instruction is resolved to its handler once, at compile time, by opcode_table
+//with gcc/clang the handlers are threaded with computed goto, each handler fetching and
+//jumping straight to the next one, otherwise a dense switch over the opcode class is used
+
+namespace
+{
+    constexpr std::array<uint8_t, 65536> build_opcode_table()
+    {
+        std::array<uint8_t, 65536> table{};
+        for(uint32_t instruction = 0; instruction < 65536; instruction++)
+        {
+            table[instruction] = classify_opcode(static_cast<uint16_t>(instruction));
+        }
+        return table;
+    }
+
+    const char* const opcode_names[OP_COUNT] = {
+#define CHIP8_OPCODE_NAME(name) #name + 3,
+        CHIP8_OPCODE_LIST(CHIP8_OPCODE_NAME)
+#undef CHIP8_OPCODE_NAME
+    };
+}
+
+constexpr std::array<uint8_t, 65536> opcode_table = build_opcode_table();
+
+const char* opcode_name(uint8_t op)
+{
+    return op < OP_COUNT ? opcode_names[op] : "????";
+}
+
+//instruction fields of the fast core
+#define CHIP8_X opcode_x(instruction)
+#define CHIP8_Y opcode_y(instruction)
+#define CHIP8_N opcode_n(instruction)
+#define CHIP8_NN opcode_nn(instruction)
+#define CHIP8_NNN opcode_nnn(instruction)
+
+#define CHIP8_NEXT_PC pc_counter
+
+#define CHIP8_SKIP() pc_counter = (pc_counter + CHIP8_SKIP_LENGTH(pc_counter)) & address_mask(quirk)
+
+//every instruction is retired as it completes, so the cycle count is always up to date
+#define CHIP8_SYNC_TIMERS()
+
+//an instruction that would run again and again, changing nothing but the cycle count, retires the
+//rest of the run at once. the profiler and the tracer see every instruction, so only the plain
+//loop skips, and only while idle skipping is on
+#define CHIP8_IDLE() \
+    if constexpr(!profiler_policy::enabled) \
+    { \
+        if(idle_skipping) { retire_instructions(count - 1); count = 1; idle = true; } \
+    }
+
+//the whole iterations of a loop polling the delay timer that cannot see it change are retired at
+//once, the FX07 then reading the timer of the iteration the loop may be left at
+#define CHIP8_POLL_DELAY(x) \
+    if constexpr(!profiler_policy::enabled) \
+    { \
+        uint64_t skipped = idle_skipping ? \
+            skip_delay_poll(static_cast<uint16_t>((pc_counter - 2) & address_mask(quirk)), x, count) : 0; \
+        if(skipped != 0) { count -= skipped; update_timers(); } \
+    }
+
+//the profiler calls are discarded at compile time unless the policy is enabled
+#define CHIP8_FETCH() \
+    instruction = (CHIP8_MEM(pc_counter & address_mask(quirk)) << 8) | CHIP8_MEM((pc_counter + 1) & address_mask(quirk)); \
+    if constexpr(profiler_policy::enabled) { profiler.begin(pc_counter, opcode_table[instruction]); } \
+    pc_counter = (pc_counter + 2) & address_mask(quirk)
+
+#define CHIP8_RETIRE() \
+    if constexpr(profiler_policy::enabled) { profiler.end(); } \
+    retire_instruction()
+
+#if CHIP8_COMPUTED_GOTO
+#define CHIP8_DISPATCH(op) goto *labels[op];
+#define CHIP8_OP(name) label_##name:
+#define CHIP8_NEXT() \
+    CHIP8_RETIRE(); \
+    if(--count == 0) return cycle_status::ok; \
+    CHIP8_FETCH(); \
+    goto *labels[opcode_table[instruction]]
+#else
+#define CHIP8_DISPATCH(op) switch(op)
+#define CHIP8_OP(name) case name:
+#define CHIP8_NEXT() break
+#endif
+
+//run count instructions with the table dispatch of one quirk profile, stopping early on a fault
+template<quirk_profile profile, typename profiler_policy>
+cycle_status chip8::run_table(uint64_t count, profiler_policy& profiler)
+{
+    constexpr quirk_set quirk = quirks_of(profile);
+
+    idle = false;
+    if(count == 0)
+    {
+        return cycle_status::ok;
+    }
+
+#if CHIP8_COMPUTED_GOTO
+    CHIP8_LABEL_TABLE(labels);
+#endif
+
+    uint16_t instruction;
+    CHIP8_FETCH();
+    for(;;)
+    {
+        CHIP8_DISPATCH(opcode_table[instruction])
+        {
+#include "chip8_ops.inl"
+        }
+
+#if !CHIP8_COMPUTED_GOTO
+        CHIP8_RETIRE();
+        if(--count == 0)
+        {
+            return cycle_status::ok;
+        }
+        CHIP8_FETCH();
+#endif
+    }
+}
+
+//the loop of the machine's profile is picked once per run
+cycle_status chip8::run_table(uint64_t count)
+{
+    no_profiler profiler;
+    return with_quirk_profile(quirks, [&](auto profile) {
+        return run_table<decltype(profile)::value>(count, profiler);
+    });
+}
+
+cycle_status chip8::run_table(uint64_t count, opcode_profiler& profiler)
+{
+    return with_quirk_profile(quirks, [&](auto profile) {
+        return run_table<decltype(profile)::value>(count, profiler);
+    });
+}
+
+cycle_status chip8::run_table(uint64_t count, trace_probe& probe)
+{
+    return with_quirk_profile(quirks, [&](auto profile) {
+        return run_table<decltype(profile)::value>(count, probe);
+    });
+}
+
+//the reference switch, a whole chip8_cycle per instruction, reported to the profiler around it
+//the reference never skips idle loops, so a run ends idle only after the table loop
+template<typename profiler_policy>
+cycle_status chip8::run_reference(uint64_t count, profiler_policy& profiler)
+{
+    idle = false;
+    uint16_t mask = address_mask(quirks_of(quirks));
+    while(count-- > 0)
+    {
+        if constexpr(profiler_policy::enabled)
+        {
+            uint16_t instruction = (memory[pc_counter & mask] << 8) | memory[(pc_counter + 1) & mask];
+            profiler.begin(pc_counter, opcode_table[instruction]);
+        }
+        cycle_status status = chip8_cycle();
+        if(status != cycle_status::ok)
+        {
+            return status;
+        }
+        profiler.end();
+    }
+    return cycle_status::ok;
+}
+
+//run count cycles with the selected dispatch, stopping early on a fault
+cycle_status chip8::run_cycles(uint64_t count)
+{
+    if(dispatch == dispatch_mode::reference)
+    {
+        no_profiler profiler;
+        return run_reference(count, profiler);
+    }
+
+    return run_table(count);
+}
+
+//run count cycles with the selected dispatch, counting every instruction in profiler
+//the reference dispatch is timed around a whole chip8_cycle, fetch and decode_excute
+cycle_status chip8::run_cycles(uint64_t count, opcode_profiler& profiler)
+{
+    if(dispatch == dispatch_mode::reference)
+    {
+        return run_reference(count, profiler);
+    }
+
+    return run_table(count, profiler);
+}
+
+//run count cycles with the selected dispatch, recording every instruction in tracer
+//the reference dispatch is recorded around a whole chip8_cycle like the profiled one
+cycle_status chip8::run_cycles(uint64_t count, trace_recorder& tracer)
+{
+    quirk_set quirk = quirks_of(quirks);
+    trace_probe probe{tracer, V.data(), &I, memory.data(), &cycle_count, address_mask(quirk),
+                      quirk.instructions == instruction_set::xochip, {}, 0, {}};
+    if(dispatch == dispatch_mode::reference)
+    {
+        return run_reference(count, probe);
+    }
+
+    return run_table(count, probe);
+}
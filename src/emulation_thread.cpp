@@ -0,0 +1,266 @@
+#include "emulation_thread.hpp"
+#include <algorithm>
+#include <iostream>
+
+emulation_thread::emulation_thread(chip8& machine, movie& session, const emulation_settings& settings)
+    : machine(machine), session(session), settings(settings), stopping(false), history(settings.rewind_bytes),
+      rewinding(false), turbo(false), tracing(false), replaying(settings.replaying), next_event(0),
+      fault(cycle_status::ok)
+{
+    pace();
+}
+
+emulation_thread::~emulation_thread()
+{
+    stop();
+}
+
+bool emulation_thread::start()
+{
+    if(settings.tracing)
+    {
+        if(!tracer.open(settings.trace_path))
+        {
+            return false;
+        }
+        tracing = true;
+    }
+    stopping.store(false);
+    worker = std::thread(&emulation_thread::loop, this);
+    return true;
+}
+
+void emulation_thread::stop()
+{
+    if(worker.joinable())
+    {
+        stopping.store(true);
+        worker.join();
+    }
+    if(tracer.is_open())
+    {
+        uint64_t records = tracer.get_records();
+        if(tracer.close())
+        {
+            std::cerr << records << " instructions traced to " << settings.trace_path << std::endl;
+        }
+    }
+}
+
+void emulation_thread::send(const ui_command& command)
+{
+    while(!commands.push(command))
+    {
+        std::this_thread::yield();
+    }
+}
+
+void emulation_thread::press(uint8_t key, uint8_t value)
+{
+    machine.set_keypad(key, value);
+    if(settings.recording)
+    {
+        session.events.push_back({machine.get_cycle_count(), key, value});
+    }
+}
+
+void emulation_thread::apply(const ui_command& command)
+{
+    switch(command.type)
+    {
+        case ui_command_type::key:
+            //a replay plays its own keys until it ends
+            if(!replaying)
+            {
+                press(command.key, command.value);
+                if(pending_input == std::chrono::steady_clock::time_point())
+                {
+                    pending_input = command.time;
+                }
+            }
+            break;
+
+        case ui_command_type::rewind:
+            if(settings.rewind_bytes == 0 || (command.value != 0) == rewinding)
+            {
+                break;
+            }
+            rewinding = command.value != 0;
+            pace();
+
+            //the keys changed after the frame stepped back to are dropped from a recording, the ui then
+            //sends the keys held now. a replay carries on from its keys at that frame
+            if(!rewinding && replaying)
+            {
+                next_event = std::lower_bound(session.events.begin(), session.events.end(), machine.get_cycle_count(),
+                    [](const key_event& event, uint64_t cycle) { return event.cycle < cycle; }) - session.events.begin();
+            }else if(!rewinding)
+            {
+                while(settings.recording && !session.events.empty() && session.events.back().cycle >= machine.get_cycle_count())
+                {
+                    session.events.pop_back();
+                }
+            }
+            break;
+
+        case ui_command_type::turbo:
+            turbo = command.value != 0;
+            pace();
+            break;
+
+        case ui_command_type::trace:
+            if(tracing || tracer.is_open() || tracer.open(settings.trace_path))
+            {
+                tracing = !tracing;
+                if(tracing)
+                {
+                    std::cerr << "Tracing to " << settings.trace_path << std::endl;
+                }else
+                {
+                    std::cerr << "Tracing stopped, " << tracer.get_records() << " instructions traced so far" << std::endl;
+                }
+            }
+            break;
+    }
+}
+
+//holding the rewind key steps back one recorded frame per frame at 60 Hz, whatever the speed
+void emulation_thread::pace()
+{
+    clock.set_speed(rewinding ? 1.0 : turbo ? settings.turbo_speed : settings.speed);
+    clock.start();
+}
+
+cycle_status emulation_thread::run_cycles(uint64_t count)
+{
+    if(tracing)
+    {
+        return machine.run_cycles(count, tracer);
+    }
+    return settings.profile ? machine.run_cycles(count, profiler) : machine.run_cycles(count);
+}
+
+//a replay changes the keys at the cycles they were recorded at, in the middle of a frame if need be
+cycle_status emulation_thread::run(uint64_t count)
+{
+    for(;;)
+    {
+        uint64_t slice = count;
+        if(replaying)
+        {
+            const std::vector<key_event>& events = session.events;
+            for(; next_event < events.size() && events[next_event].cycle <= machine.get_cycle_count(); next_event++)
+            {
+                machine.set_keypad(events[next_event].key, events[next_event].value);
+            }
+            if(next_event < events.size())
+            {
+                slice = std::min(count, events[next_event].cycle - machine.get_cycle_count());
+            }
+        }
+        cycle_status status = run_cycles(slice);
+        count -= slice;
+        if(status != cycle_status::ok || count == 0)
+        {
+            return status;
+        }
+    }
+}
+
+void emulation_thread::publish()
+{
+    video_frame& frame = frames.get_back();
+    frame.high_resolution = machine.is_high_resolution();
+    int words = frame.high_resolution ? 2 : 1;
+    for(int plane = 0; plane < 2; plane++)
+    {
+        for(int y = 0; y < machine.get_display_height(); y++)
+        {
+            for(int word = 0; word < words; word++)
+            {
+                frame.planes[plane][y * words + word] = machine.get_display_word(plane, y, word);
+            }
+        }
+    }
+    frame.frame = machine.get_frame_count();
+    frame.cycles = machine.get_cycle_count();
+    machine.clear_draw_flag();
+    frame.input_time = pending_input;
+    pending_input = std::chrono::steady_clock::time_point();
+    frames.publish();
+}
+
+//the audio pattern is played once an XO-CHIP rom has loaded one, other roms beep
+void emulation_thread::push_audio()
+{
+    audio_state state;
+    state.on = fault == cycle_status::ok && machine.get_sound_timer() != 0;
+    state.samples = machine.get_audio_pattern();
+    state.pattern = quirks_of(machine.get_quirk_profile()).instructions == instruction_set::xochip &&
+                    std::any_of(state.samples.begin(), state.samples.end(), [](uint8_t byte) { return byte != 0; });
+    state.rate = machine.get_audio_rate();
+    sounds.push(state);
+}
+
+//the frames run are recorded for rewinding, at most 60 per second of wall time. a fault is reported once and pauses the machine, which
+//stepping back with the rewind key sets going again
+void emulation_thread::loop()
+{
+    clock.start();
+    publish();
+    while(!stopping.load(std::memory_order_relaxed))
+    {
+        ui_command command;
+        while(commands.pop(command))
+        {
+            apply(command);
+        }
+
+        //run the frames whose time has come, one at a time when unthrottled
+        uint32_t due = clock.frames_due();
+        for(uint32_t frame = 0; frame < due; frame++)
+        {
+            if(rewinding)
+            {
+                history.step_back(machine);
+                fault = cycle_status::ok;
+            }else if(fault == cycle_status::ok)
+            {
+                fault = clock.run_frame(machine, [this](uint64_t count) { return run(count); });
+                if(fault != cycle_status::ok)
+                {
+                    std::cerr << "Fault: " << cycle_status_name(fault) << ", the machine is paused"
+                              << (settings.rewind_bytes != 0 ? " until rewound" : "") << std::endl;
+                }
+                if(settings.rewind_bytes != 0 && clock.record_due())
+                {
+                    history.push(machine);
+                }
+            }
+            if(settings.audio)
+            {
+                push_audio();
+            }
+        }
+
+        if(replaying && !rewinding && machine.get_cycle_count() >= session.cycles)
+        {
+            std::cerr << "End of the replay, the keyboard takes over" << std::endl;
+            replaying = false;
+        }
+
+        //above real speed the frames the screen has no time for are skipped
+        if(due != 0 && clock.present_due())
+        {
+            publish();
+        }
+        clock.wait_for_frame((machine.is_idle() || fault != cycle_status::ok) && !rewinding);
+
+        //unthrottled, a machine waiting for a key, stopped on a jump to itself or paused at a fault is
+        //run at real speed
+        if((machine.is_idle() || fault != cycle_status::ok) && !rewinding)
+        {
+            clock.wait_while_idle([this]() { return commands.size() != 0 || stopping.load(std::memory_order_relaxed); });
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "chip8.hpp"
+#include "movie.hpp"
+#include "profiler.hpp"
+#include "rewind.hpp"
+#include "scheduler.hpp"
+#include "spsc_queue.hpp"
+#include "trace.hpp"
+#include "triple_buffer.hpp"
+
+//emulation thread
+//the machine runs on a thread of its own, paced by a scheduler, so a slow present or a flood of
+//window events never holds it back. the ui sends keys and requests through a single producer single
+//consumer queue, applied at the start of the next frame, and the emulation thread hands the
+//completed frames back through a triple buffer, the ui always drawing the newest one. above real
+//speed only 60 frames per second of wall time are handed back, the ones in between are skipped
+//
+//every frame run also sends the state of the sound to the audio callback through a second queue, as
+//the callback may not take a lock
+//
+//every input carries the time it happened at, and the first frame run after it carries that time to
+//the ui, which measures how long the input took to reach the screen
+
+//a completed frame, the display as the ui draws it
+struct video_frame
+{
+    std::array<std::array<uint64_t, 128>, 2> planes; // the words of chip8::get_display_word, y * words + word
+    bool high_resolution;
+    uint64_t frame; // frames the machine had completed
+    uint64_t cycles; // instructions the machine had run
+    std::chrono::steady_clock::time_point input_time; // the oldest input this frame is the first to follow, default for none
+};
+
+//the sound of a frame
+struct audio_state
+{
+    bool on; // the sound timer runs
+    bool pattern; // play the XO-CHIP audio pattern rather than the beep
+    std::array<uint8_t, 16> samples; // the audio pattern
+    double rate; // samples of the pattern per second
+};
+
+enum class ui_command_type : uint8_t
+{
+    key, // a key of the keypad changes to value
+    rewind, // rewinding starts (value 1) or stops (value 0)
+    turbo, // running at the turbo speed starts (value 1) or stops (value 0)
+    trace // tracing starts or stops
+};
+
+//a request of the ui
+struct ui_command
+{
+    ui_command_type type;
+    uint8_t key;
+    uint8_t value;
+    std::chrono::steady_clock::time_point time; // when the input happened
+};
+
+struct emulation_settings
+{
+    double speed = 1.0; // multiple of real speed, 0 for frames back to back
+    double turbo_speed = 0.0; // speed while the turbo is on, 0 for frames back to back
+    bool profile = false; // count the instructions in the profiler
+    size_t rewind_bytes = rewind_buffer::default_capacity; // history kept for rewinding, 0 for none
+    bool recording = false; // record the keys in the movie
+    bool replaying = false; // play the keys of the movie, the keyboard taking over at its end
+    std::string trace_path = "chip8.trace"; // file of the execution trace
+    bool tracing = false; // trace from the start
+    bool audio = false; // send the sound of every frame to pop_audio
+};
+
+class emulation_thread
+{
+    public:
+        //the machine and the movie belong to the thread from start to stop
+        emulation_thread(chip8& machine, movie& session, const emulation_settings& settings); // constructor
+
+        ~emulation_thread(); // destructor, stops the thread
+
+        emulation_thread(const emulation_thread&) = delete;
+        emulation_thread& operator=(const emulation_thread&) = delete;
+
+        bool start(); // start the thread, false when the trace to start with cannot be made
+
+        void stop(); // end the thread after its current frame and close the trace
+
+        //ui side
+        void send(const ui_command& command); // queue a command, waiting in the rare case the queue is full
+
+        bool update_frame() { return frames.update(); } // take the newest completed frame, false when none came since
+
+        const video_frame& get_frame() const { return frames.get_front(); } // the frame last taken
+
+        const opcode_profiler& get_profiler() const { return profiler; } // instructions counted, read after stop
+
+        //audio callback side
+        bool pop_audio(audio_state& state) { return sounds.pop(state); } // the sound of the oldest frame not taken yet, false when none
+
+    private:
+        void loop(); // the thread
+
+        void apply(const ui_command& command); // carry out a command of the ui
+
+        void press(uint8_t key, uint8_t value); // a keyboard key, recorded by the cycle it changes before
+
+        cycle_status run_cycles(uint64_t count); // run on the table core, traced or profiled as asked
+
+        cycle_status run(uint64_t count); // run_cycles, applying the keys of a replay at their cycles
+
+        void publish(); // hand the display to the ui
+
+        void pace(); // set the speed of the scheduler, real speed while rewinding
+
+        void push_audio(); // send the sound of the frame, dropped when the callback is that far behind
+
+        chip8& machine;
+        movie& session;
+        emulation_settings settings;
+
+        spsc_queue<ui_command, 256> commands;
+        triple_buffer<video_frame> frames;
+        spsc_queue<audio_state, 64> sounds;
+
+        std::thread worker;
+        std::atomic<bool> stopping;
+
+        scheduler clock;
+        rewind_buffer history;
+        trace_recorder tracer;
+        opcode_profiler profiler;
+
+        bool rewinding; // the rewind key is held, every frame steps back one recorded frame
+        bool turbo; // running at the turbo speed
+        bool tracing;
+        bool replaying;
+        size_t next_event; // next key of the replay
+        cycle_status fault; // the fault the machine is paused at, ok while it runs, cleared by rewinding
+        std::chrono::steady_clock::time_point pending_input; // oldest input applied since the last frame was published
+};
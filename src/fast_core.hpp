@@ -0,0 +1,61 @@
+#pragma once
+
+#include "chip8.hpp"
+
+//shared pieces of the fast core
+//the handlers in chip8_ops.inl are included into each dispatch loop (dispatch.cpp, block_cache.cpp),
+//the loop defines how fields are read (CHIP8_X, CHIP8_Y, CHIP8_N, CHIP8_NN, CHIP8_NNN), how
+//handlers are entered and left (CHIP8_OP, CHIP8_NEXT, CHIP8_SKIP), the address after the current
+//instruction (CHIP8_NEXT_PC) and when cycles are retired (CHIP8_SYNC_TIMERS)
+//
+//the fast core never throws: addresses are masked to the memory of the profile (12 bits, 16 bits
+//with XO-CHIP), key indices to 4 bits, and
+//faults (stack underflow or overflow, I running past the end of memory) are returned as a cycle_status
+//with the faulting instruction dropped, as the reference switch does on an exception
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+
+//computed goto targets of every handler, in opcode_class order
+#define CHIP8_OPCODE_LABEL(name) &&label_##name,
+#define CHIP8_LABEL_TABLE(labels) \
+    static const void* const labels[OP_COUNT] = { CHIP8_OPCODE_LIST(CHIP8_OPCODE_LABEL) }
+
+//register and memory access of the fast core
+//the handlers mask or range check every index themselves, the checked build (CHIP8_CHECKED_CORE,
+//on in debug builds) goes through at() instead so a missing check throws instead of going unnoticed
+#ifdef CHIP8_CHECKED_CORE
+#define CHIP8_V(index) V.at(index)
+#define CHIP8_MEM(address) memory.at(address)
+#else
+#define CHIP8_V(index) V[index]
+#define CHIP8_MEM(address) memory[address]
+#endif
+
+//drop the current instruction and report the fault
+#define CHIP8_FAULT(status) return cycle_status::status
+
+//fault unless the length bytes starting at I are all in the memory of the profile
+#define CHIP8_CHECK_I(length) \
+    if(static_cast<uint32_t>(I + (length)) > memory_size(quirk)) { CHIP8_FAULT(address_fault); }
+
+//bytes a taken skip jumps over from address, the whole of a 4 byte F000 NNNN with XO-CHIP
+#define CHIP8_SKIP_LENGTH(address) \
+    (quirk.instructions == instruction_set::xochip && CHIP8_MEM((address) & address_mask(quirk)) == 0xF0 && \
+     CHIP8_MEM(((address) + 1) & address_mask(quirk)) == 0x00 ? 4 : 2)
+
+//account for one excuted instruction
+//the timers follow the cycle count, they are brought up to date when read or written (update_timers)
+inline void chip8::retire_instruction()
+{
+    cycle_count++;
+}
+
+//account for count excuted instructions at once
+inline void chip8::retire_instructions(uint64_t count)
+{
+    cycle_count += count;
+}
@@ -0,0 +1,600 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+
+#include "chip8.hpp"
+#include "runner.hpp"
+#include "block_cache.hpp"
+#include "jit.hpp"
+#include "lockstep.hpp"
+#include "rom_library.hpp"
+
+//differential fuzzer
+//generates programs, random ones and mutations of the roms of a directory, runs each of them on two
+//cores side by side and compares the hash of the whole machine every --checkpoint cycles. the cores
+//get the same CXNN seed and the same key script, so any difference is a difference of the cores
+//
+//the lockstep core runs the program on lockstep_lanes lanes of a lockstep engine, lane 0 playing the
+//key script and every other lane the same script on other keys, so the lanes branch apart and come
+//back together as they read the keys. lane 0 is the machine compared
+//
+//a divergence is narrowed down to the first cycle the machines differ at, then the program is shrunk
+//while it still diverges by that cycle: bytes are cut from its end and zeroed in ever smaller chunks.
+//the minimal rom, its key script and the command lines replaying it on chip8_headless are written out
+
+#ifndef CHIP8_ROM_DIR
+#define CHIP8_ROM_DIR "roms"
+#endif
+
+namespace
+{
+    //programs are kept to what a 4 KB machine can load
+    const size_t fuzz_rom_limit = 4096 - 512;
+
+    //lanes of the lockstep core, lane i pressing key + i where lane 0 presses key
+    const size_t lockstep_lanes = 4;
+
+    //xorshift64, the cases of a seed are the same on every platform
+    struct fuzz_random
+    {
+        uint64_t state;
+
+        uint64_t next()
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+
+        uint32_t below(uint32_t bound) { return static_cast<uint32_t>(next() % bound); } // 0 to bound - 1
+    };
+
+    //one of the two cores compared, the block and jit cores keep their caches between the slices of a case
+    //and the lockstep core its engine, which holds the machine run while machine follows lane 0
+    struct core_runner
+    {
+        std::string name;
+        block_cache cache;
+        jit_compiler compiler;
+        std::unique_ptr<lockstep_engine> lanes;
+        uint64_t cycles = 0; // cycles run over every case
+        double seconds = 0;
+
+        //forget the blocks of the last program before a new one is loaded
+        void start(chip8& machine)
+        {
+            cache.flush();
+            compiler.flush();
+            bool reference = name == "reference" || name == "interp";
+            machine.set_dispatch_mode(reference ? dispatch_mode::reference : dispatch_mode::table);
+        }
+
+        //load the program into the lanes the way start_case loads it into machine
+        void load(const std::vector<uint8_t>& rom, quirk_profile quirks, sprite_edge edge, uint32_t ipf, uint32_t seed)
+        {
+            if(name != "lockstep")
+            {
+                return;
+            }
+            if(!lanes)
+            {
+                lanes.reset(new lockstep_engine(lockstep_lanes, 1, false));
+            }
+            lanes->set_quirk_profile(quirks);
+            lanes->set_sprite_edge(edge);
+            lanes->set_instructions_per_frame(ipf);
+            lanes->load_program(rom.data(), rom.size());
+            lanes->set_random_seed(seed);
+        }
+
+        void set_keypad(chip8& machine, uint8_t key, uint8_t value)
+        {
+            machine.set_keypad(key, value);
+            if(name == "lockstep")
+            {
+                for(size_t lane = 0; lane < lockstep_lanes; lane++)
+                {
+                    lanes->set_keypad(lane, static_cast<uint8_t>((key + lane) & 0xF), value);
+                }
+            }
+        }
+
+        cycle_status run(chip8& machine, uint64_t count)
+        {
+            //the reference core prints the unknown instructions it runs and the exceptions behind its faults
+            std::streambuf* errors = std::cerr.rdbuf(nullptr);
+
+            auto begin = std::chrono::steady_clock::now();
+            uint64_t before = machine.get_cycle_count();
+            cycle_status status;
+            if(name == "lockstep")
+            {
+                lanes->run(count);
+                lanes->export_machine(0, machine);
+                status = lanes->get_status(0);
+            }else if(name == "block")
+            {
+                status = cache.run(machine, count);
+            }else if(name == "jit")
+            {
+                status = compiler.run(machine, count);
+            }else
+            {
+                status = machine.run_cycles(count);
+            }
+            cycles += machine.get_cycle_count() - before;
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            std::cerr.rdbuf(errors);
+            std::cerr.clear();
+            return status;
+        }
+    };
+
+    //a program and how it is run
+    struct fuzz_case
+    {
+        std::vector<uint8_t> rom;
+        quirk_profile quirks;
+        sprite_edge edge;
+        uint32_t ipf;
+        uint32_t seed; // seed of CXNN, and of the key script
+        std::vector<key_event> events;
+    };
+
+    struct divergence
+    {
+        bool found;
+        uint64_t matched; // last cycle both machines were seen equal at
+        uint64_t cycle; // cycle they were seen to differ at
+        cycle_status status_a, status_b;
+    };
+
+    void start_case(chip8& machine, core_runner& core, const fuzz_case& test)
+    {
+        machine = chip8();
+        machine.chip8_init();
+        machine.set_quirk_profile(test.quirks);
+        machine.set_sprite_edge(test.edge);
+        machine.set_instructions_per_frame(test.ipf);
+        core.start(machine);
+        machine.load_program(test.rom.data(), test.rom.size());
+        machine.set_random_seed(test.seed);
+        core.load(test.rom, test.quirks, test.edge, test.ipf, test.seed);
+    }
+
+    //run the case on both cores for the given cycles, comparing the machines every checkpoint cycles and
+    //after every cycle from fine_from on. a case both cores stop with the same fault at does not diverge
+    divergence compare(chip8& a, chip8& b, core_runner& core_a, core_runner& core_b, const fuzz_case& test,
+                       uint64_t cycles, uint64_t checkpoint, uint64_t fine_from = UINT64_MAX)
+    {
+        start_case(a, core_a, test);
+        start_case(b, core_b, test);
+
+        divergence result = {false, 0, 0, cycle_status::ok, cycle_status::ok};
+        size_t next_event = 0;
+        uint64_t cycle = 0;
+        while(cycle < cycles)
+        {
+            while(next_event < test.events.size() && test.events[next_event].cycle <= cycle)
+            {
+                core_a.set_keypad(a, test.events[next_event].key, test.events[next_event].value);
+                core_b.set_keypad(b, test.events[next_event].key, test.events[next_event].value);
+                next_event++;
+            }
+
+            uint64_t until = std::min(cycles, cycle >= fine_from ? cycle + 1 : std::min(cycle + checkpoint, fine_from));
+            if(next_event < test.events.size() && test.events[next_event].cycle < until)
+            {
+                until = test.events[next_event].cycle;
+            }
+            result.status_a = core_a.run(a, until - cycle);
+            result.status_b = core_b.run(b, until - cycle);
+            if(result.status_a != result.status_b || a.state_hash() != b.state_hash())
+            {
+                result.found = true;
+                result.cycle = until;
+                return result;
+            }
+            if(result.status_a != cycle_status::ok)
+            {
+                break;
+            }
+            cycle = until;
+            result.matched = cycle;
+        }
+        return result;
+    }
+
+    //an instruction with random fields, jumps and calls land on an instruction of a program of the given length
+    uint16_t random_instruction(fuzz_random& random, size_t length)
+    {
+        static const uint16_t patterns[][2] = {
+            {0x00E0, 0x0000}, {0x00EE, 0x0000}, {0x00C0, 0x000F}, {0x00D0, 0x000F}, {0x00FB, 0x0000},
+            {0x00FC, 0x0000}, {0x00FD, 0x0000}, {0x00FE, 0x0000}, {0x00FF, 0x0000}, {0x1000, 0x0FFF},
+            {0x2000, 0x0FFF}, {0x3000, 0x0FFF}, {0x4000, 0x0FFF}, {0x5000, 0x0FF0}, {0x5002, 0x0FF0},
+            {0x5003, 0x0FF0}, {0x6000, 0x0FFF}, {0x7000, 0x0FFF}, {0x8000, 0x0FF7}, {0x800E, 0x0FF0},
+            {0x9000, 0x0FF0}, {0xA000, 0x0FFF}, {0xB000, 0x0FFF}, {0xC000, 0x0FFF}, {0xD000, 0x0FFF},
+            {0xE09E, 0x0F00}, {0xE0A1, 0x0F00}, {0xF000, 0x0000}, {0xF001, 0x0F00}, {0xF002, 0x0000},
+            {0xF007, 0x0F00}, {0xF00A, 0x0F00}, {0xF015, 0x0F00}, {0xF018, 0x0F00}, {0xF01E, 0x0F00},
+            {0xF029, 0x0F00}, {0xF030, 0x0F00}, {0xF033, 0x0F00}, {0xF03A, 0x0F00}, {0xF055, 0x0F00},
+            {0xF065, 0x0F00}, {0xF075, 0x0F00}, {0xF085, 0x0F00}
+        };
+        const size_t pattern_count = sizeof(patterns) / sizeof(patterns[0]);
+
+        //now and then a word no pattern makes, the unknown instructions have to agree too
+        if(random.below(16) == 0)
+        {
+            return static_cast<uint16_t>(random.next());
+        }
+        const uint16_t* pattern = patterns[random.below(pattern_count)];
+        uint16_t instruction = pattern[0] | (static_cast<uint16_t>(random.next()) & pattern[1]);
+        uint16_t kind = instruction & 0xF000;
+        if((kind == 0x1000 || kind == 0x2000 || kind == 0xA000) && random.below(4) != 0)
+        {
+            instruction = kind | static_cast<uint16_t>(0x200 + 2 * random.below(static_cast<uint32_t>(std::max<size_t>(1, length / 2))));
+        }
+        return instruction;
+    }
+
+    void put_instruction(std::vector<uint8_t>& rom, size_t offset, uint16_t instruction)
+    {
+        rom[offset] = static_cast<uint8_t>(instruction >> 8);
+        rom[offset + 1] = static_cast<uint8_t>(instruction & 0xFF);
+    }
+
+    std::vector<uint8_t> random_program(fuzz_random& random)
+    {
+        size_t length = 2 * (1 + random.below(512));
+        std::vector<uint8_t> rom(length);
+        for(size_t offset = 0; offset < length; offset += 2)
+        {
+            put_instruction(rom, offset, random_instruction(random, length));
+        }
+        return rom;
+    }
+
+    //a few random edits of a rom: bit flips, byte and instruction overwrites, instructions inserted and
+    //deleted, and runs of bytes spliced in from another rom
+    std::vector<uint8_t> mutate(fuzz_random& random, const rom_image& rom, const rom_image& other)
+    {
+        std::vector<uint8_t> mutated(rom.data, rom.data + std::min(rom.size, fuzz_rom_limit));
+        if(mutated.size() < 2)
+        {
+            mutated.resize(2, 0);
+        }
+        uint32_t edits = 1 + random.below(8);
+        for(uint32_t edit = 0; edit < edits; edit++)
+        {
+            size_t offset = random.below(static_cast<uint32_t>(mutated.size() - 1)) & ~static_cast<size_t>(1);
+            switch(random.below(6))
+            {
+                case 0:
+                    mutated[offset + random.below(2)] ^= static_cast<uint8_t>(1 << random.below(8));
+                    break;
+                case 1:
+                    mutated[offset + random.below(2)] = static_cast<uint8_t>(random.next());
+                    break;
+                case 2:
+                    put_instruction(mutated, offset, random_instruction(random, mutated.size()));
+                    break;
+                case 3:
+                    if(mutated.size() + 2 <= fuzz_rom_limit)
+                    {
+                        mutated.insert(mutated.begin() + offset, 2, 0);
+                        put_instruction(mutated, offset, random_instruction(random, mutated.size()));
+                    }
+                    break;
+                case 4:
+                    if(mutated.size() > 2)
+                    {
+                        mutated.erase(mutated.begin() + offset, mutated.begin() + offset + 2);
+                    }
+                    break;
+                default:
+                    if(other.size > 0)
+                    {
+                        size_t from = random.below(static_cast<uint32_t>(other.size));
+                        size_t length = std::min<size_t>({1 + random.below(64), other.size - from, mutated.size() - offset});
+                        std::copy(other.data + from, other.data + from + length, mutated.begin() + offset);
+                    }
+                    break;
+            }
+        }
+        return mutated;
+    }
+
+    //the smallest rom found that still diverges by the cycle of the divergence, cutting bytes from the
+    //end, then zeroing ever smaller chunks, until neither changes anything
+    void shrink(chip8& a, chip8& b, core_runner& core_a, core_runner& core_b, fuzz_case& test,
+                divergence& found, uint64_t checkpoint)
+    {
+        auto diverges = [&](const std::vector<uint8_t>& rom)
+        {
+            fuzz_case trial = test;
+            trial.rom = rom;
+            divergence result = compare(a, b, core_a, core_b, trial, found.cycle, checkpoint);
+            if(result.found)
+            {
+                test.rom = rom;
+            }
+            return result.found;
+        };
+
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            for(size_t chunk = test.rom.size() / 2; chunk >= 1; chunk /= 2)
+            {
+                while(test.rom.size() > chunk && diverges(std::vector<uint8_t>(test.rom.begin(), test.rom.end() - chunk)))
+                {
+                    changed = true;
+                }
+            }
+            for(size_t chunk = std::max<size_t>(1, test.rom.size() / 2); chunk >= 1; chunk /= 2)
+            {
+                for(size_t offset = 0; offset < test.rom.size(); offset += chunk)
+                {
+                    size_t end = std::min(test.rom.size(), offset + chunk);
+                    if(std::all_of(test.rom.begin() + offset, test.rom.begin() + end, [](uint8_t byte) { return byte == 0; }))
+                    {
+                        continue;
+                    }
+                    std::vector<uint8_t> zeroed = test.rom;
+                    std::fill(zeroed.begin() + offset, zeroed.begin() + end, 0);
+                    changed = diverges(zeroed) || changed;
+                }
+            }
+        }
+
+        //the keys pressed after the divergence play no part in it, and often none do
+        test.events.erase(std::remove_if(test.events.begin(), test.events.end(), [&](const key_event& event) {
+            return event.cycle >= found.cycle;
+        }), test.events.end());
+        fuzz_case without_keys = test;
+        without_keys.events.clear();
+        if(compare(a, b, core_a, core_b, without_keys, found.cycle, checkpoint).found)
+        {
+            test.events.clear();
+        }
+
+        //the smaller program may diverge sooner than the original
+        found = compare(a, b, core_a, core_b, test, found.cycle, checkpoint);
+        found = compare(a, b, core_a, core_b, test, found.cycle, checkpoint, found.matched);
+    }
+
+    //write the rom and key script of a divergence, and tell how to replay it on each core
+    bool write_divergence(const std::string& prefix, const fuzz_case& test, const divergence& found,
+                          const core_runner& core_a, const core_runner& core_b)
+    {
+        std::string rom_path = prefix + ".ch8";
+        std::string key_path = prefix + ".keys";
+        std::ofstream rom_file(rom_path, std::ios::binary);
+        std::ofstream key_file(key_path);
+        if(!rom_file.is_open() || !key_file.is_open())
+        {
+            std::cerr << "Error writing " << prefix << std::endl;
+            return false;
+        }
+        rom_file.write(reinterpret_cast<const char*>(test.rom.data()), static_cast<std::streamsize>(test.rom.size()));
+        write_key_script(key_file, test.events);
+
+        std::cerr << "  " << test.rom.size() << " byte rom " << rom_path << ", differs after cycle " << found.cycle
+                  << " (" << cycle_status_name(found.status_a) << " on " << core_a.name << ", "
+                  << cycle_status_name(found.status_b) << " on " << core_b.name << ")" << std::endl;
+        for(const core_runner* core : {&core_a, &core_b})
+        {
+            //lane 0 of the lockstep engine runs what the table core runs, replayed there
+            if(core->name == "lockstep")
+            {
+                continue;
+            }
+            std::cerr << "  ./chip8_headless " << rom_path << " --core " << core->name << " --cycles " << found.cycle
+                      << " --quirks " << quirk_profile_name(test.quirks)
+                      << (test.edge == sprite_edge::clip ? " --clip" : " --wrap") << " --ipf " << test.ipf
+                      << " --seed " << test.seed << " --keys " << key_path << std::endl;
+        }
+        return true;
+    }
+
+    double mips(const core_runner& core)
+    {
+        return core.seconds > 0 ? core.cycles / core.seconds / 1e6 : 0.0;
+    }
+
+    void print_usage()
+    {
+        std::cout << "Usage: ./chip8_fuzz [options], options as --option value or --option=value" << std::endl;
+        std::cout << "  --roms DIR        roms the mutated programs start from (default " << CHIP8_ROM_DIR << ")" << std::endl;
+        std::cout << "  --cores A,B       the two cores compared, reference, table, block, jit or lockstep (default reference,table)" << std::endl;
+        std::cout << "  --cases N         programs generated (default 1000)" << std::endl;
+        std::cout << "  --cycles N        instructions per program (default 200000)" << std::endl;
+        std::cout << "  --checkpoint N    instructions between comparisons of the machines (default 10000)" << std::endl;
+        std::cout << "  --seed S          seed of the generated programs (default 1)" << std::endl;
+        std::cout << "  --quirks LIST     comma separated quirk profiles the programs run with (default every profile)" << std::endl;
+        std::cout << "  --ipf N           instructions per 60 Hz frame (default 10)" << std::endl;
+        std::cout << "  --output PREFIX   file names of the shrunk divergences, PREFIX_<case>.ch8 and .keys (default divergence)" << std::endl;
+        std::cout << "  --keep-going      go on after a divergence instead of stopping at the first" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string rom_dir = CHIP8_ROM_DIR;
+    std::string output_prefix = "divergence";
+    uint64_t cases = 1000;
+    uint64_t cycles = 200000;
+    uint64_t checkpoint = 10000;
+    uint64_t seed = 1;
+    uint32_t ipf = default_instructions_per_frame;
+    bool keep_going = false;
+    std::vector<quirk_profile> profiles = {quirk_profile::modern, quirk_profile::cosmac_vip, quirk_profile::chip48,
+                                           quirk_profile::superchip, quirk_profile::xochip};
+    std::vector<std::string> cores = {"reference", "table"};
+
+    //parse the arguments, options take their value as the next argument or after '='
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string value;
+        size_t equals = arg.find('=');
+        if(equals != std::string::npos)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        }else if(arg != "-h" && arg != "--help" && arg != "--keep-going")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "Missing value of " << arg << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+            value = argv[++i];
+        }
+
+        if(arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }else if(arg == "--roms")
+        {
+            rom_dir = value;
+        }else if(arg == "--cases")
+        {
+            cases = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--cycles")
+        {
+            cycles = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        }else if(arg == "--checkpoint")
+        {
+            checkpoint = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        }else if(arg == "--seed")
+        {
+            seed = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--ipf")
+        {
+            ipf = static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(UINT32_MAX, std::strtoull(value.c_str(), nullptr, 10))));
+        }else if(arg == "--output")
+        {
+            output_prefix = value;
+        }else if(arg == "--keep-going")
+        {
+            keep_going = true;
+        }else if(arg == "--quirks")
+        {
+            profiles.clear();
+            std::istringstream list(value);
+            std::string name;
+            while(std::getline(list, name, ','))
+            {
+                quirk_profile profile;
+                if(!parse_quirk_profile(name, profile))
+                {
+                    std::cerr << "Unknown quirk profile " << name << "(use -h to get help)" << std::endl;
+                    return 1;
+                }
+                profiles.push_back(profile);
+            }
+        }else if(arg == "--cores")
+        {
+            cores.clear();
+            std::istringstream list(value);
+            std::string core;
+            while(std::getline(list, core, ','))
+            {
+                if(!is_core(core) && core != "lockstep")
+                {
+                    std::cerr << "Unknown core " << core << "(use -h to get help)" << std::endl;
+                    return 1;
+                }
+                cores.push_back(core);
+            }
+        }else
+        {
+            std::cerr << "Unknown argument " << arg << "(use -h to get help)" << std::endl;
+            return 1;
+        }
+    }
+    if(cores.size() != 2 || profiles.empty())
+    {
+        std::cerr << "Give two cores and at least one quirk profile(use -h to get help)" << std::endl;
+        return 1;
+    }
+
+    //without roms every program is a random one
+    rom_library library;
+    if(!library.open(rom_dir) || library.size() == 0)
+    {
+        std::cerr << "No roms found in " << rom_dir << ", generating random programs only" << std::endl;
+    }
+
+    //the machines are large, they are made once and reset for every case
+    std::unique_ptr<chip8> machine_a(new chip8());
+    std::unique_ptr<chip8> machine_b(new chip8());
+    std::unique_ptr<core_runner> core_a(new core_runner());
+    std::unique_ptr<core_runner> core_b(new core_runner());
+    core_a->name = cores[0];
+    core_b->name = cores[1];
+
+    fuzz_random random = {seed * 0x9E3779B97F4A7C15ull + 1};
+    uint64_t divergences = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t index = 0; index < cases; index++)
+    {
+        fuzz_case test;
+        if(library.size() == 0 || random.below(4) == 0)
+        {
+            test.rom = random_program(random);
+        }else
+        {
+            const rom_image& rom = library.get(random.below(static_cast<uint32_t>(library.size())));
+            const rom_image& other = library.get(random.below(static_cast<uint32_t>(library.size())));
+            test.rom = mutate(random, rom, other);
+        }
+        test.quirks = profiles[random.below(static_cast<uint32_t>(profiles.size()))];
+        test.edge = quirks_of(test.quirks).edge;
+        if(random.below(4) == 0)
+        {
+            test.edge = test.edge == sprite_edge::clip ? sprite_edge::wrap : sprite_edge::clip;
+        }
+        test.ipf = ipf;
+        test.seed = static_cast<uint32_t>(random.next());
+        test.events = random_key_script(test.seed, cycles);
+
+        divergence found = compare(*machine_a, *machine_b, *core_a, *core_b, test, cycles, checkpoint);
+        if(found.found)
+        {
+            divergences++;
+            std::cerr << "Case " << index << " (" << quirk_profile_name(test.quirks) << ", " << test.rom.size()
+                      << " bytes) diverges between cycles " << found.matched << " and " << found.cycle
+                      << ", shrinking" << std::endl;
+            found = compare(*machine_a, *machine_b, *core_a, *core_b, test, found.cycle, checkpoint, found.matched);
+            shrink(*machine_a, *machine_b, *core_a, *core_b, test, found, checkpoint);
+            write_divergence(output_prefix + "_" + std::to_string(index), test, found, *core_a, *core_b);
+            if(!keep_going)
+            {
+                break;
+            }
+        }
+        if((index + 1) % 100 == 0)
+        {
+            std::cerr << index + 1 << " cases, " << core_a->name << " " << mips(*core_a) << " MIPS, "
+                      << core_b->name << " " << mips(*core_b) << " MIPS" << std::endl;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << core_a->name << ": " << core_a->cycles << " cycles, " << mips(*core_a) << " MIPS" << std::endl;
+    std::cout << core_b->name << ": " << core_b->cycles << " cycles, " << mips(*core_b) << " MIPS" << std::endl;
+    std::cout << divergences << " divergences in " << seconds << " s" << std::endl;
+    return divergences == 0 ? 0 : 1;
+}
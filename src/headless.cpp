@@ -0,0 +1,403 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+
+#include "chip8.hpp"
+#include "runner.hpp"
+#include "movie.hpp"
+#include "trace.hpp"
+
+//headless runner
+//runs a rom without SDL as fast as the host allows and dumps the final machine state
+
+static void print_usage()
+{
+    std::cout << "Usage: ./chip8_headless <rom file> [options], options as --option value or --option=value" << std::endl;
+    std::cout << "  --cycles N     run N instructions (default 100000)" << std::endl;
+    std::cout << "  --frames N     run N frames of --ipf instructions each" << std::endl;
+    std::cout << "  --ipf N        instructions per 60 Hz frame, the timers tick once per frame (default 10)" << std::endl;
+    std::cout << "  --keys FILE    key script, one \"<cycle> <key> <0|1>\" per line, key in hex" << std::endl;
+    std::cout << "  --seed N       seed of the CXNN random number generator (default 0)" << std::endl;
+    std::cout << "  --record FILE  save the run as a movie" << std::endl;
+    std::cout << "  --replay FILE  replay a movie recorded here or in the emulator, for as many cycles as it was" << std::endl;
+    std::cout << "                 recorded unless --cycles or --frames is given" << std::endl;
+    std::cout << "  --core C       core: table (the fastest on most roms), block, jit, or reference (also interp)" << std::endl;
+    std::cout << "                 block and jit are experimental, slower than table on roms that draw or wait a lot" << std::endl;
+    std::cout << "                 (TETRIS, HIDDEN, TICTAC), compare them on a rom with --bench before choosing one" << std::endl;
+    std::cout << "  --bench        run every core on the rom and report cycles per second, idle loops run as for --no-idle-skip" << std::endl;
+    std::cout << "  --no-idle-skip run every cycle of a loop waiting for a key or the delay timer, so the speed is the one" << std::endl;
+    std::cout << "                 of the instructions excuted, the table core otherwise retires them at once" << std::endl;
+    std::cout << "  --profile      count the instructions by opcode and address (reference and table cores), reported" << std::endl;
+    std::cout << "                 at the end of the run or when interrupted with ctrl-c" << std::endl;
+    std::cout << "  --trace FILE   record every instruction in a binary trace (reference and table cores), read by chip8_trace" << std::endl;
+    std::cout << "  --load-state F start from a state saved by --save-state with the same rom" << std::endl;
+    std::cout << "  --save-state F save the machine at the end of the run" << std::endl;
+    std::cout << "  --quirks Q     quirk profile: modern (default), vip, chip48, schip or xochip" << std::endl;
+    std::cout << "  --clip         clip sprites at the screen edges, whatever the quirk profile" << std::endl;
+    std::cout << "  --wrap         wrap sprites around the screen edges, whatever the quirk profile" << std::endl;
+    std::cout << "  --no-screen    do not dump the framebuffer" << std::endl;
+    std::cout << "  --no-regs      do not dump the registers" << std::endl;
+}
+
+static void dump_registers(const chip8& chip8_emu)
+{
+    std::cout << std::hex << std::uppercase;
+    for(int i = 0; i < 16; i++)
+    {
+        std::cout << "V" << i << "=" << static_cast<int>(chip8_emu.get_V(i)) << (i % 8 == 7 ? "\n" : " ");
+    }
+    std::cout << "PC=" << chip8_emu.get_pc() << " I=" << chip8_emu.get_I();
+    std::cout << std::dec << std::nouppercase;
+    std::cout << " DT=" << static_cast<int>(chip8_emu.get_delay_timer());
+    std::cout << " ST=" << static_cast<int>(chip8_emu.get_sound_timer());
+    std::cout << " cycles=" << chip8_emu.get_cycle_count() << std::endl;
+}
+
+//one character per pixel at the resolution of the machine, '#' for plane 1, '+' for plane 2 and
+//'@' for both
+static void dump_screen(chip8& chip8_emu)
+{
+    static const char shades[] = {'.', '#', '+', '@'};
+    for(int y = 0; y < chip8_emu.get_display_height(); ++y)
+    {
+        std::string row(chip8_emu.get_display_width(), '.');
+        for(int x = 0; x < chip8_emu.get_display_width(); ++x)
+        {
+            row[x] = shades[chip8_emu.get_screent_pixels(x, y)];
+        }
+        std::cout << row << '\n';
+    }
+    std::cout.flush();
+}
+
+//set by ctrl-c during a profiled run, which then ends early and still reports
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void interrupt_handler(int)
+{
+    interrupted = 1;
+}
+
+//the cycles idle loops retired at once are counted as run, the speed is then how fast the rom plays
+static void print_speed(const run_result& result, bool idle_skipping)
+{
+    std::cerr << result.cycles << " cycles in " << result.seconds * 1000.0 << " ms ("
+              << (result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0) << " MIPS"
+              << (idle_skipping ? ", idle loops retired at once, --no-idle-skip to time every instruction" : "")
+              << ")" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc <= 1)
+    {
+        std::cerr << "no specific rom file(use -h to get help)" << std::endl;
+        return 1;
+    }
+
+    std::string rom_path;
+    std::string key_path;
+    std::string save_state;
+    std::string record_path;
+    std::string replay_path;
+    std::string trace_path;
+    bool cycles_set = false;
+    bool edge_set = false;
+    uint64_t cycles = 100000;
+    uint64_t frames = 0;
+    run_settings settings;
+    settings.core = default_dispatch_mode == dispatch_mode::reference ? "reference" : "table";
+    bool show_screen = true;
+    bool show_registers = true;
+    bool bench = false;
+    bool profile = false;
+
+    //parse the arguments, options take their value as the next argument or after '='
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string value;
+        bool has_value = false;
+        size_t equals = arg.find('=');
+        if(arg.compare(0, 2, "--") == 0 && equals != std::string::npos)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+            has_value = true;
+        }else if(i + 1 < argc)
+        {
+            value = argv[i + 1];
+            has_value = true;
+        }
+        auto take_value = [&]()
+        {
+            if(equals == std::string::npos)
+            {
+                i++;
+            }
+            return value;
+        };
+
+        if(arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }else if(arg == "--cycles" && has_value)
+        {
+            cycles = std::strtoull(take_value().c_str(), nullptr, 10);
+            cycles_set = true;
+        }else if(arg == "--frames" && has_value)
+        {
+            frames = std::strtoull(take_value().c_str(), nullptr, 10);
+        }else if(arg == "--ipf" && has_value)
+        {
+            settings.instructions_per_frame = static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(UINT32_MAX, std::strtoull(take_value().c_str(), nullptr, 10))));
+        }else if(arg == "--keys" && has_value)
+        {
+            key_path = take_value();
+        }else if(arg == "--core" && has_value)
+        {
+            settings.core = take_value();
+            if(!is_core(settings.core))
+            {
+                std::cerr << "Unknown core " << settings.core << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+        }else if(arg == "--seed" && has_value)
+        {
+            settings.random_seed = static_cast<uint32_t>(std::strtoul(take_value().c_str(), nullptr, 10));
+        }else if(arg == "--record" && has_value)
+        {
+            record_path = take_value();
+        }else if(arg == "--replay" && has_value)
+        {
+            replay_path = take_value();
+        }else if(arg == "--trace" && has_value)
+        {
+            trace_path = take_value();
+        }else if(arg == "--load-state" && has_value)
+        {
+            settings.load_state = take_value();
+        }else if(arg == "--save-state" && has_value)
+        {
+            save_state = take_value();
+        }else if(arg == "--quirks" && has_value)
+        {
+            std::string name = take_value();
+            if(!parse_quirk_profile(name, settings.quirks))
+            {
+                std::cerr << "Unknown quirk profile " << name << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+        }else if(arg == "--clip" || arg == "--wrap")
+        {
+            edge_set = true;
+            settings.edge = arg == "--clip" ? sprite_edge::clip : sprite_edge::wrap;
+        }else if(arg == "--profile")
+        {
+            profile = true;
+        }else if(arg == "--bench")
+        {
+            bench = true;
+        }else if(arg == "--no-screen")
+        {
+            show_screen = false;
+        }else if(arg == "--no-regs")
+        {
+            show_registers = false;
+        }else if(arg == "--no-idle-skip")
+        {
+            settings.idle_skipping = false;
+        }else if(rom_path.empty() && arg[0] != '-')
+        {
+            rom_path = arg;
+        }else
+        {
+            std::cerr << "Unknown argument " << arg << "(use -h to get help)" << std::endl;
+            return 1;
+        }
+    }
+    if(!edge_set)
+    {
+        settings.edge = quirks_of(settings.quirks).edge;
+    }
+
+    //a movie brings its own settings and keys
+    std::vector<key_event> events;
+    if(!replay_path.empty())
+    {
+        movie replay;
+        std::vector<uint8_t> image;
+        if(!load_movie(replay_path, replay) || !read_rom_file(rom_path, image))
+        {
+            return 1;
+        }
+        if(!movie_matches_rom(replay, image))
+        {
+            std::cerr << "The movie was recorded with another rom" << std::endl;
+            return 1;
+        }
+        settings.random_seed = replay.random_seed;
+        settings.instructions_per_frame = replay.instructions_per_frame;
+        settings.quirks = replay.quirks;
+        settings.edge = replay.edge;
+        events = replay.events;
+        if(!cycles_set && frames == 0)
+        {
+            cycles = replay.cycles;
+        }
+    }else if(!key_path.empty() && !load_key_script(key_path, events))
+    {
+        return 1;
+    }
+
+    if(frames != 0)
+    {
+        cycles = frames * settings.instructions_per_frame;
+    }
+
+    if(!record_path.empty() && !settings.load_state.empty())
+    {
+        std::cerr << "A movie starts at power on, it cannot be recorded from a state(use -h to get help)" << std::endl;
+        return 1;
+    }
+
+    //set up chip8 emulator
+    chip8 chip8_emu;
+    run_result result;
+    opcode_profiler profiler;
+    if(profile && !bench)
+    {
+        if(settings.core != "reference" && settings.core != "interp" && settings.core != "table")
+        {
+            std::cerr << "Only the reference and table cores can be profiled(use -h to get help)" << std::endl;
+            return 1;
+        }
+        settings.profiler = &profiler;
+        settings.stop = &interrupted;
+        std::signal(SIGINT, interrupt_handler);
+    }
+
+    trace_recorder tracer;
+    if(!trace_path.empty() && !bench)
+    {
+        if(settings.core != "reference" && settings.core != "interp" && settings.core != "table")
+        {
+            std::cerr << "Only the reference and table cores can be traced(use -h to get help)" << std::endl;
+            return 1;
+        }
+        if(profile)
+        {
+            std::cerr << "Cannot trace and profile at once(use -h to get help)" << std::endl;
+            return 1;
+        }
+        if(!tracer.open(trace_path))
+        {
+            return 1;
+        }
+        settings.tracer = &tracer;
+    }
+
+    //run the same cycles through every core and compare their speed
+    if(bench)
+    {
+        for(const char* bench_core : core_names)
+        {
+            chip8 bench_emu;
+            run_settings bench_settings = settings;
+            bench_settings.core = bench_core;
+            bench_settings.idle_skipping = false;
+            if(!run_rom(bench_settings, rom_path, events, cycles, nullptr, bench_emu, result))
+            {
+                std::cerr << "Failed to load the rom file(use -h to get help)" << std::endl;
+                return 1;
+            }
+            std::cout << bench_core << ": " << result.cycles << " cycles, "
+                      << (result.seconds > 0 ? result.cycles / result.seconds : 0.0) << " cycles/s";
+            if(result.status != cycle_status::ok)
+            {
+                std::cout << " (stopped: " << cycle_status_name(result.status) << ")";
+            }
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+
+    if(rom_path.empty() || !run_rom(settings, rom_path, events, cycles, &std::cerr, chip8_emu, result))
+    {
+        std::cerr << "Failed to load the rom file(use -h to get help)" << std::endl;
+        return 1;
+    }
+    if(result.status != cycle_status::ok)
+    {
+        std::cerr << "Fault: " << cycle_status_name(result.status) << " at pc " << std::hex
+                  << ((chip8_emu.get_pc() - 2) & address_mask(quirks_of(chip8_emu.get_quirk_profile()))) << std::dec << std::endl;
+    }
+    if(tracer.is_open())
+    {
+        uint64_t records = tracer.get_records();
+        uint64_t stalls = tracer.get_stalls();
+        if(!tracer.close())
+        {
+            return 1;
+        }
+        std::cerr << records << " instructions traced to " << trace_path << " (" << stalls << " waits for the writer)" << std::endl;
+    }
+
+    if(!record_path.empty())
+    {
+        std::vector<uint8_t> image;
+        if(!read_rom_file(rom_path, image))
+        {
+            return 1;
+        }
+        movie recorded = start_movie(image, settings.random_seed, settings.instructions_per_frame, settings.quirks, settings.edge);
+        recorded.cycles = result.cycles;
+        for(const key_event& event : events)
+        {
+            if(event.cycle < result.cycles)
+            {
+                recorded.events.push_back(event);
+            }
+        }
+        if(!save_movie(record_path, recorded))
+        {
+            return 1;
+        }
+    }
+
+    if(!save_state.empty())
+    {
+        std::vector<uint8_t> image;
+        std::ofstream state(save_state, std::ios::binary);
+        if(!read_rom_file(rom_path, image) || !chip8_emu.write_state(state, image))
+        {
+            std::cerr << "Failed to save the state to " << save_state << std::endl;
+            return 1;
+        }
+    }
+
+    if(show_registers)
+    {
+        dump_registers(chip8_emu);
+    }
+    if(show_screen)
+    {
+        dump_screen(chip8_emu);
+    }
+
+    print_speed(result, settings.idle_skipping && settings.core != "reference" && settings.core != "interp" &&
+                        settings.profiler == nullptr && settings.tracer == nullptr);
+
+    if(settings.profiler != nullptr)
+    {
+        profiler.report(std::cerr);
+    }
+
+    return 0;
+}
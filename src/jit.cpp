@@ -0,0 +1,890 @@
+#include "jit.hpp"
+#include "fast_core.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_X64 1
+#else
+#define CHIP8_JIT_X64 0
+#endif
+
+#if CHIP8_JIT_X64
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+//register use of the generated code
+//  rdi       the context, for the whole run
+//  rax..rdx  scratch
+//  the rest  the V registers and I used by the block being run, loaded at its entry and the
+//            written ones stored back at each of its exits, so blocks never share host registers
+//the values are kept zero extended in the 32 bit registers, 8 bit results are masked with 0xFF
+
+namespace
+{
+    //capacity of the code buffer, the whole buffer is flushed when a block might not fit
+    const size_t code_capacity = 1 << 20;
+    const size_t max_block_code = 16 << 10;
+
+    //cycles handed to the generated code per call
+    const uint32_t max_chunk = 0x7FFFFFFF;
+
+    enum host_register : uint8_t
+    {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    //host registers for the V registers and I of a block, in allocation order
+    const host_register allocatable[] = {RBX, RBP, RSI, R8, R9, R10, R11, R12, R13, R14, R15};
+    const uint32_t allocatable_count = sizeof(allocatable) / sizeof(allocatable[0]);
+
+    //bit of I in the register masks, V0..VF are bits 0..15
+    const uint32_t I_BIT = 1u << 16;
+
+    enum condition : uint8_t
+    {
+        CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7
+    };
+
+    enum alu_extension : uint8_t
+    {
+        ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_CMP = 7
+    };
+
+    enum alu_opcode : uint8_t
+    {
+        ADD_RR = 0x01, OR_RR = 0x09, AND_RR = 0x21, SUB_RR = 0x29, XOR_RR = 0x31, CMP_RR = 0x39, MOV_RR = 0x89
+    };
+
+    enum shift_extension : uint8_t
+    {
+        SHIFT_LEFT = 4, SHIFT_RIGHT = 5
+    };
+
+    //registers read and written by a compiled instruction
+    struct register_use
+    {
+        uint32_t read;
+        uint32_t written;
+    };
+
+    //whether the generated code handles op, the rest is left to the interpreter
+    bool is_compiled(const decoded_op& op)
+    {
+        switch(op.op)
+        {
+            case OP_0NNN: case OP_1NNN: case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_6XNN:
+            case OP_7XNN: case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3: case OP_8XY4:
+            case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE: case OP_9XY0: case OP_ANNN:
+            case OP_EX9E: case OP_EXA1: case OP_FX1E: case OP_FX29: case OP_INVALID:
+                return true;
+            case OP_FX65:
+                //V0..VX and I must all fit in host registers
+                return op.x + 2u <= allocatable_count;
+            default:
+                return false;
+        }
+    }
+
+    //registers read and written by op under the quirks, the written ones being read as well as
+    //they are stored back at every exit of the block
+    register_use uses(const decoded_op& op, const quirk_set& quirk)
+    {
+        uint32_t x = 1u << op.x;
+        uint32_t y = 1u << op.y;
+        uint32_t f = 1u << 0xF;
+        switch(op.op)
+        {
+            case OP_3XNN: case OP_4XNN: case OP_EX9E: case OP_EXA1:
+                return {x, 0};
+            case OP_5XY0: case OP_9XY0:
+                return {x | y, 0};
+            case OP_6XNN:
+                return {0, x};
+            case OP_7XNN:
+                return {x, x};
+            case OP_8XY0:
+                return {y, x};
+            case OP_8XY1: case OP_8XY2: case OP_8XY3:
+                return quirk.logic_resets_vf ? register_use{x | y | f, x | f} : register_use{x | y, x};
+            case OP_8XY4: case OP_8XY5: case OP_8XY7:
+                return {x | y | f, x | f};
+            case OP_8XY6: case OP_8XYE:
+                return {x | (quirk.shift_reads_vy ? y : 0) | f, x | f};
+            case OP_ANNN:
+                return {0, I_BIT};
+            case OP_FX1E:
+                return quirk.add_index_sets_vf ? register_use{x | f | I_BIT, f | I_BIT} : register_use{x | I_BIT, I_BIT};
+            case OP_FX29:
+                return {x, I_BIT};
+            case OP_FX65:
+                return {I_BIT, ((2u << op.x) - 1) | I_BIT};
+            default:
+                return {0, 0};
+        }
+    }
+
+    uint32_t count_registers(uint32_t mask)
+    {
+        uint32_t count = 0;
+        for(; mask != 0; mask &= mask - 1)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    //minimal x86-64 encoder, only the instruction forms the blocks need
+    //registers are 32 bit unless noted, memory operands are [base + disp32]
+    class x64_emitter
+    {
+        public:
+            x64_emitter(uint8_t* buffer, size_t position) : buffer(buffer), position(position) {}
+
+            size_t get_position() const { return position; }
+
+            void byte(uint8_t value) { buffer[position++] = value; }
+
+            void word(uint16_t value)
+            {
+                byte(value & 0xFF);
+                byte(value >> 8);
+            }
+
+            void dword(uint32_t value)
+            {
+                for(int i = 0; i < 4; i++)
+                {
+                    byte((value >> (i * 8)) & 0xFF);
+                }
+            }
+
+            void mov_rr64(uint8_t dst, uint8_t src)
+            {
+                rex(true, src, 0, dst);
+                byte(MOV_RR);
+                byte(modrm(3, src, dst));
+            }
+
+            void mov_ri(uint8_t r, uint32_t imm)
+            {
+                rex(false, 0, 0, r);
+                byte(0xB8 + (r & 7));
+                dword(imm);
+            }
+
+            //opcode dst, src with an alu_opcode
+            void alu_rr(uint8_t opcode, uint8_t dst, uint8_t src)
+            {
+                rex(false, src, 0, dst);
+                byte(opcode);
+                byte(modrm(3, src, dst));
+            }
+
+            //extension r, imm with an alu_extension
+            void alu_ri(uint8_t extension, uint8_t r, uint32_t imm)
+            {
+                rex(false, 0, 0, r);
+                byte(0x81);
+                byte(modrm(3, extension, r));
+                dword(imm);
+            }
+
+            void shift_ri(uint8_t extension, uint8_t r, uint8_t amount)
+            {
+                rex(false, 0, 0, r);
+                byte(0xC1);
+                byte(modrm(3, extension, r));
+                byte(amount);
+            }
+
+            //eax = condition ? 1 : 0, from the flags
+            void set_eax(uint8_t cc)
+            {
+                byte(0x0F);
+                byte(0x90 + cc);
+                byte(modrm(3, 0, RAX));
+                byte(0x0F);
+                byte(0xB6);
+                byte(modrm(3, RAX, RAX));
+            }
+
+            void load_u8(uint8_t r, uint8_t base, int32_t disp)
+            {
+                rex(false, r, 0, base);
+                byte(0x0F);
+                byte(0xB6);
+                memory(r, base, disp);
+            }
+
+            void load_u16(uint8_t r, uint8_t base, int32_t disp)
+            {
+                rex(false, r, 0, base);
+                byte(0x0F);
+                byte(0xB7);
+                memory(r, base, disp);
+            }
+
+            //64 bit load
+            void load_pointer(uint8_t r, uint8_t base, int32_t disp)
+            {
+                rex(true, r, 0, base);
+                byte(0x8B);
+                memory(r, base, disp);
+            }
+
+            //r = byte [base + index], base must not be rbp or r13
+            void load_u8_indexed(uint8_t r, uint8_t base, uint8_t index)
+            {
+                rex(false, r, index, base);
+                byte(0x0F);
+                byte(0xB6);
+                byte(modrm(0, r, 4));
+                byte(sib(0, index, base));
+            }
+
+            //byte [base + index] compared with 0, base must not be rbp or r13
+            void cmp_u8_indexed_zero(uint8_t base, uint8_t index)
+            {
+                rex(false, 0, index, base);
+                byte(0x80);
+                byte(modrm(0, ALU_CMP, 4));
+                byte(sib(0, index, base));
+                byte(0);
+            }
+
+            void store_u8(uint8_t base, int32_t disp, uint8_t r)
+            {
+                //a rex prefix selects sil/dil/bpl instead of dh/bh/ch
+                rex(false, r, 0, base, true);
+                byte(0x88);
+                memory(r, base, disp);
+            }
+
+            void store_u16(uint8_t base, int32_t disp, uint8_t r)
+            {
+                byte(0x66);
+                rex(false, r, 0, base);
+                byte(0x89);
+                memory(r, base, disp);
+            }
+
+            void store_imm16(uint8_t base, int32_t disp, uint16_t imm)
+            {
+                byte(0x66);
+                rex(false, 0, 0, base);
+                byte(0xC7);
+                memory(0, base, disp);
+                word(imm);
+            }
+
+            //extension dword [base + disp], imm with an alu_extension
+            void alu_mi(uint8_t extension, uint8_t base, int32_t disp, uint32_t imm)
+            {
+                rex(false, 0, 0, base);
+                byte(0x81);
+                memory(extension, base, disp);
+                dword(imm);
+            }
+
+            void push(uint8_t r)
+            {
+                rex(false, 0, 0, r);
+                byte(0x50 + (r & 7));
+            }
+
+            void pop(uint8_t r)
+            {
+                rex(false, 0, 0, r);
+                byte(0x58 + (r & 7));
+            }
+
+            //jumps return the position of their displacement, see patch()
+            size_t jcc(uint8_t cc)
+            {
+                byte(0x0F);
+                byte(0x80 + cc);
+                dword(0);
+                return position - 4;
+            }
+
+            size_t jmp()
+            {
+                byte(0xE9);
+                dword(0);
+                return position - 4;
+            }
+
+            void patch(size_t displacement, size_t target)
+            {
+                uint32_t relative = static_cast<uint32_t>(target - (displacement + 4));
+                for(int i = 0; i < 4; i++)
+                {
+                    buffer[displacement + i] = (relative >> (i * 8)) & 0xFF;
+                }
+            }
+
+        private:
+            static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm)
+            {
+                return static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+            }
+
+            static uint8_t sib(uint8_t scale, uint8_t index, uint8_t base)
+            {
+                return static_cast<uint8_t>((scale << 6) | ((index & 7) << 3) | (base & 7));
+            }
+
+            void rex(bool wide, uint8_t reg, uint8_t index, uint8_t base, bool force = false)
+            {
+                uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+                if(prefix != 0x40 || force)
+                {
+                    byte(prefix);
+                }
+            }
+
+            void memory(uint8_t reg, uint8_t base, int32_t disp)
+            {
+                byte(modrm(2, reg, base));
+                if((base & 7) == RSP)
+                {
+                    byte(sib(0, RSP, RSP));
+                }
+                dword(static_cast<uint32_t>(disp));
+            }
+
+            uint8_t* buffer;
+            size_t position;
+    };
+
+    //a jump out of a block, emitted after the block body
+    struct block_exit
+    {
+        size_t displacement; // the jump to this exit
+        uint16_t pc; // address to continue at
+        uint32_t executed; // instructions run when leaving through it
+        bool leave; // return to run() instead of going on to the next block
+    };
+}
+
+#define CONTEXT_OFFSET(field) static_cast<int32_t>(offsetof(context, field))
+
+jit_compiler::jit_compiler()
+{
+    code = nullptr;
+    code_used = 0;
+    stub_size = 0;
+    entry = nullptr;
+    compiled_blocks = 0;
+    invalidated_blocks = 0;
+    quirks = quirk_profile::modern;
+
+#if CHIP8_JIT_X64
+#ifdef _WIN32
+    void* buffer = VirtualAlloc(nullptr, code_capacity, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* buffer = mmap(nullptr, code_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffer == MAP_FAILED)
+    {
+        buffer = nullptr;
+    }
+#endif
+    if(buffer != nullptr)
+    {
+        code = static_cast<uint8_t*>(buffer);
+
+        //entry: save the callee saved registers and fall into the dispatcher
+        //the generated code never calls out, so the stack alignment does not matter
+        x64_emitter emit(code, 0);
+        const host_register saved[] = {RBX, RBP, RSI, RDI, R12, R13, R14, R15};
+        for(host_register r : saved)
+        {
+            emit.push(r);
+        }
+#ifdef _WIN32
+        emit.mov_rr64(RDI, RCX); // first argument of the windows calling convention
+#endif
+
+        //dispatcher: jump to the block at context.pc, or return when there is none
+        size_t dispatch = emit.get_position();
+        emit.load_u16(RAX, RDI, CONTEXT_OFFSET(pc));
+        emit.alu_ri(ALU_AND, RAX, 0xFFF);
+        emit.load_pointer(RCX, RDI, CONTEXT_OFFSET(code));
+        emit.byte(0x48); // mov rcx, [rcx + rax * 8]
+        emit.byte(0x8B);
+        emit.byte(0x0C);
+        emit.byte(0xC1);
+        emit.byte(0x48); // test rcx, rcx
+        emit.byte(0x85);
+        emit.byte(0xC9);
+        size_t no_block = emit.jcc(CC_E);
+        emit.byte(0xFF); // jmp rcx
+        emit.byte(0xE1);
+
+        //epilogue, also where a block too long for the cycles left returns
+        size_t epilogue = emit.get_position();
+        emit.patch(no_block, epilogue);
+        for(int i = 7; i >= 0; i--)
+        {
+            emit.pop(saved[i]);
+        }
+        emit.byte(0xC3); // ret
+
+        stub_size = emit.get_position();
+        code_used = stub_size;
+        dispatch_offset = dispatch;
+        epilogue_offset = epilogue;
+        set_writable(false);
+        entry = reinterpret_cast<entry_function>(code);
+    }
+#endif
+
+    flush();
+}
+
+jit_compiler::~jit_compiler()
+{
+#if CHIP8_JIT_X64
+    if(code != nullptr)
+    {
+#ifdef _WIN32
+        VirtualFree(code, 0, MEM_RELEASE);
+#else
+        munmap(code, code_capacity);
+#endif
+    }
+#endif
+}
+
+//the buffer is never writable and executable at once
+void jit_compiler::set_writable(bool writable)
+{
+#if CHIP8_JIT_X64
+#ifdef _WIN32
+    DWORD previous;
+    VirtualProtect(code, code_capacity, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous);
+#else
+    mprotect(code, code_capacity, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+#else
+    (void)writable;
+#endif
+}
+
+void jit_compiler::flush()
+{
+    code_used = stub_size;
+    code_at.fill(nullptr);
+    block_length.fill(0);
+    covered.fill(0);
+    visits.fill(0);
+}
+
+//translate the block starting at pc, false when its first instruction is left to the interpreter
+bool jit_compiler::compile(const chip8& machine, uint16_t pc)
+{
+#if CHIP8_JIT_X64
+    if(code_used + max_block_code > code_capacity)
+    {
+        flush();
+    }
+
+    //the code is generated for the quirks of the machine, run() flushes it when they change
+    const quirk_set quirk = quirks_of(machine.quirks);
+
+    //pick the instructions, stopping before one the interpreter runs or one needing more host
+    //registers than are left, and before wrapping around the end of memory
+    std::array<decoded_op, max_block_length> ops;
+    uint32_t length = 0;
+    uint32_t used = 0;
+    uint32_t written = 0;
+    uint16_t address = pc;
+    for(;;)
+    {
+        uint16_t instruction = (machine.memory[address] << 8) | machine.memory[(address + 1) & 0xFFF];
+        decoded_op op = decode_opcode(instruction);
+        register_use use = uses(op, quirk);
+        if(!is_compiled(op) || count_registers(used | use.read | use.written) > allocatable_count)
+        {
+            break;
+        }
+        used |= use.read | use.written;
+        written |= use.written;
+        ops[length++] = op;
+        address += 2;
+
+        if(op.op == OP_1NNN || length == max_block_length || address >= 0xFFF)
+        {
+            break;
+        }
+    }
+
+    if(length == 0)
+    {
+        return false;
+    }
+
+    //host register of V0..VF and I
+    std::array<uint8_t, 17> host{};
+    uint32_t next_register = 0;
+    for(uint32_t i = 0; i < 17; i++)
+    {
+        if(used & (1u << i))
+        {
+            host[i] = allocatable[next_register++];
+        }
+    }
+
+    set_writable(true);
+    x64_emitter emit(code, code_used);
+    size_t start = code_used;
+
+    //only run when the whole block fits in the cycles left, run() interprets the rest
+    emit.alu_mi(ALU_CMP, RDI, CONTEXT_OFFSET(budget), length);
+    emit.patch(emit.jcc(CC_B), epilogue_offset);
+
+    if(used & 0xFFFF)
+    {
+        emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(V));
+        for(uint32_t i = 0; i < 16; i++)
+        {
+            if(used & (1u << i))
+            {
+                emit.load_u8(host[i], RAX, i);
+            }
+        }
+    }
+    if(used & I_BIT)
+    {
+        emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(I));
+        emit.load_u16(host[16], RAX, 0);
+    }
+
+    //side exits of taken skips and of FX65 running past the end of memory
+    std::array<block_exit, max_block_length> exits;
+    uint32_t exit_count = 0;
+
+    uint16_t exit_pc = address & 0xFFF;
+    for(uint32_t k = 0; k < length; k++)
+    {
+        const decoded_op& op = ops[k];
+        uint16_t op_pc = (pc + 2 * k) & 0xFFF;
+        uint8_t vx = host[op.x];
+        uint8_t vy = host[op.y];
+        uint8_t vf = host[0xF];
+        uint8_t vi = host[16];
+
+        switch(op.op)
+        {
+            case OP_1NNN:
+                exit_pc = op.nnn;
+                break;
+
+            case OP_3XNN:
+            case OP_4XNN:
+                emit.alu_ri(ALU_CMP, vx, op.nn);
+                exits[exit_count++] = {emit.jcc(op.op == OP_3XNN ? CC_E : CC_NE), static_cast<uint16_t>((op_pc + 4) & 0xFFF), k + 1, false};
+                break;
+
+            case OP_5XY0:
+            case OP_9XY0:
+                emit.alu_rr(CMP_RR, vx, vy);
+                exits[exit_count++] = {emit.jcc(op.op == OP_5XY0 ? CC_E : CC_NE), static_cast<uint16_t>((op_pc + 4) & 0xFFF), k + 1, false};
+                break;
+
+            case OP_6XNN:
+                emit.mov_ri(vx, op.nn);
+                break;
+
+            case OP_7XNN:
+                emit.alu_ri(ALU_ADD, vx, op.nn);
+                emit.alu_ri(ALU_AND, vx, 0xFF);
+                break;
+
+            case OP_8XY0:
+                emit.alu_rr(MOV_RR, vx, vy);
+                break;
+
+            case OP_8XY1:
+            case OP_8XY2:
+            case OP_8XY3:
+                emit.alu_rr(op.op == OP_8XY1 ? OR_RR : (op.op == OP_8XY2 ? AND_RR : XOR_RR), vx, vy);
+                if(quirk.logic_resets_vf)
+                {
+                    emit.mov_ri(vf, 0);
+                }
+                break;
+
+            //VF = carry, VX = sum & 0xFF, in this order as VF may be VX
+            case OP_8XY4:
+                emit.alu_rr(MOV_RR, RAX, vx);
+                emit.alu_rr(ADD_RR, RAX, vy);
+                emit.alu_rr(MOV_RR, RCX, RAX);
+                emit.shift_ri(SHIFT_RIGHT, RCX, 8);
+                emit.alu_rr(MOV_RR, vf, RCX);
+                emit.alu_ri(ALU_AND, RAX, 0xFF);
+                emit.alu_rr(MOV_RR, vx, RAX);
+                break;
+
+            //VF = VX >= VY, then VX -= VY with the new VF
+            case OP_8XY5:
+                emit.alu_rr(CMP_RR, vx, vy);
+                emit.set_eax(CC_AE);
+                emit.alu_rr(MOV_RR, vf, RAX);
+                emit.alu_rr(SUB_RR, vx, vy);
+                emit.alu_ri(ALU_AND, vx, 0xFF);
+                break;
+
+            //VF = the low bit, then VX = the source shifted, the source being VY or VX
+            case OP_8XY6:
+                emit.alu_rr(MOV_RR, RCX, quirk.shift_reads_vy ? vy : vx);
+                emit.alu_rr(MOV_RR, RAX, RCX);
+                emit.alu_ri(ALU_AND, RAX, 1);
+                emit.alu_rr(MOV_RR, vf, RAX);
+                emit.shift_ri(SHIFT_RIGHT, RCX, 1);
+                emit.alu_rr(MOV_RR, vx, RCX);
+                break;
+
+            //VF = VY >= VX, then VX = VY - VX with the new VF
+            case OP_8XY7:
+                emit.alu_rr(CMP_RR, vy, vx);
+                emit.set_eax(CC_AE);
+                emit.alu_rr(MOV_RR, vf, RAX);
+                emit.alu_rr(MOV_RR, RAX, vy);
+                emit.alu_rr(SUB_RR, RAX, vx);
+                emit.alu_ri(ALU_AND, RAX, 0xFF);
+                emit.alu_rr(MOV_RR, vx, RAX);
+                break;
+
+            case OP_8XYE:
+                emit.alu_rr(MOV_RR, RCX, quirk.shift_reads_vy ? vy : vx);
+                emit.alu_rr(MOV_RR, RAX, RCX);
+                emit.shift_ri(SHIFT_RIGHT, RAX, 7);
+                emit.alu_rr(MOV_RR, vf, RAX);
+                emit.shift_ri(SHIFT_LEFT, RCX, 1);
+                emit.alu_ri(ALU_AND, RCX, 0xFF);
+                emit.alu_rr(MOV_RR, vx, RCX);
+                break;
+
+            case OP_ANNN:
+                emit.mov_ri(vi, op.nnn);
+                break;
+
+            case OP_EX9E:
+            case OP_EXA1:
+                emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(keypad));
+                emit.alu_rr(MOV_RR, RCX, vx);
+                emit.alu_ri(ALU_AND, RCX, 0xF);
+                emit.cmp_u8_indexed_zero(RAX, RCX);
+                exits[exit_count++] = {emit.jcc(op.op == OP_EX9E ? CC_NE : CC_E), static_cast<uint16_t>((op_pc + 4) & 0xFFF), k + 1, false};
+                break;
+
+            //VF = I + VX > 0xFFF when the quirks say so, then I += VX with the new VF
+            case OP_FX1E:
+                if(quirk.add_index_sets_vf)
+                {
+                    emit.alu_rr(MOV_RR, RAX, vi);
+                    emit.alu_rr(ADD_RR, RAX, vx);
+                    emit.alu_ri(ALU_CMP, RAX, 0xFFF);
+                    emit.set_eax(CC_A);
+                    emit.alu_rr(MOV_RR, vf, RAX);
+                }
+                emit.alu_rr(ADD_RR, vi, vx);
+                emit.alu_ri(ALU_AND, vi, 0xFFFF);
+                break;
+
+            case OP_FX29:
+                emit.alu_rr(MOV_RR, vi, vx);
+                emit.shift_ri(SHIFT_LEFT, vi, 2);
+                emit.alu_rr(ADD_RR, vi, vx);
+                emit.alu_ri(ALU_ADD, vi, font_address);
+                break;
+
+            //leave before the instruction when it would run past the end of memory, so the
+            //interpreter reports the fault, returning to run() as the dispatcher would only come back
+            //to a block stopping at the same FX65. the bytes are read through RCX, I then moves as
+            //the quirks say
+            case OP_FX65:
+                emit.alu_ri(ALU_CMP, vi, 0x1000 - (op.x + 1));
+                exits[exit_count++] = {emit.jcc(CC_A), op_pc, k, true};
+                emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(memory));
+                emit.alu_rr(MOV_RR, RCX, vi);
+                for(uint32_t i = 0; i <= op.x; i++)
+                {
+                    emit.load_u8_indexed(host[i], RAX, RCX);
+                    emit.alu_ri(ALU_ADD, RCX, 1);
+                }
+                if(index_advance(quirk, op.x) != 0)
+                {
+                    emit.alu_ri(ALU_ADD, vi, index_advance(quirk, op.x));
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    //leave with the written registers stored back, continuing at exit_pc
+    auto emit_exit = [&](uint16_t exit_pc, uint32_t executed, bool leave)
+    {
+        if(written & 0xFFFF)
+        {
+            emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(V));
+            for(uint32_t i = 0; i < 16; i++)
+            {
+                if(written & (1u << i))
+                {
+                    emit.store_u8(RAX, i, host[i]);
+                }
+            }
+        }
+        if(written & I_BIT)
+        {
+            emit.load_pointer(RAX, RDI, CONTEXT_OFFSET(I));
+            emit.store_u16(RAX, 0, host[16]);
+        }
+        emit.store_imm16(RDI, CONTEXT_OFFSET(pc), exit_pc);
+        emit.alu_mi(ALU_SUB, RDI, CONTEXT_OFFSET(budget), executed);
+        emit.patch(emit.jmp(), leave ? epilogue_offset : dispatch_offset);
+    };
+
+    emit_exit(exit_pc, length, false);
+    for(uint32_t i = 0; i < exit_count; i++)
+    {
+        emit.patch(exits[i].displacement, emit.get_position());
+        emit_exit(exits[i].pc, exits[i].executed, exits[i].leave);
+    }
+
+    code_used = emit.get_position();
+    set_writable(false);
+
+    code_at[pc] = code + start;
+    block_length[pc] = static_cast<uint8_t>(length);
+    for(uint32_t i = 0; i < length * 2; i++)
+    {
+        covered[(pc + i) & 0xFFF]++;
+    }
+    compiled_blocks++;
+    return true;
+#else
+    (void)machine;
+    (void)pc;
+    return false;
+#endif
+}
+
+//remove the block starting at start, its code is reclaimed on the next flush
+void jit_compiler::drop(uint16_t start)
+{
+    for(uint32_t i = 0; i < block_length[start] * 2u; i++)
+    {
+        covered[(start + i) & 0xFFF]--;
+    }
+    code_at[start] = nullptr;
+    block_length[start] = 0;
+    visits[start] = 0;
+    invalidated_blocks++;
+}
+
+//drop every block compiled from the bytes address .. address + length - 1
+void jit_compiler::invalidate(uint16_t address, uint16_t length)
+{
+    for(uint32_t i = 0; i < length; i++)
+    {
+        uint16_t written = (address + i) & 0xFFF;
+
+        //a block covering this byte starts at most 2 * max_block_length - 1 bytes before it
+        for(uint32_t back = 0; covered[written] != 0 && back < max_block_length * 2; back++)
+        {
+            uint16_t start = (written - back) & 0xFFF;
+            if(code_at[start] != nullptr && block_length[start] * 2u > back)
+            {
+                drop(start);
+            }
+        }
+    }
+}
+
+//run count cycles, stopping early on a fault
+//the blocks run back to back inside the generated code, run() only steps in to compile a new
+//block, to interpret an instruction the blocks leave out, or to finish the last few cycles when
+//the next block is longer than what is left
+cycle_status jit_compiler::run(chip8& machine, uint64_t count)
+{
+    if(entry == nullptr || memory_size(quirks_of(machine.quirks)) > code_at.size())
+    {
+        return machine.run_table(count);
+    }
+    if(machine.quirks != quirks)
+    {
+        flush();
+        quirks = machine.quirks;
+    }
+    machine.idle = false;
+
+    context state;
+    state.V = machine.V.data();
+    state.I = &machine.I;
+    state.memory = machine.memory.data();
+    state.keypad = machine.keypad.data();
+    state.code = code_at.data();
+
+    while(count > 0)
+    {
+        uint16_t pc = machine.pc_counter & 0xFFF;
+        uint16_t instruction = (machine.memory[pc] << 8) | machine.memory[(pc + 1) & 0xFFF];
+
+        if(code_at[pc] == nullptr && is_compiled(decode_opcode(instruction)))
+        {
+            if(visits[pc] < hot_threshold)
+            {
+                visits[pc]++;
+            }else
+            {
+                compile(machine, pc);
+            }
+        }
+
+        if(code_at[pc] != nullptr)
+        {
+            uint32_t chunk = count < max_chunk ? static_cast<uint32_t>(count) : max_chunk;
+            state.pc = pc;
+            state.budget = chunk;
+            entry(&state);
+
+            uint32_t executed = chunk - state.budget;
+            if(executed > 0)
+            {
+                machine.pc_counter = state.pc;
+                machine.retire_instructions(executed);
+                count -= executed;
+                continue;
+            }
+        }
+
+        //one instruction through the interpreter
+        uint16_t store_address = machine.I;
+        cycle_status status = machine.run_table(1);
+        if(status != cycle_status::ok)
+        {
+            return status;
+        }
+        count--;
+
+        uint8_t op = opcode_table[instruction];
+        if(op == OP_FX33)
+        {
+            invalidate(store_address, 3);
+        }else if(op == OP_FX55)
+        {
+            invalidate(store_address, opcode_x(instruction) + 1);
+        }
+    }
+    return cycle_status::ok;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+#include "chip8.hpp"
+
+//x86-64 dynamic recompiler
+//hot basic blocks are translated to native code in an executable buffer, with the V registers (and
+//I) a block uses kept in host registers from its entry to its exits. blocks chain into each other
+//through a small dispatcher in the buffer and only come back to run() when they reach an address
+//without code
+//
+//the instructions that touch the stack, the display, the timers or the random number generator,
+//wait for a key or write memory (00E0, 00EE, 2NNN, BNNN, CXNN, DXYN, FX07, FX0A, FX15, FX18, FX33,
+//FX55) are left to the table interpreter, one at a time, and the stores of FX33 and FX55
+//invalidate the blocks compiled from the bytes they wrote
+//
+//the code of a block is generated for the quirk profile of the machine, so it holds no test of the
+//quirks, and the blocks are flushed when a machine with another profile is run
+//
+//the SUPER-CHIP and XO-CHIP instructions are left to the interpreter as well, and a machine with the
+//64 KB of XO-CHIP is interpreted throughout, the blocks being kept for 12 bit addresses
+//
+//on hosts other than x86-64, or when no executable memory can be mapped, run() interprets instead
+//like block_cache, a machine must either be run through one compiler only, or the compiler flushed
+//after the machine ran elsewhere or loaded a rom
+class jit_compiler
+{
+    public:
+        jit_compiler(); // constructor
+
+        ~jit_compiler(); // destructor
+
+        jit_compiler(const jit_compiler&) = delete;
+        jit_compiler& operator=(const jit_compiler&) = delete;
+
+        cycle_status run(chip8& machine, uint64_t count); // run count cycles, stopping early on a fault
+
+        void invalidate(uint16_t address, uint16_t length); // drop the blocks compiled from the given bytes
+
+        void flush(); // drop every block
+
+        bool is_native() const { return entry != nullptr; } // false when run() falls back to the interpreter
+
+        uint64_t get_compiled_blocks() const { return compiled_blocks; } // blocks compiled so far
+
+        uint64_t get_invalidated_blocks() const { return invalidated_blocks; } // blocks dropped by stores
+
+        static const uint32_t max_block_length = 64; // instructions per block at most
+
+        static const uint8_t hot_threshold = 2; // visits of an address before a block is compiled there
+
+    private:
+        //state shared with the generated code, see jit.cpp for the register use
+        struct context
+        {
+            uint8_t* V;
+            uint16_t* I;
+            const uint8_t* memory;
+            const uint8_t* keypad;
+            const uint8_t* const* code; // code_at
+            uint32_t budget; // cycles left, each block only starts when its whole length fits
+            uint16_t pc; // address of the next block
+        };
+
+        using entry_function = void (*)(context*);
+
+        bool compile(const chip8& machine, uint16_t pc); // translate the block starting at pc
+
+        void drop(uint16_t start); // remove the block starting at start
+
+        void set_writable(bool writable); // switch the code buffer between writable and executable
+
+        uint8_t* code; // executable buffer, the entry and dispatcher first, then the blocks
+        size_t code_used;
+        size_t stub_size;
+        size_t dispatch_offset; // jumped to by the exits of every block
+        size_t epilogue_offset; // returns to run()
+        entry_function entry; // null when the host cannot run generated code
+
+        std::array<const uint8_t*, 4096> code_at; // block starting at each address, null if none
+        std::array<uint8_t, 4096> block_length; // instructions of the block at each address
+        std::array<uint8_t, 4096> covered; // number of blocks compiled from each byte
+        std::array<uint8_t, 4096> visits; // visits of each address without a block, up to hot_threshold
+        quirk_profile quirks; // profile the blocks were compiled for
+
+        uint64_t compiled_blocks;
+        uint64_t invalidated_blocks;
+};
@@ -0,0 +1,1186 @@
+#include "lockstep.hpp"
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+
+#include "runner.hpp"
+
+//build the lane loops twice, for avx2 and for the baseline, the loader picking the one the host runs
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__ELF__) && defined(__GNUC__) && (!defined(__clang__) || __clang_major__ >= 14)
+#define CHIP8_LANE_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CHIP8_LANE_CLONES
+#endif
+
+#define CHIP8_LANES(lane) for(size_t lane = 0; lane < lanes_per_group; lane++)
+
+namespace
+{
+    const size_t lanes_per_group = lockstep_engine::group_lanes;
+
+    //bytes of memory of a lane, the lanes only run the 4 KB of CHIP-8
+    const size_t lane_memory = chip8_base_memory_size;
+
+    //whether the lanes run the instructions of a profile, the others run on the scalar core throughout
+    bool runs_in_lanes(quirk_profile profile)
+    {
+        return quirks_of(profile).instructions == instruction_set::chip8;
+    }
+
+    template<typename element>
+    using lane_array = std::array<element, lanes_per_group>;
+
+    enum lane_state : uint8_t
+    {
+        lane_empty, // no machine in this lane
+        lane_vector, // run in lockstep
+        lane_scalar, // run by its scalar machine
+        lane_faulted // stopped by a fault while in lockstep
+    };
+
+    //cycles of one run_group call at most, so the lane budgets fit 32 bits
+    const uint64_t max_group_run = 1u << 30;
+
+    //value in the lanes of the mask, old in the others, as bit operations so the lane loops vectorize
+    inline uint8_t blend(uint8_t mask, uint8_t value, uint8_t old)
+    {
+        return (value & mask) | (old & ~mask);
+    }
+
+    inline uint16_t blend(uint16_t mask, uint16_t value, uint16_t old)
+    {
+        return (value & mask) | (old & ~mask);
+    }
+
+    inline uint32_t blend(uint32_t mask, uint32_t value, uint32_t old)
+    {
+        return (value & mask) | (old & ~mask);
+    }
+}
+
+//state of the lanes of a group, one array element per lane
+struct lockstep_group
+{
+    alignas(32) std::array<lane_array<uint8_t>, 16> V;
+    alignas(32) lane_array<uint16_t> I;
+    alignas(32) lane_array<uint16_t> pc;
+    alignas(32) lane_array<uint32_t> remaining; // cycles left in the current run
+    alignas(32) lane_array<uint8_t> state; // lane_state
+    lane_array<uint8_t> delay_timer;
+    lane_array<uint8_t> sound_timer;
+    lane_array<uint64_t> timer_frame; // frame the timers were last updated to
+    lane_array<uint64_t> cycle_count;
+    std::array<lane_array<uint16_t>, lockstep_engine::stack_depth> stack;
+    lane_array<uint8_t> stack_size;
+    std::array<lane_array<uint8_t>, 16> keypad;
+    lane_array<uint8_t> draw_flag;
+    alignas(32) lane_array<uint32_t> random_state; // CXNN generator of each lane
+    lane_array<uint32_t> solo_steps; // steps run alone since the lane last ran with others
+    lane_array<cycle_status> status;
+    lane_array<std::array<uint64_t, 32>> display;
+    lane_array<std::array<uint8_t, lane_memory>> memory;
+    std::array<uint8_t, lane_memory> divergent; // bytes that may differ between the lockstep lanes
+    lane_array<std::unique_ptr<chip8>> scalar; // machine of each lane that moved to the scalar core
+
+    uint32_t instructions_per_frame;
+    sprite_edge edge;
+    quirk_profile quirks;
+    bool idle_skipping; // the machines of the lanes on the scalar core retire idle loops at once
+    uint64_t steps;
+    uint64_t lane_instructions;
+};
+
+namespace
+{
+    //copy a machine into a lane
+    void machine_to_lane(lockstep_group& group, size_t lane, const chip8& machine)
+    {
+        group.stack_size[lane] = machine.get_stack_pointer();
+        for(uint8_t depth = 0; depth < machine.get_stack_pointer(); depth++)
+        {
+            group.stack[depth][lane] = machine.get_stack_entry(depth);
+        }
+        for(uint8_t r = 0; r < 16; r++)
+        {
+            group.V[r][lane] = machine.get_V(r);
+        }
+        group.I[lane] = machine.get_I();
+        group.pc[lane] = machine.get_pc();
+        group.cycle_count[lane] = machine.get_cycle_count();
+        group.random_state[lane] = machine.get_random_state();
+        group.solo_steps[lane] = 0;
+        group.status[lane] = cycle_status::ok;
+        group.state[lane] = lane_vector;
+        for(int y = 0; y < 32; y++)
+        {
+            group.display[lane][y] = machine.get_display_row(y);
+        }
+    }
+
+    //a timer of a lane as the machine would read it
+    uint8_t lane_timer(const lockstep_group& group, size_t lane, uint8_t timer)
+    {
+        uint64_t ticks = group.cycle_count[lane] / group.instructions_per_frame - group.timer_frame[lane];
+        return ticks < timer ? static_cast<uint8_t>(timer - ticks) : 0;
+    }
+}
+
+//the machine is reset first, a scalar machine kept from an earlier rom would otherwise carry its
+//flags, audio pattern and pitch into the lane. the lanes run the 4 KB profiles, so the memory past
+//the lane's is left out of use rather than cleared
+void lockstep_engine::lane_to_machine(const lockstep_group& group, size_t lane, chip8& machine)
+{
+    machine.reset();
+    machine.pc_counter = group.pc[lane];
+    machine.I = group.I[lane];
+    for(uint8_t r = 0; r < 16; r++)
+    {
+        machine.V[r] = group.V[r][lane];
+    }
+    machine.stack_pointer = group.stack_size[lane];
+    for(size_t depth = 0; depth < group.stack_size[lane]; depth++)
+    {
+        machine.stack_memory[depth] = group.stack[depth][lane];
+    }
+    machine.delay_timer = group.delay_timer[lane];
+    machine.sound_timer = group.sound_timer[lane];
+    machine.timer_frame = group.timer_frame[lane];
+    machine.cycle_count = group.cycle_count[lane];
+    machine.random_state = group.random_state[lane];
+    machine.instructions_per_frame = group.instructions_per_frame;
+    machine.idle_skipping = group.idle_skipping;
+    std::copy(group.memory[lane].begin(), group.memory[lane].end(), machine.memory.begin());
+    for(auto& plane : machine.display)
+    {
+        plane.fill(0);
+    }
+    std::copy(group.display[lane].begin(), group.display[lane].end(), machine.display[0].begin());
+    machine.high_resolution = false;
+    machine.selected_planes = 1;
+    machine.edge = group.edge;
+    machine.quirks = group.quirks;
+    for(uint8_t key = 0; key < 16; key++)
+    {
+        machine.keypad[key] = group.keypad[key][lane];
+    }
+    machine.draw_flag = group.draw_flag[lane] != 0;
+    machine.dispatch = dispatch_mode::table;
+}
+
+void lockstep_engine::to_scalar(lockstep_group& group, size_t lane)
+{
+    if(!group.scalar[lane])
+    {
+        group.scalar[lane] = std::make_unique<chip8>();
+    }
+    lane_to_machine(group, lane, *group.scalar[lane]);
+    group.state[lane] = lane_scalar;
+    group.solo_steps[lane] = 0;
+}
+
+//the parts machine_to_lane cannot reach through the accessors are copied here
+void lockstep_engine::from_scalar(lockstep_group& group, size_t lane)
+{
+    const chip8& machine = *group.scalar[lane];
+    machine_to_lane(group, lane, machine);
+    group.delay_timer[lane] = machine.delay_timer;
+    group.sound_timer[lane] = machine.sound_timer;
+    group.timer_frame[lane] = machine.timer_frame;
+    std::copy_n(machine.memory.begin(), lane_memory, group.memory[lane].begin());
+    for(uint8_t key = 0; key < 16; key++)
+    {
+        group.keypad[key][lane] = machine.keypad[key];
+    }
+    group.draw_flag[lane] = machine.draw_flag;
+}
+
+lockstep_engine::lockstep_engine(size_t machines, size_t threads, bool pin_threads)
+    : machines(machines), instructions_per_frame(default_instructions_per_frame), edge(sprite_edge::wrap),
+      quirks(quirk_profile::modern), idle_skipping(true), pool(threads, pin_threads)
+{
+    chip8 blank;
+    blank.chip8_init();
+    for(size_t first = 0; first < machines; first += lanes_per_group)
+    {
+        std::unique_ptr<lockstep_group> group = std::make_unique<lockstep_group>();
+        group->instructions_per_frame = instructions_per_frame;
+        group->edge = edge;
+        group->quirks = quirks;
+        group->idle_skipping = idle_skipping;
+        group->steps = 0;
+        group->lane_instructions = 0;
+        group->divergent.fill(0);
+        CHIP8_LANES(lane)
+        {
+            std::copy_n(blank.memory.begin(), lane_memory, group->memory[lane].begin());
+            group->delay_timer[lane] = 0;
+            group->sound_timer[lane] = 0;
+            group->timer_frame[lane] = 0;
+            group->draw_flag[lane] = 0;
+            group->remaining[lane] = 0;
+            for(uint8_t key = 0; key < 16; key++)
+            {
+                group->keypad[key][lane] = 0;
+            }
+            machine_to_lane(*group, lane, blank);
+            if(first + lane >= machines)
+            {
+                group->state[lane] = lane_empty;
+            }
+        }
+        groups.push_back(std::move(group));
+    }
+}
+
+lockstep_engine::~lockstep_engine() = default;
+
+//the rom is read once, every lane starts from the same freshly loaded machine
+bool lockstep_engine::load_rom(const std::string& rom_path)
+{
+    std::vector<uint8_t> image;
+    return read_rom_file(rom_path, image) && load_program(image.data(), image.size());
+}
+
+bool lockstep_engine::load_program(const uint8_t* data, size_t size)
+{
+    chip8 blank;
+    blank.chip8_init();
+    if(!blank.load_program(data, size))
+    {
+        return false;
+    }
+    blank.set_instructions_per_frame(instructions_per_frame);
+    blank.set_quirk_profile(quirks);
+    blank.set_sprite_edge(edge);
+    blank.set_idle_skipping(idle_skipping);
+
+    for(size_t index = 0; index < machines; index++)
+    {
+        lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        std::copy_n(blank.memory.begin(), lane_memory, group.memory[lane].begin());
+        machine_to_lane(group, lane, blank);
+        group.delay_timer[lane] = 0;
+        group.sound_timer[lane] = 0;
+        group.timer_frame[lane] = 0;
+        group.draw_flag[lane] = 0;
+        for(uint8_t key = 0; key < 16; key++)
+        {
+            group.keypad[key][lane] = 0;
+        }
+        if(!runs_in_lanes(quirks))
+        {
+            group.scalar[lane] = std::make_unique<chip8>(blank);
+            group.state[lane] = lane_scalar;
+        }
+    }
+    for(auto& group : groups)
+    {
+        group->divergent.fill(0);
+    }
+    return true;
+}
+
+void lockstep_engine::set_instructions_per_frame(uint32_t count)
+{
+    instructions_per_frame = count > 0 ? count : 1;
+    for(size_t index = 0; index < machines; index++)
+    {
+        lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        if(group.state[lane] == lane_scalar)
+        {
+            group.scalar[lane]->set_instructions_per_frame(instructions_per_frame);
+            continue;
+        }
+
+        //the ticks already due are applied at the old length, as chip8::set_instructions_per_frame does
+        group.delay_timer[lane] = lane_timer(group, lane, group.delay_timer[lane]);
+        group.sound_timer[lane] = lane_timer(group, lane, group.sound_timer[lane]);
+        group.timer_frame[lane] = group.cycle_count[lane] / instructions_per_frame;
+    }
+    for(auto& group : groups)
+    {
+        group->instructions_per_frame = instructions_per_frame;
+    }
+}
+
+void lockstep_engine::set_sprite_edge(sprite_edge mode)
+{
+    edge = mode;
+    for(auto& group : groups)
+    {
+        group->edge = mode;
+        CHIP8_LANES(lane)
+        {
+            if(group->state[lane] == lane_scalar)
+            {
+                group->scalar[lane]->set_sprite_edge(mode);
+            }
+        }
+    }
+}
+
+//as on a machine, the sprite edge follows the profile
+void lockstep_engine::set_quirk_profile(quirk_profile profile)
+{
+    quirks = profile;
+    edge = quirks_of(profile).edge;
+    for(auto& group : groups)
+    {
+        group->quirks = profile;
+        group->edge = edge;
+        CHIP8_LANES(lane)
+        {
+            if(group->state[lane] == lane_scalar)
+            {
+                group->scalar[lane]->set_quirk_profile(profile);
+            }
+        }
+    }
+}
+
+void lockstep_engine::set_keypad(size_t index, uint8_t key, uint8_t value)
+{
+    lockstep_group& group = *groups.at(index / lanes_per_group);
+    size_t lane = index % lanes_per_group;
+    if(group.state[lane] == lane_scalar)
+    {
+        group.scalar[lane]->set_keypad(key, value);
+    }else
+    {
+        group.keypad.at(key)[lane] = value;
+    }
+}
+
+void lockstep_engine::set_keypad_all(uint8_t key, uint8_t value)
+{
+    for(size_t index = 0; index < machines; index++)
+    {
+        set_keypad(index, key, value);
+    }
+}
+
+//the states are worked out by a scalar machine so each lane starts from the bytes a machine seeded
+//alike would
+void lockstep_engine::set_random_seed(uint32_t seed)
+{
+    chip8 seeded;
+    for(size_t index = 0; index < machines; index++)
+    {
+        lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        seeded.set_random_seed(machine_seed(seed, index));
+        group.random_state[lane] = seeded.get_random_state();
+        if(group.state[lane] == lane_scalar)
+        {
+            group.scalar[lane]->set_random_seed(machine_seed(seed, index));
+        }
+    }
+}
+
+void lockstep_engine::set_idle_skipping(bool skip)
+{
+    idle_skipping = skip;
+    for(auto& group : groups)
+    {
+        group->idle_skipping = skip;
+        CHIP8_LANES(lane)
+        {
+            if(group->scalar[lane])
+            {
+                group->scalar[lane]->set_idle_skipping(skip);
+            }
+        }
+    }
+}
+
+//lanes that moved to the scalar core come back when they reached an address of the lockstep lanes,
+//then the lockstep lanes run and the scalar ones after them
+void lockstep_engine::run(uint64_t cycles)
+{
+    pool.run(groups.size(), [this, cycles](size_t index)
+    {
+        lockstep_group& group = *groups[index];
+
+        size_t reference = lanes_per_group;
+        CHIP8_LANES(lane)
+        {
+            if(group.state[lane] == lane_vector)
+            {
+                reference = lane;
+                break;
+            }
+        }
+        CHIP8_LANES(lane)
+        {
+            if(group.state[lane] != lane_scalar || group.status[lane] != cycle_status::ok || !runs_in_lanes(group.quirks))
+            {
+                continue;
+            }
+
+            bool rejoin = reference == lanes_per_group;
+            for(size_t other = 0; other < lanes_per_group && !rejoin; other++)
+            {
+                rejoin = group.state[other] == lane_vector &&
+                         (group.pc[other] & 0xFFF) == (group.scalar[lane]->get_pc() & 0xFFF);
+            }
+            if(!rejoin)
+            {
+                continue;
+            }
+            from_scalar(group, lane);
+
+            //the lane's memory may have been written differently while it ran on its own
+            if(reference == lanes_per_group)
+            {
+                reference = lane;
+            }else
+            {
+                for(size_t address = 0; address < lane_memory; address++)
+                {
+                    group.divergent[address] |= group.memory[lane][address] != group.memory[reference][address];
+                }
+            }
+        }
+
+        for(uint64_t left = cycles; left > 0;)
+        {
+            uint32_t count = static_cast<uint32_t>(std::min(left, max_group_run));
+            run_group(group, count);
+            left -= count;
+        }
+    });
+}
+
+//one instruction per step for every lane at the lowest address, the handlers mirror chip8_ops.inl
+//with each statement applied to all the lanes in turn, so a lane sees the same order of reads and
+//writes as on the scalar core. the loop is compiled once per quirk profile
+template<quirk_profile profile>
+CHIP8_LANE_CLONES
+void lockstep_engine::run_lanes(lockstep_group& group, uint32_t count)
+{
+    constexpr quirk_set quirk = quirks_of(profile);
+    (void)count;
+    lockstep_group& g = group;
+    alignas(32) lane_array<uint8_t> mask; // 0xFF for the lanes of the step, 0 for the others
+    alignas(32) lane_array<uint16_t> mask16; // the same, for the 16 bit arrays
+    alignas(32) lane_array<uint8_t> result;
+    alignas(32) lane_array<uint8_t> flag;
+
+    for(;;)
+    {
+        //the lowest address among the runnable lanes runs next, so lanes left behind catch up
+        //the lane loops are branch free so they compile to vector compares and blends
+        uint16_t target = 0xFFFF;
+        uint32_t runnable = 0;
+        CHIP8_LANES(lane)
+        {
+            uint16_t ready = (g.state[lane] == lane_vector) & (g.remaining[lane] != 0);
+            uint16_t address = (g.pc[lane] & 0xFFF) | static_cast<uint16_t>(ready - 1);
+            target = address < target ? address : target;
+            runnable += ready;
+        }
+        if(runnable == 0)
+        {
+            break;
+        }
+
+        uint32_t lanes = 0;
+        CHIP8_LANES(lane)
+        {
+            uint16_t ready = (g.state[lane] == lane_vector) & (g.remaining[lane] != 0);
+            uint16_t hit = ready & ((g.pc[lane] & 0xFFF) == target);
+            mask16[lane] = static_cast<uint16_t>(-hit);
+            mask[lane] = static_cast<uint8_t>(-hit);
+            lanes += hit;
+        }
+        size_t leader = 0;
+        while(mask[leader] == 0)
+        {
+            leader++;
+        }
+
+        uint16_t instruction = (g.memory[leader][target] << 8) | g.memory[leader][(target + 1) & 0xFFF];
+        if(g.divergent[target] | g.divergent[(target + 1) & 0xFFF])
+        {
+            //the lanes whose code differs here wait for a later step
+            lanes = 0;
+            CHIP8_LANES(lane)
+            {
+                uint16_t own = (g.memory[lane][target] << 8) | g.memory[lane][(target + 1) & 0xFFF];
+                mask[lane] = own == instruction ? mask[lane] : 0;
+                mask16[lane] = static_cast<uint16_t>(-(mask[lane] & 1));
+                lanes += mask[lane] & 1;
+            }
+        }
+
+        //a lane running on its own while the others wait moves to the scalar core
+        if(lanes == 1 && runnable > 1 && ++g.solo_steps[leader] > max_solo_steps)
+        {
+            to_scalar(g, leader);
+            continue;
+        }
+
+        uint8_t x = opcode_x(instruction);
+        uint8_t y = opcode_y(instruction);
+        uint8_t n = opcode_n(instruction);
+        uint8_t nn = opcode_nn(instruction);
+        uint16_t nnn = opcode_nnn(instruction);
+        uint16_t next = (target + 2) & 0xFFF;
+        lane_array<uint8_t>& VX = g.V[x];
+        lane_array<uint8_t>& VY = g.V[y];
+        lane_array<uint8_t>& VF = g.V[0xF];
+
+        //a fault leaves the lane just past the instruction, which is not retired
+        auto fault = [&](size_t lane, cycle_status status)
+        {
+            g.pc[lane] = next;
+            g.status[lane] = status;
+            g.state[lane] = lane_faulted;
+            g.remaining[lane] = 0;
+            mask[lane] = 0;
+            mask16[lane] = 0;
+        };
+        auto set_pc = [&](uint16_t address)
+        {
+            CHIP8_LANES(lane)
+            {
+                g.pc[lane] = blend(mask16[lane], address, g.pc[lane]);
+            }
+        };
+        auto skip_if = [&](const lane_array<uint8_t>& taken)
+        {
+            CHIP8_LANES(lane)
+            {
+                uint16_t address = (next + 2 * (taken[lane] & 1)) & address_mask(quirk);
+                g.pc[lane] = blend(mask16[lane], address, g.pc[lane]);
+            }
+        };
+        auto update_timers = [&](size_t lane)
+        {
+            g.delay_timer[lane] = lane_timer(g, lane, g.delay_timer[lane]);
+            g.sound_timer[lane] = lane_timer(g, lane, g.sound_timer[lane]);
+            g.timer_frame[lane] = g.cycle_count[lane] / g.instructions_per_frame;
+        };
+
+        //keep the lockstep lanes' view of which bytes differ up to date after a store
+        auto note_store = [&](uint16_t address)
+        {
+            uint8_t byte = g.memory[leader][address];
+            uint8_t differs = 0;
+            CHIP8_LANES(lane)
+            {
+                differs |= (g.state[lane] == lane_vector) & (g.memory[lane][address] != byte);
+            }
+            g.divergent[address] = differs;
+        };
+        auto note_stores = [&](const lane_array<uint16_t>& start, uint16_t length)
+        {
+            CHIP8_LANES(lane)
+            {
+                if(mask[lane] && (lane == leader || !mask[leader] || start[lane] != start[leader]))
+                {
+                    for(uint16_t offset = 0; offset < length; offset++)
+                    {
+                        note_store(start[lane] + offset);
+                    }
+                }
+            }
+        };
+
+        switch(opcode_table[instruction])
+        {
+            case OP_00E0:
+                CHIP8_LANES(lane)
+                {
+                    if(mask[lane])
+                    {
+                        g.display[lane].fill(0);
+                        g.draw_flag[lane] = 1;
+                    }
+                }
+                set_pc(next);
+                break;
+
+            case OP_00EE:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.stack_size[lane] == 0)
+                    {
+                        fault(lane, cycle_status::stack_underflow);
+                        continue;
+                    }
+                    g.pc[lane] = g.stack[--g.stack_size[lane]][lane];
+                }
+                break;
+
+            case OP_1NNN:
+                set_pc(nnn);
+                break;
+
+            case OP_2NNN:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.stack_size[lane] == stack_depth)
+                    {
+                        fault(lane, cycle_status::stack_overflow);
+                        continue;
+                    }
+                    g.stack[g.stack_size[lane]++][lane] = next;
+                    g.pc[lane] = nnn;
+                }
+                break;
+
+            case OP_3XNN:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = VX[lane] == nn;
+                }
+                skip_if(flag);
+                break;
+
+            case OP_4XNN:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = VX[lane] != nn;
+                }
+                skip_if(flag);
+                break;
+
+            //5XY2 and 5XY3 are 5XY0 without XO-CHIP, whose machines never run in the lanes
+            case OP_5XY0:
+            case OP_5XY2:
+            case OP_5XY3:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = VX[lane] == VY[lane];
+                }
+                skip_if(flag);
+                break;
+
+            case OP_6XNN:
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], nn, VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_7XNN:
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>(VX[lane] + nn), VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_8XY0:
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], VY[lane], VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_8XY1:
+            case OP_8XY2:
+            case OP_8XY3:
+            {
+                uint8_t op = opcode_table[instruction];
+                CHIP8_LANES(lane)
+                {
+                    uint8_t value = op == OP_8XY1 ? (VX[lane] | VY[lane]) :
+                                    op == OP_8XY2 ? (VX[lane] & VY[lane]) : (VX[lane] ^ VY[lane]);
+                    VX[lane] = blend(mask[lane], value, VX[lane]);
+                }
+                if constexpr(quirk.logic_resets_vf)
+                {
+                    CHIP8_LANES(lane)
+                    {
+                        VF[lane] = blend(mask[lane], 0, VF[lane]);
+                    }
+                }
+                set_pc(next);
+                break;
+            }
+
+            case OP_8XY4:
+                CHIP8_LANES(lane)
+                {
+                    uint16_t sum = VX[lane] + VY[lane];
+                    flag[lane] = sum > 0xFF ? 1 : 0;
+                    result[lane] = sum & 0xFF;
+                }
+                CHIP8_LANES(lane)
+                {
+                    VF[lane] = blend(mask[lane], flag[lane], VF[lane]);
+                }
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], result[lane], VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_8XY5:
+                CHIP8_LANES(lane)
+                {
+                    VF[lane] = blend(mask[lane], (VX[lane] >= VY[lane] ? 1 : 0), VF[lane]);
+                }
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>(VX[lane] - VY[lane]), VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_8XY6:
+            {
+                const lane_array<uint8_t>& source = quirk.shift_reads_vy ? VY : VX;
+                result = source;
+                CHIP8_LANES(lane)
+                {
+                    VF[lane] = blend(mask[lane], result[lane] & 0x1, VF[lane]);
+                }
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>(result[lane] >> 1), VX[lane]);
+                }
+                set_pc(next);
+                break;
+            }
+
+            case OP_8XY7:
+                CHIP8_LANES(lane)
+                {
+                    VF[lane] = blend(mask[lane], (VY[lane] >= VX[lane] ? 1 : 0), VF[lane]);
+                }
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>(VY[lane] - VX[lane]), VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_8XYE:
+            {
+                const lane_array<uint8_t>& source = quirk.shift_reads_vy ? VY : VX;
+                result = source;
+                CHIP8_LANES(lane)
+                {
+                    VF[lane] = blend(mask[lane], result[lane] >> 7, VF[lane]);
+                }
+                CHIP8_LANES(lane)
+                {
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>(result[lane] << 1), VX[lane]);
+                }
+                set_pc(next);
+                break;
+            }
+
+            case OP_9XY0:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = VX[lane] != VY[lane];
+                }
+                skip_if(flag);
+                break;
+
+            case OP_ANNN:
+                CHIP8_LANES(lane)
+                {
+                    g.I[lane] = blend(mask16[lane], nnn, g.I[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_BNNN:
+                CHIP8_LANES(lane)
+                {
+                    uint16_t address = nnn + g.V[quirk.jump_reads_vx ? x : 0][lane];
+                    g.pc[lane] = blend(mask16[lane], address, g.pc[lane]);
+                }
+                break;
+
+            case OP_CXNN:
+                //the xorshift of chip8::random_byte, stepped in the masked lanes only
+                CHIP8_LANES(lane)
+                {
+                    uint32_t state = g.random_state[lane];
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    g.random_state[lane] = blend(static_cast<uint32_t>(0u - (mask[lane] & 1)), state, g.random_state[lane]);
+                    VX[lane] = blend(mask[lane], static_cast<uint8_t>((state >> 24) & nn), VX[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_DXYN:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.I[lane] + n > 0x1000)
+                    {
+                        fault(lane, cycle_status::address_fault);
+                        continue;
+                    }
+                    VF[lane] = xor_sprite(g.display[lane].data(), &g.memory[lane][g.I[lane]], VX[lane], VY[lane], n, g.edge) ? 1 : 0;
+                    if(n > 0)
+                    {
+                        g.draw_flag[lane] = 1;
+                    }
+                    g.pc[lane] = next;
+                }
+                break;
+
+            case OP_EX9E:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = g.keypad[VX[lane] & 0xF][lane] != 0;
+                }
+                skip_if(flag);
+                break;
+
+            case OP_EXA1:
+                CHIP8_LANES(lane)
+                {
+                    flag[lane] = g.keypad[VX[lane] & 0xF][lane] == 0;
+                }
+                skip_if(flag);
+                break;
+
+            case OP_FX07:
+                CHIP8_LANES(lane)
+                {
+                    if(mask[lane])
+                    {
+                        update_timers(lane);
+                        VX[lane] = g.delay_timer[lane];
+                    }
+                }
+                set_pc(next);
+                break;
+
+            case OP_FX0A:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    g.pc[lane] = next - 2;
+                    for(uint8_t key = 0; key < 16; key++)
+                    {
+                        if(g.keypad[key][lane] != 0)
+                        {
+                            VX[lane] = key;
+                            g.pc[lane] = next;
+                            break;
+                        }
+                    }
+                }
+                break;
+
+            case OP_FX15:
+            case OP_FX18:
+            {
+                lane_array<uint8_t>& timer = opcode_table[instruction] == OP_FX15 ? g.delay_timer : g.sound_timer;
+                CHIP8_LANES(lane)
+                {
+                    if(mask[lane])
+                    {
+                        update_timers(lane);
+                        timer[lane] = VX[lane];
+                    }
+                }
+                set_pc(next);
+                break;
+            }
+
+            case OP_FX1E:
+                if constexpr(quirk.add_index_sets_vf)
+                {
+                    CHIP8_LANES(lane)
+                    {
+                        uint8_t carry = g.I[lane] + VX[lane] > 0xFFF ? 1 : 0;
+                        VF[lane] = blend(mask[lane], carry, VF[lane]);
+                    }
+                }
+                CHIP8_LANES(lane)
+                {
+                    uint16_t sum = g.I[lane] + VX[lane];
+                    g.I[lane] = blend(mask16[lane], sum, g.I[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_FX29:
+                CHIP8_LANES(lane)
+                {
+                    uint16_t address = VX[lane] * 0x5 + font_address;
+                    g.I[lane] = blend(mask16[lane], address, g.I[lane]);
+                }
+                set_pc(next);
+                break;
+
+            case OP_FX33:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.I[lane] + 3 > 0x1000)
+                    {
+                        fault(lane, cycle_status::address_fault);
+                        continue;
+                    }
+                    uint8_t value = VX[lane];
+                    g.memory[lane][g.I[lane]] = value / 100;
+                    g.memory[lane][g.I[lane] + 1] = (value / 10) % 10;
+                    g.memory[lane][g.I[lane] + 2] = value % 10;
+                    g.pc[lane] = next;
+                }
+                note_stores(g.I, 3);
+                break;
+
+            case OP_FX55:
+            {
+                lane_array<uint16_t> start = g.I;
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.I[lane] + x + 1 > 0x1000)
+                    {
+                        fault(lane, cycle_status::address_fault);
+                        continue;
+                    }
+                    for(int i = 0; i <= x; i++)
+                    {
+                        g.memory[lane][g.I[lane] + i] = g.V[i][lane];
+                    }
+                    g.I[lane] += index_advance(quirk, x);
+                    g.pc[lane] = next;
+                }
+                note_stores(start, x + 1);
+                break;
+            }
+
+            case OP_FX65:
+                CHIP8_LANES(lane)
+                {
+                    if(!mask[lane])
+                    {
+                        continue;
+                    }
+                    if(g.I[lane] + x + 1 > 0x1000)
+                    {
+                        fault(lane, cycle_status::address_fault);
+                        continue;
+                    }
+                    for(int i = 0; i <= x; i++)
+                    {
+                        g.V[i][lane] = g.memory[lane][g.I[lane] + i];
+                    }
+                    g.I[lane] += index_advance(quirk, x);
+                    g.pc[lane] = next;
+                }
+                break;
+
+            //0NNN and unknown instructions do nothing
+            default:
+                set_pc(next);
+                break;
+        }
+
+        CHIP8_LANES(lane)
+        {
+            uint32_t retired = mask[lane] & 1;
+            g.remaining[lane] -= retired;
+            g.cycle_count[lane] += retired;
+        }
+        if(lanes > 1)
+        {
+            CHIP8_LANES(lane)
+            {
+                g.solo_steps[lane] &= ~static_cast<uint32_t>(-(mask[lane] & 1));
+            }
+        }
+        g.steps++;
+        g.lane_instructions += lanes;
+    }
+}
+
+//defined after run_lanes, a target_clones template only gets its clones when defined before its first use
+void lockstep_engine::run_group(lockstep_group& group, uint32_t count)
+{
+    //lanes left in lockstep when the profile changed to one the lanes do not run
+    if(!runs_in_lanes(group.quirks))
+    {
+        CHIP8_LANES(lane)
+        {
+            if(group.state[lane] == lane_vector)
+            {
+                to_scalar(group, lane);
+            }
+        }
+    }
+
+    CHIP8_LANES(lane)
+    {
+        bool runs = (group.state[lane] == lane_vector || group.state[lane] == lane_scalar) &&
+                    group.status[lane] == cycle_status::ok;
+        group.remaining[lane] = runs ? count : 0;
+    }
+
+    with_quirk_profile(group.quirks, [&](auto profile) {
+        run_lanes<decltype(profile)::value>(group, count);
+    });
+
+    CHIP8_LANES(lane)
+    {
+        if(group.state[lane] == lane_scalar && group.remaining[lane] != 0)
+        {
+            group.status[lane] = group.scalar[lane]->run_cycles(group.remaining[lane]);
+            group.remaining[lane] = 0;
+        }
+    }
+}
+
+cycle_status lockstep_engine::get_status(size_t index) const
+{
+    return groups.at(index / lanes_per_group)->status[index % lanes_per_group];
+}
+
+size_t lockstep_engine::get_faulted() const
+{
+    size_t faulted = 0;
+    for(size_t index = 0; index < machines; index++)
+    {
+        faulted += get_status(index) != cycle_status::ok ? 1 : 0;
+    }
+    return faulted;
+}
+
+bool lockstep_engine::is_scalar(size_t index) const
+{
+    return groups.at(index / lanes_per_group)->state[index % lanes_per_group] == lane_scalar;
+}
+
+size_t lockstep_engine::get_scalar_count() const
+{
+    size_t scalar = 0;
+    for(size_t index = 0; index < machines; index++)
+    {
+        scalar += is_scalar(index) ? 1 : 0;
+    }
+    return scalar;
+}
+
+uint64_t lockstep_engine::get_total_cycles() const
+{
+    uint64_t total = 0;
+    for(size_t index = 0; index < machines; index++)
+    {
+        const lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        total += group.state[lane] == lane_scalar ? group.scalar[lane]->get_cycle_count() : group.cycle_count[lane];
+    }
+    return total;
+}
+
+uint64_t lockstep_engine::get_steps() const
+{
+    uint64_t steps = 0;
+    for(const auto& group : groups)
+    {
+        steps += group->steps;
+    }
+    return steps;
+}
+
+uint64_t lockstep_engine::get_lane_instructions() const
+{
+    uint64_t instructions = 0;
+    for(const auto& group : groups)
+    {
+        instructions += group->lane_instructions;
+    }
+    return instructions;
+}
+
+void lockstep_engine::copy_framebuffers(uint64_t* rows) const
+{
+    for(size_t index = 0; index < machines; index++)
+    {
+        const lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        for(int y = 0; y < 32; y++)
+        {
+            *rows++ = group.state[lane] == lane_scalar ? group.scalar[lane]->get_display_row(y) : group.display[lane][y];
+        }
+    }
+}
+
+void lockstep_engine::copy_registers(machine_registers* registers) const
+{
+    for(size_t index = 0; index < machines; index++)
+    {
+        const lockstep_group& group = *groups[index / lanes_per_group];
+        size_t lane = index % lanes_per_group;
+        machine_registers& copy = registers[index];
+        copy.status = group.status[lane];
+        if(group.state[lane] == lane_scalar)
+        {
+            const chip8& machine = *group.scalar[lane];
+            for(uint8_t r = 0; r < 16; r++)
+            {
+                copy.V[r] = machine.get_V(r);
+            }
+            copy.I = machine.get_I();
+            copy.pc = machine.get_pc();
+            copy.delay_timer = machine.get_delay_timer();
+            copy.sound_timer = machine.get_sound_timer();
+            copy.cycle_count = machine.get_cycle_count();
+            continue;
+        }
+        for(uint8_t r = 0; r < 16; r++)
+        {
+            copy.V[r] = group.V[r][lane];
+        }
+        copy.I = group.I[lane];
+        copy.pc = group.pc[lane];
+        copy.delay_timer = lane_timer(group, lane, group.delay_timer[lane]);
+        copy.sound_timer = lane_timer(group, lane, group.sound_timer[lane]);
+        copy.cycle_count = group.cycle_count[lane];
+    }
+}
+
+void lockstep_engine::export_machine(size_t index, chip8& machine) const
+{
+    const lockstep_group& group = *groups.at(index / lanes_per_group);
+    size_t lane = index % lanes_per_group;
+    if(group.state[lane] == lane_scalar)
+    {
+        machine = *group.scalar[lane];
+    }else
+    {
+        lane_to_machine(group, lane, machine);
+    }
+}
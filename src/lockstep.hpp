@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "chip8.hpp"
+#include "batch.hpp"
+#include "thread_pool.hpp"
+
+struct lockstep_group;
+
+//lockstep interpreter
+//machines running the same rom are kept in groups of group_lanes lanes with their state stored as
+//lane arrays (V[register][lane], I[lane], pc[lane], the timers, the stack), and every step runs one
+//instruction for all the lanes at the same address at once, the others being masked off. the lane
+//loops are written to be vectorized (avx2 clones are built where the toolchain supports them)
+//
+//the lowest address among the lanes runs first so lanes that branched apart catch up and run
+//together again. a lane that keeps running on its own for max_solo_steps steps moves to the scalar
+//table core until the start of a later run finds it back at the address of the group
+//
+//the lanes run the CHIP-8 profiles, a machine of a profile with the SUPER-CHIP or XO-CHIP instructions
+//runs on the scalar core from the start
+//
+//every lane runs exactly the instructions the scalar core would run, the timers following each
+//lane's cycle count, so runs end in the same state as on the scalar core
+class lockstep_engine
+{
+    public:
+        static const size_t group_lanes = 32; // lanes of a group, one byte of each V register per lane fills an avx2 vector
+
+        static const uint32_t max_solo_steps = 64; // steps a lane may run alone before it moves to the scalar core
+
+        static const size_t stack_depth = chip8_stack_depth; // calls a lane can nest, the same as a machine
+
+        //machines of the engine, threads 0 for one per logical cpu, workers pinned one per cpu or not
+        lockstep_engine(size_t machines, size_t threads = 0, bool pin_threads = true);
+
+        ~lockstep_engine(); // destructor
+
+        lockstep_engine(const lockstep_engine&) = delete;
+        lockstep_engine& operator=(const lockstep_engine&) = delete;
+
+        size_t size() const { return machines; } // number of machines
+
+        bool load_rom(const std::string& rom_path); // reset every machine and load the same rom into all of them
+
+        bool load_program(const uint8_t* data, size_t size); // reset every machine and load a rom image already in memory
+
+        void set_instructions_per_frame(uint32_t count); // cycles per 60 Hz timer tick of every machine
+
+        void set_sprite_edge(sprite_edge mode); // clip or wrap sprites at the screen edges, for every machine
+
+        void set_quirk_profile(quirk_profile profile); // select the quirks of every machine, the sprite edge follows
+
+        void set_keypad(size_t index, uint8_t key, uint8_t value); // press or release a key of one machine
+
+        void set_keypad_all(uint8_t key, uint8_t value); // press or release a key of every machine
+
+        void set_random_seed(uint32_t seed); // seed the CXNN generator of machine i with machine_seed(seed, i), after loading the rom
+
+        void set_idle_skipping(bool skip); // retire idle loops at once on the scalar core, the lanes never do
+
+        void run(uint64_t cycles); // run every machine that has not faulted for count cycles
+
+        cycle_status get_status(size_t index) const; // how the last run of a machine ended
+
+        size_t get_faulted() const; // machines stopped by a fault
+
+        bool is_scalar(size_t index) const; // true while the machine runs on the scalar core
+
+        size_t get_scalar_count() const; // machines running on the scalar core
+
+        uint64_t get_total_cycles() const; // cycles run by all machines together
+
+        uint64_t get_steps() const; // lockstep steps run so far
+
+        uint64_t get_lane_instructions() const; // instructions run by lanes in lockstep steps
+
+        void copy_framebuffers(uint64_t* rows) const; // 32 rows per machine, machine after machine
+
+        void copy_registers(machine_registers* registers) const; // one entry per machine
+
+        void export_machine(size_t index, chip8& machine) const; // copy the state of a machine into a scalar machine
+
+        size_t get_thread_count() const { return pool.get_thread_count(); } // workers running the groups
+
+    private:
+        static void run_group(lockstep_group& group, uint32_t count); // run count cycles of every lane of a group
+
+        template<quirk_profile profile>
+        static void run_lanes(lockstep_group& group, uint32_t count); // the lockstep part of run_group
+
+        static void to_scalar(lockstep_group& group, size_t lane); // move a lane to the scalar core
+
+        static void from_scalar(lockstep_group& group, size_t lane); // move a lane back
+
+        static void lane_to_machine(const lockstep_group& group, size_t lane, chip8& machine); // copy a lane into a machine
+
+        std::vector<std::unique_ptr<lockstep_group>> groups;
+        size_t machines;
+        uint32_t instructions_per_frame;
+        sprite_edge edge;
+        quirk_profile quirks;
+        bool idle_skipping;
+        thread_pool pool;
+};
@@ -3,13 +3,31 @@
 #include <array>
 #include <cstdint>
 #include <unordered_map>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
 
 #include "chip8.hpp"
+#include "renderer.hpp"
+#include "audio.hpp"
+#include "emulation_thread.hpp"
+#include "scheduler.hpp"
+#include "rewind.hpp"
+#include "runner.hpp"
+#include "movie.hpp"
+#include "rom_library.hpp"
 
 
 const int SCREEN_WIDTH = 64;
 const int SCREEN_HEIGHT = 32;
 const int PIXEL_SIZE = 10; // size of each pixel
+const SDL_Scancode REWIND_KEY = SDL_SCANCODE_BACKSPACE; // held to run the machine backwards
+const SDL_Scancode TRACE_KEY = SDL_SCANCODE_F9; // starts and stops the execution trace
+const SDL_Scancode TURBO_KEY = SDL_SCANCODE_TAB; // held to run at the turbo speed
 
 int main(int argc, char* argv[])
 {
@@ -25,21 +43,178 @@ int main(int argc, char* argv[])
     chip8_emu.chip8_init();
 
     //parse the arguments
-    if(argc == 2)
+    std::string rom_path;
+    bool ipf_given = false;
+    bool quirks_given = false;
+    double speed = 1.0;
+    double turbo_speed = 0.0;
+    bool profile = false;
+    size_t rewind_bytes = rewind_buffer::default_capacity;
+    uint32_t random_seed = 0;
+    std::string record_path;
+    std::string replay_path;
+    std::string trace_path = "chip8.trace";
+    bool tracing = false;
+    bool audio = true;
+    audio_settings sound;
+    for(int i = 1; i < argc; i++)
     {
-        if(std::string(argv[1]) == "-h")
+        std::string arg = argv[i];
+        if(arg == "-h")
         {
-            std::cout << "Usage: ./chip8 <rom file>" << std::endl;
+            std::cout << "Usage: ./chip8 <rom file> [--ipf N] [--quirks Q] [--speed X | --unthrottled] [--turbo X] [--profile]" << std::endl;
+            std::cout << "                      [--rewind-mb N] [--seed N] [--record FILE | --replay FILE] [--trace FILE]" << std::endl;
+            std::cout << "                      [--no-audio] [--audio-rate N] [--audio-buffer N] [--beep HZ] [--volume N]" << std::endl;
+            std::cout << "  --ipf N          instructions per 60 Hz frame (default " << default_instructions_per_frame << ")" << std::endl;
+            std::cout << "  --quirks Q       quirk profile: modern (default), vip, chip48, schip or xochip, over the rom database" << std::endl;
+            std::cout << "  --speed X        run at X times real speed, such as 0.5 or 4, showing at most 60 frames per second" << std::endl;
+            std::cout << "  --unthrottled    run as fast as possible, the same as --speed 0" << std::endl;
+            std::cout << "  --turbo X        speed while tab is held, 0 for as fast as possible (default 0)" << std::endl;
+            std::cout << "  --profile        count the instructions by opcode and address, reported on exit" << std::endl;
+            std::cout << "  --rewind-mb N    megabytes of history kept for rewinding with backspace, 0 to turn it off (default "
+                      << (rewind_buffer::default_capacity >> 20) << ")" << std::endl;
+            std::cout << "  --seed N         seed of the CXNN random number generator (default 0)" << std::endl;
+            std::cout << "  --record FILE    save the session as a movie on exit, to replay here or in chip8_headless" << std::endl;
+            std::cout << "  --replay FILE    replay a movie, the keyboard takes over when it ends" << std::endl;
+            std::cout << "  --trace FILE     record every instruction from the start in a binary trace, read by chip8_trace." << std::endl;
+            std::cout << "                   F9 stops and restarts the trace, into chip8.trace unless given" << std::endl;
+            std::cout << "  --no-audio       no sound" << std::endl;
+            std::cout << "  --audio-rate N   samples per second (default " << sound.sample_rate << ")" << std::endl;
+            std::cout << "  --audio-buffer N samples per audio callback, a power of two, the latency being up to twice that (default "
+                      << sound.buffer_samples << ")" << std::endl;
+            std::cout << "  --beep HZ        pitch of the beep (default " << sound.beep_frequency << ")" << std::endl;
+            std::cout << "  --volume N       volume in percent (default " << sound.volume << ")" << std::endl;
             exit(0);
+        }else if(arg == "--ipf" && i + 1 < argc)
+        {
+            chip8_emu.set_instructions_per_frame(static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+            ipf_given = true;
+        }else if(arg == "--quirks" && i + 1 < argc)
+        {
+            quirk_profile quirks;
+            if(!parse_quirk_profile(argv[++i], quirks))
+            {
+                std::cerr << "Unknown quirk profile " << argv[i] << "(use -h to get help)" << std::endl;
+                exit(1);
+            }
+            chip8_emu.set_quirk_profile(quirks);
+            quirks_given = true;
+        }else if(arg == "--speed" && i + 1 < argc)
+        {
+            speed = std::max(0.0, std::strtod(argv[++i], nullptr));
+        }else if(arg == "--unthrottled")
+        {
+            speed = 0.0;
+        }else if(arg == "--turbo" && i + 1 < argc)
+        {
+            turbo_speed = std::max(0.0, std::strtod(argv[++i], nullptr));
+        }else if(arg == "--profile")
+        {
+            profile = true;
+        }else if(arg == "--rewind-mb" && i + 1 < argc)
+        {
+            rewind_bytes = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10)) << 20;
+        }else if(arg == "--seed" && i + 1 < argc)
+        {
+            random_seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }else if(arg == "--record" && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }else if(arg == "--replay" && i + 1 < argc)
+        {
+            replay_path = argv[++i];
+        }else if(arg == "--trace" && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+            tracing = true;
+        }else if(arg == "--no-audio")
+        {
+            audio = false;
+        }else if(arg == "--audio-rate" && i + 1 < argc)
+        {
+            sound.sample_rate = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        }else if(arg == "--audio-buffer" && i + 1 < argc)
+        {
+            sound.buffer_samples = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        }else if(arg == "--beep" && i + 1 < argc)
+        {
+            sound.beep_frequency = std::strtod(argv[++i], nullptr);
+        }else if(arg == "--volume" && i + 1 < argc)
+        {
+            sound.volume = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        }else if(rom_path.empty())
+        {
+            rom_path = arg;
         }else
         {
-            if(!chip8_emu.load_rom(argv[1]))
+            std::cerr << "Unknown argument " << arg << "(use -h to get help)" << std::endl;
+            exit(1);
+        }
+    }
+
+    std::vector<uint8_t> image;
+    if(!read_rom_file(rom_path, image) || !chip8_emu.load_program(image.data(), image.size()))
+    {
+        std::cerr << "Failed to load the rom file(use -h to get help)" << std::endl;
+        exit(1);
+    }
+
+    //the rom database next to the rom gives its title, speed, quirks, sprite edge and extra keys
+    std::vector<std::pair<std::string, rom_metadata>> database;
+    std::filesystem::path rom_file(rom_path);
+    std::filesystem::path database_path = rom_file.parent_path() / rom_library::database_name;
+    std::error_code error;
+    const rom_metadata* metadata = nullptr;
+    if(std::filesystem::exists(database_path, error) && rom_library::read_database(database_path.string(), database))
+    {
+        metadata = rom_library::find_entry(database, rom_hash(image), rom_file.filename().string());
+    }
+    if(metadata != nullptr)
+    {
+        if(metadata->instructions_per_frame > 0 && !ipf_given)
+        {
+            chip8_emu.set_instructions_per_frame(metadata->instructions_per_frame);
+        }
+        if(!quirks_given)
+        {
+            chip8_emu.set_quirk_profile(metadata->quirks);
+            chip8_emu.set_sprite_edge(metadata->edge);
+        }
+    }
+
+    //a movie is recorded from power on with the settings above, a replay brings its own
+    movie session;
+    bool recording = !record_path.empty();
+    bool replaying = !replay_path.empty();
+    if(recording || replaying)
+    {
+        if(recording && replaying)
+        {
+            std::cerr << "Cannot record and replay at once(use -h to get help)" << std::endl;
+            exit(1);
+        }
+        if(replaying)
+        {
+            if(!load_movie(replay_path, session))
+            {
+                exit(1);
+            }
+            if(!movie_matches_rom(session, image))
             {
-                std::cerr << "Failed to load the rom file(use -h to get help)" << std::endl;
+                std::cerr << "The movie was recorded with another rom" << std::endl;
                 exit(1);
             }
+            random_seed = session.random_seed;
+            chip8_emu.set_instructions_per_frame(session.instructions_per_frame);
+            chip8_emu.set_quirk_profile(session.quirks);
+            chip8_emu.set_sprite_edge(session.edge);
+        }else
+        {
+            session = start_movie(image, random_seed, chip8_emu.get_instructions_per_frame(), chip8_emu.get_quirk_profile(),
+                                  chip8_emu.get_sprite_edge());
         }
     }
+    chip8_emu.set_random_seed(random_seed);
 
     //initialize the screen
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -50,7 +225,12 @@ int main(int argc, char* argv[])
     }
 
     //create window
-    SDL_Window* window = SDL_CreateWindow("Chip8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * PIXEL_SIZE, SCREEN_HEIGHT * PIXEL_SIZE, SDL_WINDOW_SHOWN);
+    std::string title = "Chip8 Emulator";
+    if(metadata != nullptr && !metadata->title.empty())
+    {
+        title += " - " + metadata->title;
+    }
+    SDL_Window* window = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * PIXEL_SIZE, SCREEN_HEIGHT * PIXEL_SIZE, SDL_WINDOW_SHOWN);
 
     if (window == NULL)
     {
@@ -59,100 +239,230 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    //create renderer
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    //create renderer, presenting in step with the display refresh, the emulation no longer waits on it
+    screen_renderer renderer;
 
-    if (renderer == NULL)
+    if (!renderer.init(window, true))
     {
-        std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
         SDL_Quit();
         exit(1);
     }
 
-    //clear the screen
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-
     //emulator loop
     bool quit = false;
     SDL_Event e;
 
     //link the keymap with the chip8 keypad
-    const std::unordered_map<SDL_Scancode, uint8_t> keyMap = {
+    std::unordered_map<SDL_Scancode, uint8_t> keyMap = {
         { SDL_SCANCODE_1, 0x1 }, { SDL_SCANCODE_2, 0x2 }, { SDL_SCANCODE_3, 0x3 }, { SDL_SCANCODE_4, 0xC },
         { SDL_SCANCODE_Q, 0x4 }, { SDL_SCANCODE_W, 0x5 }, { SDL_SCANCODE_E, 0x6 }, { SDL_SCANCODE_R, 0xD },
         { SDL_SCANCODE_A, 0x7 }, { SDL_SCANCODE_S, 0x8 }, { SDL_SCANCODE_D, 0x9 }, { SDL_SCANCODE_F, 0xE },
         { SDL_SCANCODE_Z, 0xA }, { SDL_SCANCODE_X, 0x0 }, { SDL_SCANCODE_C, 0xB }, { SDL_SCANCODE_V, 0xF }
     };
 
-    while(!quit)
+    //keys of the rom database come on top, such as the arrow keys for the keys a game moves with
+    if(metadata != nullptr)
     {
-        //emulate one cycle
+        for(const auto& key : metadata->keys)
+        {
+            SDL_Scancode scancode = SDL_GetScancodeFromName(key.first.c_str());
+            if(scancode == SDL_SCANCODE_UNKNOWN || scancode == REWIND_KEY || scancode == TRACE_KEY || scancode == TURBO_KEY)
+            {
+                std::cerr << "Unknown key " << key.first << " in the rom database" << std::endl;
+                continue;
+            }
+            keyMap[scancode] = key.second;
+        }
+    }
+
+    //the machine runs on its own thread from here, the loop below only polls the window, passes the
+    //keys on and presents the newest completed frame
+    emulation_settings settings;
+    settings.speed = speed;
+    settings.turbo_speed = turbo_speed;
+    settings.profile = profile;
+    settings.rewind_bytes = rewind_bytes;
+    settings.recording = recording;
+    settings.replaying = replaying;
+    settings.trace_path = trace_path;
+    settings.tracing = tracing;
+    settings.audio = audio;
+    emulation_thread emulation(chip8_emu, session, settings);
+    if(!emulation.start())
+    {
+        exit(1);
+    }
+
+    //the sound timer beeps through the audio callback, the emulator runs silent without a device
+    audio_output speaker;
+    if(audio)
+    {
+        speaker.open(emulation, sound);
+    }
 
+    //SDL stamps events in milliseconds since it started, taken back to the steady clock
+    auto event_time = [](uint32_t timestamp)
+    {
+        return std::chrono::steady_clock::now() - std::chrono::milliseconds(SDL_GetTicks() - timestamp);
+    };
+    bool rewinding = false;
+    bool turbo = false;
+
+    //without vsync the ui is paced at 60 Hz by a scheduler of its own
+    scheduler pacing;
+    pacing.start();
+
+    //input to screen latency, the frames presented per second and the speed the machine runs at,
+    //shown in the title twice a second, the speed also over the screen unless at real speed
+    using clock = std::chrono::steady_clock;
+    clock::time_point stats_start = clock::now();
+    uint64_t stats_frame = 0, stats_cycles = 0;
+    uint64_t presented = 0, latency_samples = 0, total_samples = 0;
+    clock::duration latency_sum = clock::duration::zero(), latency_max = clock::duration::zero(), worst_latency = clock::duration::zero();
+    clock::duration total_latency = clock::duration::zero();
+
+    while(!quit)
+    {
+        //poll the events once per frame
         while(SDL_PollEvent(&e) != 0)
         {   
-            std::cout << "event get " << e.type << std::endl;
             if(e.type == SDL_QUIT)
             {
                 quit = true;
             }else if(e.type == SDL_KEYDOWN || e.type == SDL_KEYUP)
             {
-                //std::cout << e.key.keysym.scancode << " key pressed" << std::endl;
                 bool pressed = (e.type == SDL_KEYDOWN);
+                clock::time_point time = event_time(e.key.timestamp);
+                if(e.key.keysym.scancode == TRACE_KEY)
+                {
+                    if(pressed && !e.key.repeat)
+                    {
+                        emulation.send({ui_command_type::trace, 0, 0, time});
+                    }
+                    continue;
+                }
+                if(e.key.keysym.scancode == TURBO_KEY)
+                {
+                    if(pressed != turbo)
+                    {
+                        turbo = pressed;
+                        emulation.send({ui_command_type::turbo, 0, static_cast<uint8_t>(pressed), time});
+                    }
+                    continue;
+                }
+                if(e.key.keysym.scancode == REWIND_KEY && rewind_bytes != 0 && pressed != rewinding)
+                {
+                    rewinding = pressed;
+                    emulation.send({ui_command_type::rewind, 0, static_cast<uint8_t>(pressed), time});
+
+                    //the keys held now replace the recorded keypad, a replay ignores them
+                    if(!rewinding)
+                    {
+                        const uint8_t* held = SDL_GetKeyboardState(nullptr);
+                        for(const auto& mapped : keyMap)
+                        {
+                            emulation.send({ui_command_type::key, mapped.second, held[mapped.first], time});
+                        }
+                    }
+                    continue;
+                }
                 auto key = keyMap.find(e.key.keysym.scancode);
-                std::cout << "key get pressed" << std::endl;
-                if(key != keyMap.end())
+                if(key != keyMap.end() && !(pressed && e.key.repeat))
                 {
-                    //std::cout << key->first << " | " << key->second << std::endl;
-                    chip8_emu.set_keypad(key->second, pressed);
+                    emulation.send({ui_command_type::key, key->second, static_cast<uint8_t>(pressed), time});
                 }
             }else if(e.type == SDL_TEXTEDITING || e.type == SDL_TEXTINPUT)
             {
                 break;
             }
         }
-        chip8_emu.chip8_cycle();
-        if(chip8_emu.get_draw_flag())
+
+        //draw the newest frame the emulation completed, if any came since the last one
+        bool updated = emulation.update_frame();
+        if(updated)
         {
-            chip8_emu.clear_draw_flag();
+            renderer.update(emulation.get_frame());
         }
-        else
+        renderer.present();
+        presented++;
+
+        if(updated && emulation.get_frame().input_time != clock::time_point())
         {
-            continue;
+            clock::duration latency = clock::now() - emulation.get_frame().input_time;
+            latency_sum += latency;
+            latency_max = std::max(latency_max, latency);
+            latency_samples++;
         }
 
-        for (int y = 0; y < SCREEN_HEIGHT; ++y)
+        clock::time_point now = clock::now();
+        if(now - stats_start >= std::chrono::milliseconds(500))
         {
-            for (int x = 0; x < SCREEN_WIDTH; ++x)
-            {
-                if (chip8_emu.get_screent_pixels(x, y) == 1)
-                {
-                    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                }
-                else
-                {
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                }
+            double seconds = std::chrono::duration<double>(now - stats_start).count();
+            const video_frame& shown = emulation.get_frame();
+            //rewinding runs the frames backwards, at a negative speed
+            double real_time = static_cast<int64_t>(shown.frame - stats_frame) / (seconds * scheduler::frame_rate);
+            double mips = std::max<int64_t>(0, static_cast<int64_t>(shown.cycles - stats_cycles)) / seconds / 1e6;
+            stats_frame = shown.frame;
+            stats_cycles = shown.cycles;
 
-                SDL_Rect pixel = {x * PIXEL_SIZE, y * PIXEL_SIZE, PIXEL_SIZE, PIXEL_SIZE};
-                SDL_RenderFillRect(renderer, &pixel);
+            char effective[48];
+            std::snprintf(effective, sizeof(effective), "%.1fx %.1f MIPS", real_time, mips);
+            renderer.set_overlay(rewinding || (!turbo && speed == 1.0) ? std::string() : std::string(effective));
+
+            std::string stats = title + " - " + effective + ", " + std::to_string(static_cast<int>(presented / seconds + 0.5)) + " fps";
+            if(latency_samples != 0)
+            {
+                stats += ", input latency " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(latency_sum / latency_samples).count()) +
+                         " ms (max " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(latency_max).count()) + " ms)";
             }
+            SDL_SetWindowTitle(window, stats.c_str());
+            total_latency += latency_sum;
+            total_samples += latency_samples;
+            worst_latency = std::max(worst_latency, latency_max);
+            presented = 0;
+            latency_samples = 0;
+            latency_sum = clock::duration::zero();
+            latency_max = clock::duration::zero();
+            stats_start = now;
+        }
+
+        //with vsync the presentation paces the loop
+        if(!renderer.has_vsync())
+        {
+            pacing.frames_due();
+            pacing.wait_for_frame();
         }
+    }
+
+    speaker.close();
+    emulation.stop();
+
+    total_latency += latency_sum;
+    total_samples += latency_samples;
+    worst_latency = std::max(worst_latency, latency_max);
+    if(total_samples != 0)
+    {
+        std::cerr << "Input to screen latency: " << std::chrono::duration<double, std::milli>(total_latency / total_samples).count()
+                  << " ms on average, " << std::chrono::duration<double, std::milli>(worst_latency).count() << " ms at most, over "
+                  << total_samples << " inputs" << std::endl;
+    }
 
-        //update the screen
-        SDL_RenderPresent(renderer);
+    if(profile)
+    {
+        emulation.get_profiler().report(std::cerr);
+    }
 
-        //sleep for 1/500 seconds
-        SDL_Delay(1000 / 60);   
+    if(recording)
+    {
+        session.cycles = chip8_emu.get_cycle_count();
+        save_movie(record_path, session);
     }
 
     //clear the resources
-    SDL_DestroyRenderer(renderer);
+    renderer.destroy();
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     return 0;
 
 }
-
-
@@ -0,0 +1,118 @@
+#include "movie.hpp"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cctype>
+
+namespace
+{
+    const char movie_magic[] = "chip8-movie";
+    const int movie_version = 1;
+}
+
+movie start_movie(const std::vector<uint8_t>& rom, uint32_t random_seed, uint32_t instructions_per_frame, quirk_profile quirks,
+                  sprite_edge edge)
+{
+    movie recorded;
+    recorded.rom_size = rom.size();
+    recorded.rom_hash = rom_hash(rom);
+    recorded.random_seed = random_seed;
+    recorded.instructions_per_frame = instructions_per_frame;
+    recorded.quirks = quirks;
+    recorded.edge = edge;
+    return recorded;
+}
+
+bool save_movie(const std::string& path, const movie& recorded)
+{
+    std::ofstream file(path);
+    if(!file.is_open())
+    {
+        std::cerr << "Error opening movie file " << path << std::endl;
+        return false;
+    }
+    file << movie_magic << ' ' << movie_version << '\n';
+    file << "rom " << recorded.rom_size << ' ' << std::hex << recorded.rom_hash << std::dec << '\n';
+    file << "seed " << recorded.random_seed << '\n';
+    file << "ipf " << recorded.instructions_per_frame << '\n';
+    file << "quirks " << quirk_profile_name(recorded.quirks) << '\n';
+    file << "edge " << (recorded.edge == sprite_edge::clip ? "clip" : "wrap") << '\n';
+    file << "cycles " << recorded.cycles << '\n';
+    write_key_script(file, recorded.events);
+    return static_cast<bool>(file);
+}
+
+//the settings come first, the key changes start at the first line starting with a digit
+bool load_movie(const std::string& path, movie& recorded)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        std::cerr << "Error opening movie file " << path << std::endl;
+        return false;
+    }
+
+    std::string magic;
+    int version = 0;
+    std::string line;
+    if(!std::getline(file, line) || !(std::istringstream(line) >> magic >> version) || magic != movie_magic)
+    {
+        std::cerr << path << " is not a movie file" << std::endl;
+        return false;
+    }
+    if(version != movie_version)
+    {
+        std::cerr << "Unsupported movie version " << version << std::endl;
+        return false;
+    }
+
+    recorded = movie();
+    while(file.peek() != std::char_traits<char>::eof() && !std::isdigit(file.peek()) && std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string name;
+        if(line.empty() || line[0] == '#' || !(fields >> name))
+        {
+            continue;
+        }
+
+        bool valid;
+        if(name == "rom")
+        {
+            valid = static_cast<bool>(fields >> recorded.rom_size >> std::hex >> recorded.rom_hash);
+        }else if(name == "seed")
+        {
+            valid = static_cast<bool>(fields >> recorded.random_seed);
+        }else if(name == "ipf")
+        {
+            valid = static_cast<bool>(fields >> recorded.instructions_per_frame) && recorded.instructions_per_frame > 0;
+        }else if(name == "quirks")
+        {
+            std::string profile;
+            valid = (fields >> profile) && parse_quirk_profile(profile, recorded.quirks);
+        }else if(name == "edge")
+        {
+            std::string mode;
+            valid = (fields >> mode) && (mode == "wrap" || mode == "clip");
+            recorded.edge = mode == "clip" ? sprite_edge::clip : sprite_edge::wrap;
+        }else if(name == "cycles")
+        {
+            valid = static_cast<bool>(fields >> recorded.cycles);
+        }else
+        {
+            //unknown settings are skipped
+            valid = true;
+        }
+        if(!valid)
+        {
+            std::cerr << "Bad movie setting: " << line << std::endl;
+            return false;
+        }
+    }
+    return read_key_script(file, path, recorded.events);
+}
+
+bool movie_matches_rom(const movie& recorded, const std::vector<uint8_t>& rom)
+{
+    return recorded.rom_size == rom.size() && recorded.rom_hash == rom_hash(rom);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.hpp"
+#include "runner.hpp"
+
+//movies
+//a run is fully decided by the rom, the seed of the CXNN generator, the instructions per frame, the
+//quirk profile, the sprite edge and the key changes by cycle, so recording those replays it bit for bit on any core
+//and any host, whatever the speed it was recorded at
+//
+//the file is text: a "chip8-movie <version>" line, one "<name> <value>" line per setting, then the
+//key changes in the key script format
+struct movie
+{
+    uint64_t rom_size = 0; // size of the rom the movie was recorded with
+    uint64_t rom_hash = 0; // rom_hash of that rom
+    uint32_t random_seed = 0;
+    uint32_t instructions_per_frame = default_instructions_per_frame;
+    quirk_profile quirks = quirk_profile::modern; // modern for movies saved before the profiles
+    sprite_edge edge = sprite_edge::wrap;
+    uint64_t cycles = 0; // length of the recording
+    std::vector<key_event> events; // key changes, by cycle
+};
+
+//a movie starting from power on with the rom image
+movie start_movie(const std::vector<uint8_t>& rom, uint32_t random_seed, uint32_t instructions_per_frame, quirk_profile quirks,
+                  sprite_edge edge);
+
+bool save_movie(const std::string& path, const movie& recorded);
+
+bool load_movie(const std::string& path, movie& recorded);
+
+//true when the movie was recorded with the rom image
+bool movie_matches_rom(const movie& recorded, const std::vector<uint8_t>& rom);
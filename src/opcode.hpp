@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+//every distinct instruction handler of the chip8, in dispatch order
+//the same list generates the enum, the names and the computed goto labels
+#define CHIP8_OPCODE_LIST(X) \
+    X(OP_00E0) X(OP_00EE) X(OP_0NNN) X(OP_1NNN) X(OP_2NNN) X(OP_3XNN) X(OP_4XNN) X(OP_5XY0) \
+    X(OP_6XNN) X(OP_7XNN) X(OP_8XY0) X(OP_8XY1) X(OP_8XY2) X(OP_8XY3) X(OP_8XY4) X(OP_8XY5) \
+    X(OP_8XY6) X(OP_8XY7) X(OP_8XYE) X(OP_9XY0) X(OP_ANNN) X(OP_BNNN) X(OP_CXNN) X(OP_DXYN) \
+    X(OP_EX9E) X(OP_EXA1) X(OP_FX07) X(OP_FX0A) X(OP_FX15) X(OP_FX18) X(OP_FX1E) X(OP_FX29) \
+    X(OP_FX33) X(OP_FX55) X(OP_FX65) \
+    X(OP_00CN) X(OP_00DN) X(OP_00FB) X(OP_00FC) X(OP_00FD) X(OP_00FE) X(OP_00FF) X(OP_5XY2) \
+    X(OP_5XY3) X(OP_F000) X(OP_FN01) X(OP_F002) X(OP_FX30) X(OP_FX3A) X(OP_FX75) X(OP_FX85) \
+    X(OP_INVALID)
+
+enum opcode_class : uint8_t
+{
+#define CHIP8_OPCODE_ENUM(name) name,
+    CHIP8_OPCODE_LIST(CHIP8_OPCODE_ENUM)
+#undef CHIP8_OPCODE_ENUM
+    OP_COUNT
+};
+
+//instruction fields
+constexpr uint8_t opcode_x(uint16_t instruction) { return (instruction >> 8) & 0xF; }
+constexpr uint8_t opcode_y(uint16_t instruction) { return (instruction >> 4) & 0xF; }
+constexpr uint8_t opcode_n(uint16_t instruction) { return instruction & 0xF; }
+constexpr uint8_t opcode_nn(uint16_t instruction) { return instruction & 0xFF; }
+constexpr uint16_t opcode_nnn(uint16_t instruction) { return instruction & 0xFFF; }
+
+//resolve an instruction to its handler
+//mirrors the decoding of chip8::decode_excute, so 5XYN and 9XYN ignore the last nibble
+//the SUPER-CHIP and XO-CHIP instructions have handlers of their own whatever the profile, the
+//handlers falling back to the CHIP-8 meaning for the profiles without them
+constexpr opcode_class classify_opcode(uint16_t instruction)
+{
+    switch(instruction >> 12)
+    {
+        case 0x0:
+            switch(instruction & 0xFFF0)
+            {
+                case 0x00C0: return OP_00CN;
+                case 0x00D0: return OP_00DN;
+                default: break;
+            }
+            switch(instruction)
+            {
+                case 0x00E0: return OP_00E0;
+                case 0x00EE: return OP_00EE;
+                case 0x00FB: return OP_00FB;
+                case 0x00FC: return OP_00FC;
+                case 0x00FD: return OP_00FD;
+                case 0x00FE: return OP_00FE;
+                case 0x00FF: return OP_00FF;
+                default: return OP_0NNN;
+            }
+        case 0x1: return OP_1NNN;
+        case 0x2: return OP_2NNN;
+        case 0x3: return OP_3XNN;
+        case 0x4: return OP_4XNN;
+        case 0x5:
+            switch(instruction & 0xF)
+            {
+                case 0x2: return OP_5XY2;
+                case 0x3: return OP_5XY3;
+                default: return OP_5XY0;
+            }
+        case 0x6: return OP_6XNN;
+        case 0x7: return OP_7XNN;
+        case 0x8:
+            switch(instruction & 0xF)
+            {
+                case 0x0: return OP_8XY0;
+                case 0x1: return OP_8XY1;
+                case 0x2: return OP_8XY2;
+                case 0x3: return OP_8XY3;
+                case 0x4: return OP_8XY4;
+                case 0x5: return OP_8XY5;
+                case 0x6: return OP_8XY6;
+                case 0x7: return OP_8XY7;
+                case 0xE: return OP_8XYE;
+                default: return OP_INVALID;
+            }
+        case 0x9: return OP_9XY0;
+        case 0xA: return OP_ANNN;
+        case 0xB: return OP_BNNN;
+        case 0xC: return OP_CXNN;
+        case 0xD: return OP_DXYN;
+        case 0xE:
+            switch(instruction & 0xFF)
+            {
+                case 0x9E: return OP_EX9E;
+                case 0xA1: return OP_EXA1;
+                default: return OP_INVALID;
+            }
+        default:
+            switch(instruction & 0xFF)
+            {
+                case 0x00: return instruction == 0xF000 ? OP_F000 : OP_INVALID;
+                case 0x01: return OP_FN01;
+                case 0x02: return instruction == 0xF002 ? OP_F002 : OP_INVALID;
+                case 0x07: return OP_FX07;
+                case 0x0A: return OP_FX0A;
+                case 0x15: return OP_FX15;
+                case 0x18: return OP_FX18;
+                case 0x1E: return OP_FX1E;
+                case 0x29: return OP_FX29;
+                case 0x33: return OP_FX33;
+                case 0x55: return OP_FX55;
+                case 0x65: return OP_FX65;
+                case 0x30: return OP_FX30;
+                case 0x3A: return OP_FX3A;
+                case 0x75: return OP_FX75;
+                case 0x85: return OP_FX85;
+                default: return OP_INVALID;
+            }
+    }
+}
+
+//handler of each of the 65536 instructions, resolved at compile time
+extern const std::array<uint8_t, 65536> opcode_table;
+
+//an instruction with its handler resolved and its fields extracted
+struct decoded_op
+{
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+    uint16_t nnn;
+};
+
+inline decoded_op decode_opcode(uint16_t instruction)
+{
+    return {opcode_table[instruction], opcode_x(instruction), opcode_y(instruction),
+            opcode_n(instruction), opcode_nn(instruction), opcode_nnn(instruction)};
+}
+
+//printable name of an opcode class ("8XY4", "DXYN", ...)
+const char* opcode_name(uint8_t op);
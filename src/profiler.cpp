@@ -0,0 +1,89 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <iomanip>
+
+opcode_profiler::opcode_profiler()
+{
+    //the cheapest of many back to back reads is the cost of the measurement around an instruction
+    overhead = UINT64_MAX;
+    for(int i = 0; i < 1000; i++)
+    {
+        uint64_t first = read_cycle_counter();
+        uint64_t second = read_cycle_counter();
+        overhead = std::min(overhead, second - first);
+    }
+    reset();
+}
+
+void opcode_profiler::reset()
+{
+    counts.fill(0);
+    ticks.fill(0);
+    pc_counts.fill(0);
+    pc_ops.fill(OP_INVALID);
+    start = 0;
+    current_pc = 0;
+    current_op = OP_INVALID;
+}
+
+void opcode_profiler::report(std::ostream& out, size_t hot_pcs) const
+{
+    uint64_t total_count = std::accumulate(counts.begin(), counts.end(), uint64_t(0));
+    uint64_t total_ticks = std::accumulate(ticks.begin(), ticks.end(), uint64_t(0));
+    auto percent = [](uint64_t part, uint64_t whole) { return whole > 0 ? 100.0 * part / whole : 0.0; };
+
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+
+    //opcode classes by host time spent in them
+    std::vector<uint8_t> ops;
+    for(uint8_t op = 0; op < OP_COUNT; op++)
+    {
+        if(counts[op] != 0)
+        {
+            ops.push_back(op);
+        }
+    }
+    std::stable_sort(ops.begin(), ops.end(), [this](uint8_t a, uint8_t b) { return ticks[a] > ticks[b]; });
+
+    out << total_count << " instructions, " << total_ticks << " host cycles (less " << overhead
+        << " per instruction for the measurement)" << std::endl;
+    out << "opcode        count  count%      cycles   time%  cycles/op" << std::endl;
+    for(uint8_t op : ops)
+    {
+        out << std::left << std::setw(6) << opcode_name(op) << std::right
+            << std::setw(13) << counts[op] << std::setw(8) << percent(counts[op], total_count)
+            << std::setw(12) << ticks[op] << std::setw(8) << percent(ticks[op], total_ticks)
+            << std::setw(11) << static_cast<double>(ticks[op]) / counts[op] << std::endl;
+    }
+
+    //guest addresses by instructions run there
+    std::vector<uint16_t> pcs;
+    for(uint16_t pc = 0; pc < 4096; pc++)
+    {
+        if(pc_counts[pc] != 0)
+        {
+            pcs.push_back(pc);
+        }
+    }
+    size_t shown = std::min(hot_pcs, pcs.size());
+    std::partial_sort(pcs.begin(), pcs.begin() + shown, pcs.end(), [this](uint16_t a, uint16_t b) {
+        return pc_counts[a] > pc_counts[b] || (pc_counts[a] == pc_counts[b] && a < b);
+    });
+
+    out << "hot pc  opcode        count  count%" << std::endl;
+    for(size_t i = 0; i < shown; i++)
+    {
+        uint16_t pc = pcs[i];
+        out << "0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(3) << pc
+            << std::dec << std::nouppercase << std::setfill(' ') << "   "
+            << std::left << std::setw(6) << opcode_name(pc_ops[pc]) << std::right
+            << std::setw(13) << pc_counts[pc] << std::setw(8) << percent(pc_counts[pc], total_count) << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <ostream>
+
+#include "opcode.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+//opcode profiler
+//the table core (chip8::run_table) takes a profiler policy as a template parameter and calls
+//begin() before and end() after every instruction it excutes, only when the policy is enabled, so
+//the unprofiled core is compiled without a trace of it. opcode_profiler counts the instructions of
+//each opcode class and guest address and the host cycles spent in each class
+//
+//the reference core is profiled around decode_excute by chip8::run_cycles, the block and jit cores
+//are not profiled
+
+//host cycle counter, the time stamp counter on x86, nanoseconds elsewhere
+inline uint64_t read_cycle_counter()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+//profiling compiled out
+struct no_profiler
+{
+    static constexpr bool enabled = false;
+
+    void begin(uint16_t, uint8_t) {}
+
+    void end() {}
+};
+
+class opcode_profiler
+{
+    public:
+        static constexpr bool enabled = true;
+
+        opcode_profiler(); // constructor
+
+        void begin(uint16_t pc, uint8_t op) // an instruction at pc starts
+        {
+            current_pc = pc & 0xFFF;
+            current_op = op;
+            start = read_cycle_counter();
+        }
+
+        void end() // the instruction completed, a faulting one is not counted
+        {
+            uint64_t elapsed = read_cycle_counter() - start;
+            ticks[current_op] += elapsed > overhead ? elapsed - overhead : 0;
+            counts[current_op]++;
+            pc_counts[current_pc]++;
+            pc_ops[current_pc] = current_op;
+        }
+
+        void reset(); // forget everything counted so far
+
+        uint64_t get_count(uint8_t op) const { return counts[op]; } // instructions of an opcode class
+
+        uint64_t get_ticks(uint8_t op) const { return ticks[op]; } // host cycles spent in an opcode class
+
+        uint64_t get_pc_count(uint16_t pc) const { return pc_counts[pc & 0xFFF]; } // instructions run at an address
+
+        uint64_t get_overhead() const { return overhead; } // host cycles of the measurement itself, not counted
+
+        //print the opcode classes by host time and the hottest guest addresses
+        void report(std::ostream& out, size_t hot_pcs = 16) const;
+
+    private:
+        std::array<uint64_t, OP_COUNT> counts;
+        std::array<uint64_t, OP_COUNT> ticks;
+        std::array<uint64_t, 4096> pc_counts;
+        std::array<uint8_t, 4096> pc_ops; // opcode class last run at each address
+
+        uint64_t start; // cycle counter when the current instruction started
+        uint64_t overhead; // cycles of reading the counter, taken off every instruction
+        uint16_t current_pc;
+        uint8_t current_op;
+};
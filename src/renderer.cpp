@@ -0,0 +1,243 @@
+#include "renderer.hpp"
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    const int SCREEN_WIDTH = 64;
+    const int SCREEN_HEIGHT = 32;
+
+    //colors of a pixel by its bit of plane 1 and its bit of plane 2 above it
+    const std::array<uint32_t, 4> palette = {
+        0xFF000000, // black
+        0xFFFFFFFF, // white
+        0xFFAAAAAA, // light grey, plane 2 only
+        0xFF555555 // dark grey, both planes
+    };
+
+    const int OVERLAY_SCALE = 3; // window pixels per pixel of the overlay font
+
+    //the 3x5 glyph of a character of the overlay, its rows from the top as three bits each, 0 for a
+    //character without one
+    uint16_t overlay_glyph(char c)
+    {
+        static const uint16_t digits[10] = {
+            0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249, 0x7BEF, 0x7BCF
+        };
+        switch(c)
+        {
+            case '.': return 0x0002;
+            case 'x': return 0x0AA8;
+            case 'M': return 0x5FED;
+            case 'I': return 0x7497;
+            case 'P': return 0x7BE4;
+            case 'S': return 0x79CF;
+            default: return (c >= '0' && c <= '9') ? digits[c - '0'] : 0;
+        }
+    }
+}
+
+screen_renderer::screen_renderer()
+{
+    renderer = nullptr;
+    texture = nullptr;
+    vsync_enabled = false;
+    texture_width = SCREEN_WIDTH;
+    texture_height = SCREEN_HEIGHT;
+    for(auto& row : shown)
+    {
+        row.fill(0);
+    }
+    texture_valid = false;
+    uploaded_rows = 0;
+
+    for(uint32_t value = 0; value < 256; value++)
+    {
+        for(uint32_t bit = 0; bit < 8; bit++)
+        {
+            expand[value][bit] = palette[(value & (0x80 >> bit)) ? 1 : 0];
+        }
+    }
+}
+
+screen_renderer::~screen_renderer()
+{
+    destroy();
+}
+
+void screen_renderer::destroy()
+{
+    if(texture != nullptr)
+    {
+        SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+    if(renderer != nullptr)
+    {
+        SDL_DestroyRenderer(renderer);
+        renderer = nullptr;
+    }
+}
+
+//create the renderer, paced by the display refresh when vsync is asked for and available
+bool screen_renderer::init(SDL_Window* window, bool vsync)
+{
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if(renderer == NULL)
+    {
+        std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    SDL_RendererInfo info;
+    vsync_enabled = SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+
+    //keep the pixels sharp when scaling up
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+
+    if(!create_texture(SCREEN_WIDTH, SCREEN_HEIGHT))
+    {
+        return false;
+    }
+
+    //clear the screen
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    return true;
+}
+
+//the texture has the resolution of the machine, scaling it to the window doubles the pixels of 64x32
+bool screen_renderer::create_texture(int width, int height)
+{
+    if(texture != nullptr)
+    {
+        SDL_DestroyTexture(texture);
+    }
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if(texture == NULL)
+    {
+        std::cerr << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    texture_width = width;
+    texture_height = height;
+    texture_valid = false;
+    return true;
+}
+
+//expand the rows that differ from the texture
+//a locked area of a streaming texture is write only, so every row between the first and the last
+//changed one is written
+void screen_renderer::update(const video_frame& frame)
+{
+    int width = frame.high_resolution ? 128 : 64;
+    int height = frame.high_resolution ? 64 : 32;
+    if((width != texture_width || height != texture_height) && !create_texture(width, height))
+    {
+        return;
+    }
+
+    int words = width / 64;
+    std::array<std::array<uint64_t, 4>, 64> rows;
+    uint64_t dirty = 0;
+    for(int y = 0; y < height; y++)
+    {
+        rows[y].fill(0);
+        for(int plane = 0; plane < 2; plane++)
+        {
+            for(int word = 0; word < words; word++)
+            {
+                rows[y][plane * 2 + word] = frame.planes[plane][y * words + word];
+            }
+        }
+        if(rows[y] != shown[y] || !texture_valid)
+        {
+            dirty |= 1ull << y;
+        }
+    }
+    if(dirty == 0)
+    {
+        return;
+    }
+
+    int first = 0;
+    while(!(dirty & (1ull << first)))
+    {
+        first++;
+    }
+    int last = height - 1;
+    while(!(dirty & (1ull << last)))
+    {
+        last--;
+    }
+
+    SDL_Rect area = {0, first, width, last - first + 1};
+    void* pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, &area, &pixels, &pitch) != 0)
+    {
+        std::cerr << "Texture could not be locked! SDL_Error: " << SDL_GetError() << std::endl;
+        return;
+    }
+
+    //a byte with nothing on plane 2 is a single table lookup, the others are colored pixel by pixel
+    for(int y = first; y <= last; y++)
+    {
+        uint32_t* line = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + (y - first) * pitch);
+        for(int word = 0; word < words; word++)
+        {
+            for(int byte = 0; byte < 8; byte++)
+            {
+                uint8_t low = (rows[y][word] >> (56 - byte * 8)) & 0xFF;
+                uint8_t high = (rows[y][2 + word] >> (56 - byte * 8)) & 0xFF;
+                uint32_t* out = line + word * 64 + byte * 8;
+                if(high == 0)
+                {
+                    std::memcpy(out, expand[low].data(), 8 * sizeof(uint32_t));
+                    continue;
+                }
+                for(int bit = 0; bit < 8; bit++)
+                {
+                    out[bit] = palette[((low >> (7 - bit)) & 1) | (((high >> (7 - bit)) & 1) << 1)];
+                }
+            }
+        }
+        shown[y] = rows[y];
+    }
+    SDL_UnlockTexture(texture);
+
+    texture_valid = true;
+    uploaded_rows += last - first + 1;
+}
+
+//scale the texture to the whole window and show it
+void screen_renderer::present()
+{
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+
+    //the overlay is white on a black box, so it reads over any screen
+    if(!overlay.empty())
+    {
+        SDL_Rect box = {0, 0, (static_cast<int>(overlay.size()) * 4 + 1) * OVERLAY_SCALE, 7 * OVERLAY_SCALE};
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderFillRect(renderer, &box);
+
+        std::vector<SDL_Rect> pixels;
+        for(size_t i = 0; i < overlay.size(); i++)
+        {
+            uint16_t glyph = overlay_glyph(overlay[i]);
+            for(int bit = 0; bit < 15; bit++)
+            {
+                if(glyph & (0x4000 >> bit))
+                {
+                    pixels.push_back({(static_cast<int>(i) * 4 + 1 + bit % 3) * OVERLAY_SCALE, (1 + bit / 3) * OVERLAY_SCALE,
+                                      OVERLAY_SCALE, OVERLAY_SCALE});
+                }
+            }
+        }
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderFillRects(renderer, pixels.data(), static_cast<int>(pixels.size()));
+    }
+    SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sdl2/sdl.h>
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "emulation_thread.hpp"
+
+//screen renderer
+//the packed framebuffer is expanded into a streaming texture of the machine's resolution, 64x32 or
+//128x64, eight pixels per table lookup, and scaled to the window with a single SDL_RenderCopy. only
+//the rows that changed since the last upload are expanded, and a frame with no changed rows skips the
+//upload entirely. the two bit planes of XO-CHIP give four colors
+//
+//a line of status text, such as the speed, can be drawn over the screen in a 3x5 font of digits and
+//the few letters it needs
+class screen_renderer
+{
+    public:
+        screen_renderer(); // constructor
+
+        ~screen_renderer(); // destructor
+
+        screen_renderer(const screen_renderer&) = delete;
+        screen_renderer& operator=(const screen_renderer&) = delete;
+
+        bool init(SDL_Window* window, bool vsync); // create the renderer and the texture
+
+        void destroy(); // release the renderer and the texture, before the window goes
+
+        void update(const video_frame& frame); // upload the rows that changed
+
+        void present(); // draw the texture and the overlay to the window and show it
+
+        void set_overlay(const std::string& text) { overlay = text; } // text drawn over the top left corner, empty for none
+
+        bool has_vsync() const { return vsync_enabled; } // true when present() waits for the display refresh
+
+        SDL_Renderer* get_renderer() const { return renderer; } // the underlying SDL renderer
+
+        uint64_t get_uploaded_rows() const { return uploaded_rows; } // rows expanded since init
+
+    private:
+        bool create_texture(int width, int height); // (re)create the texture at a resolution
+
+        SDL_Renderer* renderer;
+        SDL_Texture* texture;
+        bool vsync_enabled;
+        int texture_width, texture_height; // resolution of the texture
+
+        std::array<std::array<uint64_t, 4>, 64> shown; // rows currently in the texture, the two words of plane 1 then of plane 2
+        bool texture_valid; // false until the first upload
+
+        //the eight ARGB pixels of each byte of a row of plane 1
+        std::array<std::array<uint32_t, 8>, 256> expand;
+
+        uint64_t uploaded_rows;
+
+        std::string overlay;
+};
@@ -0,0 +1,149 @@
+#include "rewind.hpp"
+#include <cstring>
+#include <algorithm>
+
+static_assert(sizeof(chip8_snapshot) % sizeof(uint64_t) == 0, "a snapshot is a whole number of words");
+
+namespace
+{
+    //a run of the encoding: zero words skipped, then literal words copied from the stream
+    inline uint64_t run_header(size_t zeros, size_t literals)
+    {
+        return (static_cast<uint64_t>(zeros) << 32) | literals;
+    }
+
+    //a delta is at most a header for every other word, plus the words themselves
+    const size_t max_encoded_words = 2 * (sizeof(chip8_snapshot) / sizeof(uint64_t)) + 1;
+
+    //words compared at once before looking at them one by one
+    const size_t block_words = 32;
+}
+
+rewind_buffer::rewind_buffer(size_t capacity_bytes)
+    : ring(std::max(capacity_bytes / sizeof(uint64_t), max_encoded_words))
+{
+    encoded.resize(max_encoded_words);
+    clear();
+}
+
+void rewind_buffer::clear()
+{
+    entries.clear();
+    head = 0;
+    used_words = 0;
+    recorded = false;
+    newest_words = 0;
+    std::memset(newest.bytes, 0, sizeof(newest.bytes));
+}
+
+//the machine is trivially copyable, so its bytes are read in place, the same bytes save_snapshot
+//would copy. the delta is encoded while the newest frame is brought up to date, in one pass
+//runs alternate between zero words, which are skipped, and the words between them. most of the
+//machine is the same from frame to frame, so blocks equal to the newest frame are found with memcmp
+//and skipped whole. only the words of the machine in use are compared, 4 KB into the memory unless
+//the machine has brought the rest into use
+void rewind_buffer::push(const chip8& machine)
+{
+    size_t machine_words = machine.get_snapshot_size() / sizeof(uint64_t);
+    if(!recorded)
+    {
+        machine.save_snapshot(newest);
+        newest_words = machine_words;
+        recorded = true;
+        return;
+    }
+    newest_words = std::max(newest_words, machine_words);
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&machine);
+    uint64_t* out = encoded.data();
+    uint64_t* header = out++;
+    size_t zeros = 0;
+    size_t literals = 0;
+    for(size_t block = 0; block < newest_words; block += block_words)
+    {
+        size_t words = std::min(block_words, newest_words - block);
+        size_t offset = block * sizeof(uint64_t);
+        if(std::memcmp(newest.bytes + offset, bytes + offset, words * sizeof(uint64_t)) == 0)
+        {
+            if(literals != 0)
+            {
+                *header = run_header(zeros, literals);
+                header = out++;
+                zeros = 0;
+                literals = 0;
+            }
+            zeros += words;
+            continue;
+        }
+
+        for(size_t word = 0; word < words; word++, offset += sizeof(uint64_t))
+        {
+            uint64_t old_word, new_word;
+            std::memcpy(&old_word, newest.bytes + offset, sizeof(uint64_t));
+            std::memcpy(&new_word, bytes + offset, sizeof(uint64_t));
+            if(old_word == new_word)
+            {
+                if(literals != 0)
+                {
+                    *header = run_header(zeros, literals);
+                    header = out++;
+                    zeros = 0;
+                    literals = 0;
+                }
+                zeros++;
+                continue;
+            }
+            *out++ = old_word ^ new_word;
+            literals++;
+            std::memcpy(newest.bytes + offset, &new_word, sizeof(uint64_t));
+        }
+    }
+    *header = run_header(zeros, literals);
+
+    //a delta never wraps around the end of the ring, the oldest deltas in its way are dropped
+    size_t length = static_cast<size_t>(out - encoded.data());
+    if(head + length > ring.size())
+    {
+        head = 0;
+    }
+    while(!entries.empty() && entries.front().first < head + length && head < entries.front().first + entries.front().length)
+    {
+        used_words -= entries.front().length;
+        entries.pop_front();
+    }
+    std::copy(encoded.begin(), encoded.begin() + length, ring.begin() + head);
+    entries.push_back({head, length});
+    head += length;
+    used_words += length;
+}
+
+bool rewind_buffer::step_back(chip8& machine)
+{
+    if(entries.empty())
+    {
+        return false;
+    }
+
+    entry last = entries.back();
+    entries.pop_back();
+    used_words -= last.length;
+    head = last.first;
+
+    const uint64_t* run = &ring[last.first];
+    const uint64_t* end = run + last.length;
+    size_t word = 0;
+    while(run < end)
+    {
+        uint64_t header = *run++;
+        word += header >> 32;
+        for(size_t literal = header & 0xFFFFFFFF; literal > 0; literal--, word++)
+        {
+            uint64_t value;
+            std::memcpy(&value, newest.bytes + word * sizeof(uint64_t), sizeof(uint64_t));
+            value ^= *run++;
+            std::memcpy(newest.bytes + word * sizeof(uint64_t), &value, sizeof(uint64_t));
+        }
+    }
+    machine.restore_snapshot(newest);
+    return true;
+}
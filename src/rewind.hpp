@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "chip8.hpp"
+
+//rewind buffer
+//a snapshot of the machine is recorded every frame, each stored as the xor of the frame before it
+//and the one after, run length encoded by 64 bit words. between two frames only a few registers,
+//display rows and bytes of memory change, so a frame takes a few dozen bytes
+//
+//only the newest frame is kept whole, xoring it with its delta gives back the frame before, so
+//stepping back is the reverse of recording and the oldest deltas can be dropped as the ring fills up
+class rewind_buffer
+{
+    public:
+        static const size_t default_capacity = 8 << 20; // bytes of deltas kept unless set otherwise
+
+        explicit rewind_buffer(size_t capacity_bytes = default_capacity); // constructor
+
+        void clear(); // forget every recorded frame
+
+        void push(const chip8& machine); // record the machine as the newest frame
+
+        bool step_back(chip8& machine); // restore the frame before the newest and forget the newest, false when there is none
+
+        size_t get_frames() const { return entries.size(); } // frames that can be stepped back
+
+        size_t get_used_bytes() const { return used_words * sizeof(uint64_t); } // bytes of deltas held
+
+        size_t get_capacity() const { return ring.size() * sizeof(uint64_t); } // bytes of deltas held at most
+
+    private:
+        //a delta in the ring, its words being ring[first] .. ring[first + length - 1]
+        struct entry
+        {
+            size_t first;
+            size_t length;
+        };
+
+        std::vector<uint64_t> ring; // encoded deltas, oldest first from the front entry
+        std::deque<entry> entries; // deltas in the ring, oldest first
+        size_t head; // where the next delta goes
+        size_t used_words;
+
+        bool recorded; // newest holds a frame
+        chip8_snapshot newest; // the newest frame, whole
+        size_t newest_words; // words of newest the deltas cover, the most any frame recorded used
+        std::vector<uint64_t> encoded; // delta being recorded, run length encoded
+};
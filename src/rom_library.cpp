@@ -0,0 +1,293 @@
+#include "rom_library.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <cctype>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char* const rom_library::database_name = "romdb.txt";
+
+namespace
+{
+    //largest rom that fits after the interpreter area, the 64 KB of an XO-CHIP machine as chip8::load_program takes
+    const size_t max_rom_size = chip8_memory_size - 512;
+
+    //map a whole file read only, null when it cannot be mapped
+    void* map_file(const std::string& path, size_t size)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+        HANDLE file_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if(file_mapping == nullptr)
+        {
+            return nullptr;
+        }
+        void* address = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, size);
+        CloseHandle(file_mapping);
+        return address;
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if(file < 0)
+        {
+            return nullptr;
+        }
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        return address == MAP_FAILED ? nullptr : address;
+#endif
+    }
+
+    void unmap_file(void* address, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        UnmapViewOfFile(address);
+#else
+        munmap(address, size);
+#endif
+    }
+
+    //one name=value setting of a database line
+    bool read_setting(const std::string& setting, rom_metadata& metadata)
+    {
+        size_t equals = setting.find('=');
+        if(equals == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = setting.substr(0, equals);
+        std::string value = setting.substr(equals + 1);
+        if(name == "title")
+        {
+            metadata.title = value;
+        }else if(name == "ipf")
+        {
+            metadata.instructions_per_frame = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        }else if(name == "quirks")
+        {
+            return parse_quirk_profile(value, metadata.quirks);
+        }else if(name == "edge")
+        {
+            if(value != "clip" && value != "wrap")
+            {
+                return false;
+            }
+            metadata.edge = value == "clip" ? sprite_edge::clip : sprite_edge::wrap;
+        }else if(name == "keys")
+        {
+            //Name:key pairs separated by commas, the chip8 key in hex
+            std::istringstream pairs(value);
+            std::string pair;
+            while(std::getline(pairs, pair, ','))
+            {
+                size_t colon = pair.rfind(':');
+                if(colon == std::string::npos || colon + 2 != pair.size() || !std::isxdigit(static_cast<unsigned char>(pair[colon + 1])))
+                {
+                    return false;
+                }
+                uint8_t key = static_cast<uint8_t>(std::strtoul(pair.c_str() + colon + 1, nullptr, 16));
+                metadata.keys.emplace_back(pair.substr(0, colon), key);
+            }
+        }
+        //unknown settings are skipped
+        return true;
+    }
+
+    //the database key of a hash
+    std::string hash_key(uint64_t hash)
+    {
+        std::ostringstream key;
+        key << std::hex;
+        key.width(16);
+        key.fill('0');
+        key << hash;
+        return key.str();
+    }
+}
+
+rom_library::rom_library()
+{
+}
+
+rom_library::~rom_library()
+{
+    close();
+}
+
+void rom_library::close()
+{
+    for(const mapping& mapped : mappings)
+    {
+        unmap_file(mapped.address, mapped.size);
+    }
+    mappings.clear();
+    images.clear();
+    by_hash.clear();
+    database.clear();
+}
+
+//files that cannot be a rom (empty or larger than the memory after the interpreter area) and the
+//database are skipped
+bool rom_library::open(const std::string& directory)
+{
+    close();
+
+    std::error_code error;
+    std::vector<std::filesystem::path> files;
+    for(const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        if(entry.is_regular_file() && entry.path().filename() != database_name)
+        {
+            files.push_back(entry.path());
+        }
+    }
+    if(error)
+    {
+        std::cerr << "Error opening rom directory " << directory << std::endl;
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    std::filesystem::path database_path = std::filesystem::path(directory) / database_name;
+    if(std::filesystem::exists(database_path, error) && !read_database(database_path.string(), database))
+    {
+        return false;
+    }
+
+    for(const auto& path : files)
+    {
+        size_t size = static_cast<size_t>(std::filesystem::file_size(path, error));
+        if(error || size == 0 || size > max_rom_size)
+        {
+            continue;
+        }
+        void* address = map_file(path.string(), size);
+        if(address == nullptr)
+        {
+            std::cerr << "Error mapping rom file " << path.string() << std::endl;
+            continue;
+        }
+        mappings.push_back({address, size});
+
+        rom_image image;
+        image.name = path.filename().string();
+        image.data = static_cast<const uint8_t*>(address);
+        image.size = size;
+        image.hash = rom_hash(image.data, image.size);
+        image.metadata = find_metadata(image.hash, image.name);
+
+        //a rom found twice is indexed by its first name
+        by_hash.emplace(image.hash, images.size());
+        images.push_back(image);
+    }
+    return true;
+}
+
+const rom_image* rom_library::find(uint64_t hash) const
+{
+    auto found = by_hash.find(hash);
+    return found != by_hash.end() ? &images[found->second] : nullptr;
+}
+
+const rom_image* rom_library::find_name(const std::string& name) const
+{
+    auto found = std::lower_bound(images.begin(), images.end(), name, [](const rom_image& image, const std::string& key) {
+        return image.name < key;
+    });
+    return found != images.end() && found->name == name ? &*found : nullptr;
+}
+
+const rom_metadata* rom_library::find_metadata(uint64_t hash, const std::string& name) const
+{
+    return find_entry(database, hash, name);
+}
+
+const rom_metadata* rom_library::find_entry(const std::vector<std::pair<std::string, rom_metadata>>& entries, uint64_t hash, const std::string& name)
+{
+    std::string key = hash_key(hash);
+    for(const auto& entry : entries)
+    {
+        if(entry.first == key)
+        {
+            return &entry.second;
+        }
+    }
+    for(const auto& entry : entries)
+    {
+        if(entry.first == name)
+        {
+            return &entry.second;
+        }
+    }
+    return nullptr;
+}
+
+bool rom_library::read_database(const std::string& path, std::vector<std::pair<std::string, rom_metadata>>& entries)
+{
+    std::ifstream file(path);
+    if(!file.is_open())
+    {
+        std::cerr << "Error opening rom database " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while(std::getline(file, line))
+    {
+        line_number++;
+        std::istringstream fields(line);
+        std::string key;
+        if(line.empty() || line[0] == '#' || !(fields >> key))
+        {
+            continue;
+        }
+
+        rom_metadata metadata;
+        std::string setting;
+        bool edge_given = false;
+        while(fields >> setting)
+        {
+            if(!read_setting(setting, metadata))
+            {
+                std::cerr << "Bad line " << line_number << " in " << path << ": " << line << std::endl;
+                return false;
+            }
+            edge_given |= setting.compare(0, 5, "edge=") == 0;
+        }
+        if(!edge_given)
+        {
+            metadata.edge = quirks_of(metadata.quirks).edge;
+        }
+
+        //hashes are matched in lower case, file names as they are
+        bool is_hash = key.size() == 16 && std::all_of(key.begin(), key.end(), [](char c) {
+            return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+        });
+        if(is_hash)
+        {
+            std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+                return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            });
+        }
+        entries.emplace_back(key, metadata);
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+#include "chip8.hpp"
+
+//what is known about a rom beyond its bytes, from the rom database
+struct rom_metadata
+{
+    std::string title;
+    sprite_edge edge = sprite_edge::wrap; // the edge the rom was written for, the edge of the profile unless given
+    uint32_t instructions_per_frame = 0; // recommended speed, 0 when unknown
+    quirk_profile quirks = quirk_profile::modern; // interpreter the rom was written for
+    std::vector<std::pair<std::string, uint8_t>> keys; // keyboard keys (SDL names) mapped to chip8 keys
+};
+
+//a rom of the library, its bytes stay mapped for as long as the library is open
+struct rom_image
+{
+    std::string name; // file name
+    const uint8_t* data;
+    size_t size;
+    uint64_t hash; // rom_hash of the bytes
+    const rom_metadata* metadata; // null when the rom is not in the database
+};
+
+//rom library
+//every rom of a directory is mapped into memory once and indexed by the hash of its contents, so
+//loading a rom into any number of machines is a copy from the mapping into their memory, with no
+//file reads. the database file of the directory, when there is one, attaches metadata to the roms
+//
+//the database is text, one rom per line: the file name or the 16 hex digit hash of the rom, then
+//settings as name=value, # starts a comment line
+//  title=Brix  ipf=15  quirks=modern|vip|chip48|schip|xochip  edge=clip|wrap  keys=Left:4,Right:6
+class rom_library
+{
+    public:
+        static const char* const database_name; // file of the directory holding the database
+
+        rom_library(); // constructor
+
+        ~rom_library(); // destructor, unmaps the roms
+
+        rom_library(const rom_library&) = delete;
+        rom_library& operator=(const rom_library&) = delete;
+
+        bool open(const std::string& directory); // map the roms of a directory and read its database
+
+        void close(); // unmap every rom
+
+        size_t size() const { return images.size(); } // number of roms
+
+        const rom_image& get(size_t index) const { return images.at(index); } // a rom, sorted by name
+
+        const rom_image* find(uint64_t hash) const; // the rom with these contents, null when there is none
+
+        const rom_image* find_name(const std::string& name) const; // the rom with this file name, null when there is none
+
+        const rom_metadata* find_metadata(uint64_t hash, const std::string& name) const; // database entry by hash, then by name
+
+        //read a database file into entries keyed by file name or hash, false if it cannot be read
+        static bool read_database(const std::string& path, std::vector<std::pair<std::string, rom_metadata>>& entries);
+
+        //the entry of a rom by hash, then by name, null when there is none
+        static const rom_metadata* find_entry(const std::vector<std::pair<std::string, rom_metadata>>& entries, uint64_t hash, const std::string& name);
+
+    private:
+        struct mapping
+        {
+            void* address;
+            size_t size;
+        };
+
+        std::vector<rom_image> images;
+        std::vector<mapping> mappings;
+        std::unordered_map<uint64_t, size_t> by_hash;
+        std::vector<std::pair<std::string, rom_metadata>> database;
+};
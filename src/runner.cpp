@@ -0,0 +1,223 @@
+#include "runner.hpp"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+
+#include "block_cache.hpp"
+#include "jit.hpp"
+
+const char* const core_names[4] = {"reference", "table", "block", "jit"};
+
+bool read_rom_file(const std::string& path, std::vector<uint8_t>& image)
+{
+    std::ifstream rom_file(path, std::ios::binary);
+    if(!rom_file.is_open())
+    {
+        std::cerr << "Error opening rom file" << std::endl;
+        return false;
+    }
+    image.assign(std::istreambuf_iterator<char>(rom_file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool is_core(const std::string& core)
+{
+    return core == "interp" || std::find(std::begin(core_names), std::end(core_names), core) != std::end(core_names);
+}
+
+//load the key script, lines starting with # are comments
+bool load_key_script(const std::string& path, std::vector<key_event>& events)
+{
+    std::ifstream script(path);
+    if(!script.is_open())
+    {
+        std::cerr << "Error opening key script " << path << std::endl;
+        return false;
+    }
+    return read_key_script(script, path, events);
+}
+
+bool read_key_script(std::istream& script, const std::string& name, std::vector<key_event>& events)
+{
+    std::string line;
+    int line_number = 0;
+    while(std::getline(script, line))
+    {
+        line_number++;
+        if(line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        uint64_t cycle;
+        unsigned int key, value;
+        if(!(fields >> cycle >> std::hex >> key >> std::dec >> value) || key > 0xF)
+        {
+            std::cerr << "Bad line " << line_number << " in " << name << ": " << line << std::endl;
+            return false;
+        }
+        events.push_back({cycle, static_cast<uint8_t>(key), static_cast<uint8_t>(value != 0)});
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const key_event& a, const key_event& b) {
+        return a.cycle < b.cycle;
+    });
+    return true;
+}
+
+void write_key_script(std::ostream& script, const std::vector<key_event>& events)
+{
+    script << "# <cycle> <key> <0|1>" << std::endl;
+    for(const key_event& event : events)
+    {
+        script << event.cycle << ' ' << std::hex << static_cast<int>(event.key) << std::dec << ' '
+               << static_cast<int>(event.value) << '\n';
+    }
+}
+
+//presses of a random key, held for a while, every few hundred to few thousand cycles
+//the generator is a plain xorshift so the script is the same on every platform
+std::vector<key_event> random_key_script(uint32_t seed, uint64_t cycles)
+{
+    uint32_t state = seed != 0 ? seed : 1;
+    auto next = [&state]()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    std::vector<key_event> events;
+    uint64_t cycle = 0;
+    for(;;)
+    {
+        cycle += 200 + next() % 4000;
+        uint64_t release = cycle + 50 + next() % 1000;
+        if(release >= cycles)
+        {
+            break;
+        }
+        uint8_t key = next() & 0xF;
+        events.push_back({cycle, key, 1});
+        events.push_back({release, key, 0});
+        cycle = release;
+    }
+    return events;
+}
+
+bool run_rom(const run_settings& settings, const std::string& rom_path, const std::vector<key_event>& events,
+             uint64_t cycles, std::ostream* stats, chip8& machine, run_result& result)
+{
+    std::vector<uint8_t> image;
+    return read_rom_file(rom_path, image) &&
+           run_program(settings, image.data(), image.size(), events, cycles, stats, machine, result);
+}
+
+bool run_program(const run_settings& settings, const uint8_t* rom, size_t rom_size, const std::vector<key_event>& events,
+                 uint64_t cycles, std::ostream* stats, chip8& machine, run_result& result)
+{
+    const std::string& core = settings.core;
+    machine.chip8_init();
+    machine.set_quirk_profile(settings.quirks);
+    machine.set_sprite_edge(settings.edge);
+    machine.set_instructions_per_frame(settings.instructions_per_frame);
+    bool reference = core == "reference" || core == "interp";
+    machine.set_dispatch_mode(reference ? dispatch_mode::reference : dispatch_mode::table);
+    machine.set_idle_skipping(settings.idle_skipping);
+    if(!machine.load_program(rom, rom_size))
+    {
+        return false;
+    }
+    machine.set_random_seed(settings.random_seed);
+    if(!settings.load_state.empty())
+    {
+        std::ifstream state(settings.load_state, std::ios::binary);
+        if(!state.is_open())
+        {
+            std::cerr << "Error opening state file " << settings.load_state << std::endl;
+            return false;
+        }
+        if(!machine.read_state(state, std::vector<uint8_t>(rom, rom + rom_size)))
+        {
+            return false;
+        }
+    }
+    block_cache cache;
+    jit_compiler compiler;
+
+    //a run that can be stopped goes in slices short enough to notice the stop quickly
+    const uint64_t stop_slice = 1 << 16;
+
+    //the cycles of a loaded state were run before, only the ones from here on are counted
+    uint64_t first_cycle = machine.get_cycle_count();
+
+    //run the rom, only stopping to apply the scripted keys
+    auto start = std::chrono::steady_clock::now();
+    size_t next_event = 0;
+    uint64_t cycle = 0;
+    result.status = cycle_status::ok;
+    while(cycle < cycles)
+    {
+        if(settings.stop != nullptr && *settings.stop != 0)
+        {
+            break;
+        }
+
+        while(next_event < events.size() && events[next_event].cycle <= cycle)
+        {
+            machine.set_keypad(events[next_event].key, events[next_event].value);
+            next_event++;
+        }
+
+        uint64_t until = cycles;
+        if(next_event < events.size() && events[next_event].cycle < until)
+        {
+            until = events[next_event].cycle;
+        }
+        if(settings.stop != nullptr && until - cycle > stop_slice)
+        {
+            until = cycle + stop_slice;
+        }
+        if(core == "block")
+        {
+            result.status = cache.run(machine, until - cycle);
+        }else if(core == "jit")
+        {
+            result.status = compiler.run(machine, until - cycle);
+        }else if(settings.tracer != nullptr)
+        {
+            result.status = machine.run_cycles(until - cycle, *settings.tracer);
+        }else if(settings.profiler != nullptr)
+        {
+            result.status = machine.run_cycles(until - cycle, *settings.profiler);
+        }else
+        {
+            result.status = machine.run_cycles(until - cycle);
+        }
+        if(result.status != cycle_status::ok)
+        {
+            break;
+        }
+        cycle = until;
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.cycles = machine.get_cycle_count() - first_cycle;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+
+    if(stats != nullptr && core == "block")
+    {
+        *stats << cache.get_compiled_blocks() << " blocks decoded, "
+               << cache.get_invalidated_blocks() << " invalidated" << std::endl;
+    }else if(stats != nullptr && core == "jit")
+    {
+        *stats << compiler.get_compiled_blocks() << " blocks compiled, "
+               << compiler.get_invalidated_blocks() << " invalidated"
+               << (compiler.is_native() ? "" : " (no native code, interpreted)") << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <csignal>
+
+#include "chip8.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+
+//batch runs shared by the headless runner and the benchmark
+//a rom is loaded into a fresh machine and run for a number of cycles on one of the cores, with
+//key changes scripted by cycle so every run of the same script is identical
+
+//one scripted key change, applied before the given cycle is excuted
+struct key_event
+{
+    uint64_t cycle;
+    uint8_t key;
+    uint8_t value;
+};
+
+//load a key script, one "<cycle> <key> <0|1>" per line with the key in hex, # starts a comment line
+bool load_key_script(const std::string& path, std::vector<key_event>& events);
+
+//read the lines of a key script from script, name is used in the error messages
+bool read_key_script(std::istream& script, const std::string& name, std::vector<key_event>& events);
+
+//write events in the key script format
+void write_key_script(std::ostream& script, const std::vector<key_event>& events);
+
+//a reproducible script of random key presses and releases over the given cycles
+std::vector<key_event> random_key_script(uint32_t seed, uint64_t cycles);
+
+//read a whole rom file, the image saved states are compared against
+bool read_rom_file(const std::string& path, std::vector<uint8_t>& image);
+
+//cores a run can use, interp is accepted for reference, the original switch in decode_excute
+extern const char* const core_names[4];
+
+bool is_core(const std::string& core);
+
+//how a rom is run
+struct run_settings
+{
+    std::string core = "table";
+    uint32_t instructions_per_frame = default_instructions_per_frame;
+    sprite_edge edge = sprite_edge::wrap; // set after the quirk profile, which comes with its own edge
+    quirk_profile quirks = quirk_profile::modern;
+    opcode_profiler* profiler = nullptr; // counts the instructions of the reference and table cores when set
+    trace_recorder* tracer = nullptr; // records the instructions of the reference and table cores when set, over the profiler
+    const volatile std::sig_atomic_t* stop = nullptr; // when set, the run ends early once it becomes non zero
+    std::string load_state; // state file the run starts from when set, saved with the same rom
+    uint32_t random_seed = 0; // seed of the CXNN generator, 0 for the default state
+    bool idle_skipping = true; // idle loops of the table core retire the rest of a slice at once, counted as run
+};
+
+//outcome of one run
+struct run_result
+{
+    cycle_status status;
+    uint64_t cycles; // cycles actually run
+    double seconds;
+};
+
+//load the rom into the freshly constructed machine and run it for the given cycles, applying the
+//scripted keys, statistics of the block and jit cores go to stats when given
+//false if the rom or the state to start from could not be loaded
+bool run_rom(const run_settings& settings, const std::string& rom_path, const std::vector<key_event>& events,
+             uint64_t cycles, std::ostream* stats, chip8& machine, run_result& result);
+
+//run_rom with a rom image already in memory, such as one from a rom_library
+bool run_program(const run_settings& settings, const uint8_t* rom, size_t rom_size, const std::vector<key_event>& events,
+                 uint64_t cycles, std::ostream* stats, chip8& machine, run_result& result);
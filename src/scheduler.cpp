@@ -0,0 +1,111 @@
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+scheduler::scheduler()
+{
+    set_speed(1.0);
+    next_frame = clock::now();
+    next_present = next_frame;
+    next_record = next_frame;
+    next_tick = next_frame;
+}
+
+//a frame takes 1/60 s divided by the speed, and a host falling behind may catch up as many frames
+//as max_catch_up_frames take at real speed
+void scheduler::set_speed(double multiple)
+{
+    speed = multiple > 0 ? multiple : 0;
+    if(speed > 0)
+    {
+        frame_time = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / (frame_rate * speed)));
+        catch_up_frames = static_cast<uint32_t>(std::max(1.0, std::ceil(max_catch_up_frames * speed)));
+    }else
+    {
+        frame_time = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / frame_rate));
+        catch_up_frames = 1;
+    }
+}
+
+void scheduler::start()
+{
+    next_frame = clock::now();
+    next_present = next_frame;
+    next_record = next_frame;
+    next_tick = next_frame;
+}
+
+//frames whose time has come, the deadline moves on by one frame time per frame so the rate
+//does not drift, and a host too slow to catch up drops the time it cannot make up
+uint32_t scheduler::frames_due()
+{
+    if(speed == 0)
+    {
+        return 1;
+    }
+
+    clock::time_point now = clock::now();
+    uint32_t due = 0;
+    while(next_frame <= now && due < catch_up_frames)
+    {
+        next_frame += frame_time;
+        due++;
+    }
+    if(next_frame <= now)
+    {
+        next_frame = now + frame_time;
+    }
+    return due;
+}
+
+//sleep most of the wait, then yield for the last millisecond as sleeps overshoot on some hosts. an
+//idle machine has nothing to show early, so it sleeps all of it, a late wake only delaying a frame
+//that looks the same
+void scheduler::wait_for_frame(bool idle)
+{
+    if(speed == 0)
+    {
+        return;
+    }
+
+    clock::time_point wake = idle ? next_frame : next_frame - std::chrono::milliseconds(1);
+    if(clock::now() < wake)
+    {
+        std::this_thread::sleep_until(wake);
+    }
+    while(clock::now() < next_frame)
+    {
+        std::this_thread::yield();
+    }
+}
+
+//up to real speed every frame is shown, faster the screen is only updated at the frame rate of the
+//wall clock so presenting does not slow the emulation down
+bool scheduler::present_due()
+{
+    return wall_frame_due(next_present);
+}
+
+//the rewind history holds frames of wall time, so turbo or unthrottled it does not fill with
+//frames nobody saw, and rewinding plays back at the pace the game was played
+bool scheduler::record_due()
+{
+    return wall_frame_due(next_record);
+}
+
+bool scheduler::wall_frame_due(clock::time_point& next) const
+{
+    if(speed > 0 && speed <= 1)
+    {
+        return true;
+    }
+
+    clock::time_point now = clock::now();
+    if(now < next)
+    {
+        return false;
+    }
+    next = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / frame_rate));
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+#include "chip8.hpp"
+
+//frame scheduler
+//emulated time is counted in instructions: a frame is the machine's instructions_per_frame cycles
+//and the delay and sound timers tick once per frame, whenever the cycle count reaches a multiple of
+//it (see chip8::update_timers). runs with the same rom, keys (by cycle) and instructions per frame
+//therefore end in the same state, whatever the host speed or the front end
+//
+//the wall clock only decides when frames run: throttled, frames are released at 60 Hz times the
+//speed from a steady high resolution clock, unthrottled they run back to back. frames released faster
+//than 60 Hz are only presented at 60 Hz of wall time, the ones in between are skipped
+//
+//a machine idling, waiting for a key or jumping to itself (chip8::is_idle), retires its frames at
+//once in the core. unthrottled it would still run them back to back for nothing, so wait_while_idle
+//sleeps until the next 60 Hz tick instead, or until there is input to handle
+class scheduler
+{
+    public:
+        static const uint32_t frame_rate = 60; // timer ticks and frames per second
+
+        static const uint32_t max_catch_up_frames = 4; // frames run at once when the host falls behind, at real speed
+
+        scheduler(); // constructor
+
+        void set_speed(double multiple); // pace the frames at multiple times 60 Hz, 0 to run them back to back
+
+        double get_speed() const { return speed; } // multiple of real speed, 0 when unthrottled
+
+        bool is_throttled() const { return speed > 0; } // true when frames are paced
+
+        //run the machine up to the end of its current frame through run(n), a function running n
+        //cycles on some core
+        template<typename run_function>
+        cycle_status run_frame(chip8& machine, run_function&& run);
+
+        void start(); // start the clock, the first frame is due at once
+
+        uint32_t frames_due(); // frames to run now, 1 when unthrottled, at most max_catch_up_frames times the speed
+
+        void wait_for_frame(bool idle = false); // sleep until the next frame is due, all of it when idle, returns at once when unthrottled
+
+        bool present_due(); // true once per frame up to real speed, at most 60 times per second above it
+
+        bool record_due(); // the same for recording a frame to rewind, kept apart from present_due
+
+        //unthrottled, sleep until the next 60 Hz tick of the wall clock or until woken() is true,
+        //returns at once when throttled
+        template<typename wake_function>
+        void wait_while_idle(wake_function&& woken);
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        bool wall_frame_due(clock::time_point& next) const; // true once per frame up to real speed, else once per 1/60 s after next
+
+        double speed;
+        uint32_t catch_up_frames; // frames run at once when the host falls behind, at this speed
+        clock::time_point next_frame; // when the next frame is due
+        clock::time_point next_present; // when the next screen update is due above real speed
+        clock::time_point next_record; // when the next rewind frame is due above real speed
+        clock::time_point next_tick; // when the next idle wait ends
+        clock::duration frame_time;
+};
+
+template<typename wake_function>
+void scheduler::wait_while_idle(wake_function&& woken)
+{
+    if(speed > 0)
+    {
+        return;
+    }
+
+    //the ticks are kept steady while idling on, and restart from now after running
+    clock::time_point now = clock::now();
+    clock::duration tick = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / frame_rate));
+    if(next_tick + tick < now)
+    {
+        next_tick = now + tick;
+    }
+    while(clock::now() < next_tick && !woken())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    next_tick += tick;
+}
+
+template<typename run_function>
+cycle_status scheduler::run_frame(chip8& machine, run_function&& run)
+{
+    uint32_t length = machine.get_instructions_per_frame();
+    return run(length - machine.get_cycle_count() % length);
+}
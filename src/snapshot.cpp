@@ -0,0 +1,350 @@
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+//save states
+//a snapshot is a copy of the bytes of the machine, restored by copying them back
+//the state file is a versioned little endian format meant to last between builds: the machine
+//field by field, then the memory as 256 byte pages, the pages still equal to the freshly loaded
+//rom left out so a state is mostly the registers and display
+//version 2 added the quirk profile, version 1 states load with the modern profile
+//version 3 added the display planes, the high resolution, the flag registers and the audio pattern of
+//SUPER-CHIP and XO-CHIP, and the 64 KB of memory. the states before it are 4 KB machines on one plane
+
+namespace
+{
+    const char state_magic[4] = {'C', '8', 'S', 'T'};
+    const uint16_t state_version = 3;
+
+    const size_t page_size = 256;
+
+    //pages of memory in a state of a version, one bit each in the page mask
+    size_t page_count(uint64_t version)
+    {
+        return (version >= 3 ? chip8_memory_size : 4096) / page_size;
+    }
+
+    void put(std::ostream& out, uint64_t value, int bytes)
+    {
+        for(int i = 0; i < bytes; i++)
+        {
+            out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    //0 once the stream has run out, the caller checks the stream at the end
+    uint64_t get(std::istream& in, int bytes)
+    {
+        uint64_t value = 0;
+        for(int i = 0; i < bytes; i++)
+        {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(in.get())) << (8 * i);
+        }
+        return in ? value : 0;
+    }
+}
+
+//fnv-1a
+uint64_t rom_hash(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+size_t chip8::base_snapshot_size()
+{
+    return (offsetof(chip8, memory) + chip8_base_memory_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+//the memory is the last member, a machine not using the memory past 4 KB ends 4 KB into it
+size_t chip8::get_snapshot_size() const
+{
+    if(extended_memory)
+    {
+        return sizeof(chip8);
+    }
+    return base_snapshot_size();
+}
+
+void chip8::save_snapshot(chip8_snapshot& snapshot) const
+{
+    std::memcpy(snapshot.bytes, this, get_snapshot_size());
+}
+
+//the bytes of a machine without XO-CHIP memory come first, they tell whether the rest follows
+void chip8::restore_snapshot(const chip8_snapshot& snapshot)
+{
+    std::memcpy(this, snapshot.bytes, base_snapshot_size());
+    if(extended_memory)
+    {
+        std::memcpy(reinterpret_cast<unsigned char*>(this) + base_snapshot_size(), snapshot.bytes + base_snapshot_size(),
+                    sizeof(chip8) - base_snapshot_size());
+    }
+}
+
+//everything a program can observe, mixed 8 bytes at a time so the memory of a 4 KB machine hashes
+//in a few hundred steps. the timers are hashed by value as the cores bring them up to date at
+//different times, the dispatch is left out as it is how the machine is run, and only the memory of
+//the profile and the display words of the resolution are hashed
+uint64_t chip8::state_hash() const
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto mix = [&hash](uint64_t value)
+    {
+        hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    };
+    auto mix_bytes = [&mix](const uint8_t* data, size_t size)
+    {
+        size_t i = 0;
+        for(; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            mix(word);
+        }
+        for(; i < size; i++)
+        {
+            mix(data[i]);
+        }
+    };
+
+    mix(pc_counter | static_cast<uint64_t>(I) << 16 | static_cast<uint64_t>(stack_pointer) << 32 |
+        static_cast<uint64_t>(get_delay_timer()) << 40 | static_cast<uint64_t>(get_sound_timer()) << 48);
+    mix_bytes(V.data(), V.size());
+    for(uint8_t level = 0; level < stack_pointer && level < chip8_stack_depth; level++)
+    {
+        mix(stack_memory[level]);
+    }
+    mix_bytes(memory.data(), memory_size(quirks_of(quirks)));
+    size_t words = high_resolution ? 128 : 32;
+    for(const std::array<uint64_t, 128>& plane : display)
+    {
+        for(size_t i = 0; i < words; i++)
+        {
+            mix(plane[i]);
+        }
+    }
+    mix(high_resolution | static_cast<uint64_t>(selected_planes) << 8 | static_cast<uint64_t>(audio_pitch) << 16 |
+        static_cast<uint64_t>(edge) << 24 | static_cast<uint64_t>(quirks) << 32 | static_cast<uint64_t>(draw_flag) << 40);
+    mix_bytes(flags.data(), flags.size());
+    mix_bytes(audio_pattern.data(), audio_pattern.size());
+    mix_bytes(keypad.data(), keypad.size());
+    mix(random_state);
+    mix(cycle_count);
+    return hash;
+}
+
+//save the machine, rom is the image it was loaded with
+//the dispatch is left out, it is a choice of the host and not part of the machine
+bool chip8::write_state(std::ostream& out, const std::vector<uint8_t>& rom) const
+{
+    chip8 loaded;
+    loaded.chip8_init();
+    if(!loaded.load_program(rom.data(), rom.size()))
+    {
+        return false;
+    }
+
+    out.write(state_magic, sizeof(state_magic));
+    put(out, state_version, 2);
+    put(out, rom.size(), 2);
+    put(out, rom_hash(rom), 8);
+
+    put(out, pc_counter, 2);
+    put(out, I, 2);
+    for(uint8_t value : V)
+    {
+        put(out, value, 1);
+    }
+    put(out, stack_pointer, 1);
+    for(uint8_t level = 0; level < stack_pointer; level++)
+    {
+        put(out, stack_memory[level], 2);
+    }
+    put(out, delay_timer, 1);
+    put(out, sound_timer, 1);
+    put(out, timer_frame, 8);
+    put(out, cycle_count, 8);
+    put(out, instructions_per_frame, 4);
+    put(out, static_cast<uint8_t>(edge), 1);
+    put(out, static_cast<uint8_t>(quirks), 1);
+    put(out, draw_flag, 1);
+    put(out, random_state, 4);
+    for(uint8_t value : keypad)
+    {
+        put(out, value, 1);
+    }
+
+    //the words of the rows of the resolution, plane after plane
+    put(out, high_resolution, 1);
+    put(out, selected_planes, 1);
+    size_t display_words = high_resolution ? 128 : 32;
+    for(const auto& plane : display)
+    {
+        for(size_t word = 0; word < display_words; word++)
+        {
+            put(out, plane[word], 8);
+        }
+    }
+    for(uint8_t value : flags)
+    {
+        put(out, value, 1);
+    }
+    for(uint8_t value : audio_pattern)
+    {
+        put(out, value, 1);
+    }
+    put(out, audio_pitch, 1);
+
+    //one bit per page, set for the pages that follow in full, only the pages in use can be
+    if(extended_memory)
+    {
+        loaded.extend_memory();
+    }
+    size_t used_pages = (extended_memory ? chip8_memory_size : chip8_base_memory_size) / page_size;
+    std::vector<uint8_t> changed(page_count(state_version) / 8, 0);
+    for(size_t page = 0; page < used_pages; page++)
+    {
+        if(std::memcmp(&memory[page * page_size], &loaded.memory[page * page_size], page_size) != 0)
+        {
+            changed[page / 8] |= 1 << (page % 8);
+        }
+    }
+    out.write(reinterpret_cast<const char*>(changed.data()), changed.size());
+    for(size_t page = 0; page < used_pages; page++)
+    {
+        if(changed[page / 8] & (1 << (page % 8)))
+        {
+            out.write(reinterpret_cast<const char*>(&memory[page * page_size]), page_size);
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+//restore a machine saved by write_state with the same rom, the machine is left as it was when the
+//state is not valid
+bool chip8::read_state(std::istream& in, const std::vector<uint8_t>& rom)
+{
+    chip8 loaded;
+    loaded.chip8_init();
+    if(!loaded.load_program(rom.data(), rom.size()))
+    {
+        return false;
+    }
+    loaded.dispatch = dispatch;
+    loaded.idle_skipping = idle_skipping;
+
+    char magic[sizeof(state_magic)];
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, state_magic, sizeof(magic)) != 0)
+    {
+        std::cerr << "Not a state file" << std::endl;
+        return false;
+    }
+    uint64_t version = get(in, 2);
+    if(version == 0 || version > state_version)
+    {
+        std::cerr << "Unsupported state file version " << version << std::endl;
+        return false;
+    }
+    uint64_t size = get(in, 2);
+    uint64_t hash = get(in, 8);
+    if(size != rom.size() || hash != rom_hash(rom))
+    {
+        std::cerr << "The state file was saved with another rom" << std::endl;
+        return false;
+    }
+
+    loaded.pc_counter = static_cast<uint16_t>(get(in, 2));
+    loaded.I = static_cast<uint16_t>(get(in, 2));
+    for(uint8_t& value : loaded.V)
+    {
+        value = static_cast<uint8_t>(get(in, 1));
+    }
+    loaded.stack_pointer = static_cast<uint8_t>(get(in, 1));
+    if(loaded.stack_pointer > chip8_stack_depth)
+    {
+        std::cerr << "The state file has a deeper stack than this build" << std::endl;
+        return false;
+    }
+    for(uint8_t level = 0; level < loaded.stack_pointer; level++)
+    {
+        loaded.stack_memory[level] = static_cast<uint16_t>(get(in, 2));
+    }
+    loaded.delay_timer = static_cast<uint8_t>(get(in, 1));
+    loaded.sound_timer = static_cast<uint8_t>(get(in, 1));
+    loaded.timer_frame = get(in, 8);
+    loaded.cycle_count = get(in, 8);
+    loaded.instructions_per_frame = static_cast<uint32_t>(get(in, 4));
+    uint64_t edge_mode = get(in, 1);
+    loaded.edge = static_cast<sprite_edge>(edge_mode);
+    uint64_t profile = version >= 2 ? get(in, 1) : static_cast<uint8_t>(quirk_profile::modern);
+    loaded.quirks = static_cast<quirk_profile>(profile);
+    loaded.draw_flag = get(in, 1) != 0;
+    loaded.random_state = static_cast<uint32_t>(get(in, 4));
+    for(uint8_t& value : loaded.keypad)
+    {
+        value = static_cast<uint8_t>(get(in, 1));
+    }
+    if(version >= 3)
+    {
+        loaded.high_resolution = get(in, 1) != 0;
+        loaded.selected_planes = static_cast<uint8_t>(get(in, 1));
+        size_t display_words = loaded.high_resolution ? 128 : 32;
+        for(auto& plane : loaded.display)
+        {
+            for(size_t word = 0; word < display_words; word++)
+            {
+                plane[word] = get(in, 8);
+            }
+        }
+        for(uint8_t& value : loaded.flags)
+        {
+            value = static_cast<uint8_t>(get(in, 1));
+        }
+        for(uint8_t& value : loaded.audio_pattern)
+        {
+            value = static_cast<uint8_t>(get(in, 1));
+        }
+        loaded.audio_pitch = static_cast<uint8_t>(get(in, 1));
+    }else
+    {
+        for(size_t row = 0; row < 32; row++)
+        {
+            loaded.display[0][row] = get(in, 8);
+        }
+    }
+
+    std::vector<uint8_t> changed(page_count(version) / 8, 0);
+    in.read(reinterpret_cast<char*>(changed.data()), changed.size());
+    if(quirks_of(loaded.quirks).instructions == instruction_set::xochip)
+    {
+        loaded.extend_memory();
+    }
+    for(size_t page = 0; page < page_count(version); page++)
+    {
+        if(changed[page / 8] & (1 << (page % 8)))
+        {
+            if(page * page_size >= chip8_base_memory_size)
+            {
+                loaded.extend_memory();
+            }
+            in.read(reinterpret_cast<char*>(&loaded.memory[page * page_size]), page_size);
+        }
+    }
+
+    if(!in || loaded.instructions_per_frame == 0 || edge_mode > static_cast<uint8_t>(sprite_edge::clip) ||
+       profile > static_cast<uint8_t>(quirk_profile::xochip) || loaded.selected_planes > 0x3 ||
+       loaded.random_state == 0)
+    {
+        std::cerr << "Bad state file" << std::endl;
+        return false;
+    }
+    *this = loaded;
+    return true;
+}
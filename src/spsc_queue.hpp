@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//single producer single consumer queue
+//a ring of a power of two items with one index written by each side, so neither side ever takes a
+//lock or waits for the other: push fails when the ring is full and pop when it is empty. each side
+//keeps the last index of the other side it read and only reloads it when the ring looks full or
+//empty, so the shared cache lines are touched once per burst rather than once per item
+template<typename T, size_t capacity>
+class spsc_queue
+{
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "the capacity of an spsc_queue is a power of two");
+
+    public:
+        spsc_queue() : write_index(0), read_index(0), read_cached(0), write_cached(0) {} // constructor
+
+        //producer side, false when the ring is full
+        bool push(const T& item)
+        {
+            uint64_t head = write_index.load(std::memory_order_relaxed);
+            if(head - read_cached >= capacity)
+            {
+                read_cached = read_index.load(std::memory_order_acquire);
+                if(head - read_cached >= capacity)
+                {
+                    return false;
+                }
+            }
+            items[head & (capacity - 1)] = item;
+            write_index.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        //consumer side, false when the ring is empty
+        bool pop(T& item)
+        {
+            uint64_t tail = read_index.load(std::memory_order_relaxed);
+            if(tail == write_cached)
+            {
+                write_cached = write_index.load(std::memory_order_acquire);
+                if(tail == write_cached)
+                {
+                    return false;
+                }
+            }
+            item = items[tail & (capacity - 1)];
+            read_index.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t size() const // items in the ring, exact only on either side when the other is idle
+        {
+            return static_cast<size_t>(write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire));
+        }
+
+    private:
+        std::array<T, capacity> items;
+        alignas(64) std::atomic<uint64_t> write_index; // items pushed, written by the producer
+        alignas(64) std::atomic<uint64_t> read_index; // items popped, written by the consumer
+        alignas(64) uint64_t read_cached; // read_index as the producer last saw it
+        alignas(64) uint64_t write_cached; // write_index as the consumer last saw it
+};
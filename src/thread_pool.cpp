@@ -0,0 +1,163 @@
+#include "thread_pool.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+thread_pool::thread_pool(size_t threads, bool pin_threads)
+{
+    size_t cpus = std::thread::hardware_concurrency();
+    if(cpus == 0)
+    {
+        cpus = 1;
+    }
+    if(threads == 0)
+    {
+        threads = cpus;
+    }
+
+    current_task = nullptr;
+    generation = 0;
+    finished_workers = 0;
+    stopping = false;
+    pinned = pin_threads;
+
+    for(size_t i = 0; i < threads; i++)
+    {
+        queues.push_back(std::make_unique<worker_queue>());
+    }
+    for(size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&thread_pool::worker_loop, this, i);
+        if(pin_threads && !pin_to_cpu(workers.back(), i % cpus))
+        {
+            pinned = false;
+        }
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for(std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+bool thread_pool::pin_to_cpu(std::thread& thread, size_t cpu)
+{
+#if defined(_WIN32)
+    if(cpu >= sizeof(DWORD_PTR) * 8)
+    {
+        return false;
+    }
+    return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)cpu;
+    return false;
+#endif
+}
+
+void thread_pool::run(size_t count, const std::function<void(size_t)>& task)
+{
+    if(count == 0)
+    {
+        return;
+    }
+
+    //deal the tasks out in contiguous runs so each worker starts on neighbouring indices
+    size_t threads = queues.size();
+    for(size_t i = 0; i < threads; i++)
+    {
+        std::lock_guard<std::mutex> guard(queues[i]->lock);
+        for(size_t index = count * i / threads; index < count * (i + 1) / threads; index++)
+        {
+            queues[i]->tasks.push_back(index);
+        }
+    }
+
+    //the run only ends once every worker has seen it and found the queues empty, so no worker can
+    //still be taking tasks when the next run fills the queues
+    std::unique_lock<std::mutex> guard(lock);
+    current_task = &task;
+    finished_workers = 0;
+    generation++;
+    work_ready.notify_all();
+    work_done.wait(guard, [this]() { return finished_workers == workers.size(); });
+    current_task = nullptr;
+}
+
+bool thread_pool::take_task(size_t index, size_t& task)
+{
+    {
+        worker_queue& own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if(!own.tasks.empty())
+        {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    //steal from the other workers, starting with the next one so thieves spread out
+    for(size_t offset = 1; offset < queues.size(); offset++)
+    {
+        worker_queue& victim = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::worker_loop(size_t index)
+{
+    uint64_t seen = 0;
+    for(;;)
+    {
+        const std::function<void(size_t)>* task_function;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [&]() { return stopping || generation != seen; });
+            if(stopping)
+            {
+                return;
+            }
+            seen = generation;
+            task_function = current_task;
+        }
+
+        //every task of the run is queued before it starts, so empty queues mean the run is
+        //finished or being finished by the other workers
+        size_t task;
+        while(take_task(index, task))
+        {
+            (*task_function)(task);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if(++finished_workers == workers.size())
+        {
+            work_done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+//work stealing thread pool
+//run() spreads numbered tasks over the queues of the workers, every worker takes from the back of
+//its own queue and, once it is empty, steals from the front of the others, so uneven tasks (roms
+//that draw more, machines that fault early) even out without a shared queue to fight over
+//
+//workers can be pinned one per logical cpu, keeping a worker and the machines it touches on the
+//same core and its caches between runs
+class thread_pool
+{
+    public:
+        explicit thread_pool(size_t threads = 0, bool pin_threads = false); // 0 threads: one per logical cpu
+
+        ~thread_pool(); // destructor, joins the workers
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        //run task(index) for every index in 0 .. count - 1 and wait for all of them, one run at a time
+        void run(size_t count, const std::function<void(size_t)>& task);
+
+        size_t get_thread_count() const { return workers.size(); } // number of workers
+
+        bool is_pinned() const { return pinned; } // true when every worker was pinned to its cpu
+
+    private:
+        struct worker_queue
+        {
+            std::mutex lock;
+            std::deque<size_t> tasks;
+        };
+
+        void worker_loop(size_t index); // body of worker index
+
+        bool take_task(size_t index, size_t& task); // own task first, then a stolen one
+
+        static bool pin_to_cpu(std::thread& thread, size_t cpu); // false when the host cannot pin
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<worker_queue>> queues; // one per worker
+
+        std::mutex lock; // guards everything below
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        const std::function<void(size_t)>* current_task; // task of the current run
+        uint64_t generation; // bumped by every run
+        size_t finished_workers; // workers done with the current run
+        bool stopping;
+        bool pinned;
+};
@@ -0,0 +1,283 @@
+#include "trace.hpp"
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char trace_magic[4] = {'C', '8', 'T', 'R'};
+    const uint16_t trace_version = 1;
+
+    //the file is mapped in steps of this many bytes at first, then doubled
+    const size_t initial_mapping = 16 << 20;
+}
+
+trace_recorder::trace_recorder()
+    : ring_mask(0), write_index(0), read_index(0), read_cached(0), stalls(0), stopping(false), failed(false),
+      mapping(nullptr), mapped_size(0), used_size(0),
+#ifdef _WIN32
+      file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr)
+#else
+      file_descriptor(-1)
+#endif
+{
+}
+
+trace_recorder::~trace_recorder()
+{
+    close();
+}
+
+//the ring holds a power of two records so the index of a record is a mask of its count
+bool trace_recorder::open(const std::string& file_path, size_t ring_records)
+{
+    close();
+    size_t capacity = 1024;
+    while(capacity < ring_records)
+    {
+        capacity *= 2;
+    }
+    ring.assign(capacity, trace_record{});
+    ring_mask = capacity - 1;
+    write_index.store(0, std::memory_order_relaxed);
+    read_index.store(0, std::memory_order_relaxed);
+    read_cached = 0;
+    stalls = 0;
+    stopping.store(false, std::memory_order_relaxed);
+    failed = false;
+    path = file_path;
+
+#ifdef _WIN32
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file_handle == INVALID_HANDLE_VALUE)
+#else
+    file_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(file_descriptor < 0)
+#endif
+    {
+        std::cerr << "Error creating trace file " << path << std::endl;
+        return false;
+    }
+    if(!grow(initial_mapping))
+    {
+        std::cerr << "Error mapping trace file " << path << std::endl;
+        unmap();
+        return false;
+    }
+    used_size = sizeof(trace_header);
+
+    flusher = std::thread(&trace_recorder::flush_loop, this);
+    return true;
+}
+
+bool trace_recorder::close()
+{
+    if(!flusher.joinable())
+    {
+        return true;
+    }
+    stopping.store(true, std::memory_order_release);
+    flusher.join();
+
+    trace_header header;
+    std::memcpy(header.magic, trace_magic, sizeof(header.magic));
+    header.version = trace_version;
+    header.record_size = sizeof(trace_record);
+    header.records = (used_size - sizeof(trace_header)) / sizeof(trace_record);
+    bool written = !failed && mapping != nullptr;
+    if(mapping == nullptr)
+    {
+        unmap();
+        ring.clear();
+        std::cerr << "Error writing trace file " << path << std::endl;
+        return false;
+    }
+    std::memcpy(mapping, &header, sizeof(header));
+
+    //the file is cut down to what was written once it is unmapped
+    size_t size = used_size;
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(mapping_handle);
+    mapping = nullptr;
+    mapping_handle = nullptr;
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    written = SetFilePointerEx(file_handle, end, nullptr, FILE_BEGIN) && SetEndOfFile(file_handle) && written;
+#else
+    munmap(mapping, mapped_size);
+    mapping = nullptr;
+    written = ftruncate(file_descriptor, static_cast<off_t>(size)) == 0 && written;
+#endif
+    unmap();
+    ring.clear();
+    if(!written)
+    {
+        std::cerr << "Error writing trace file " << path << ", records may be missing" << std::endl;
+    }
+    return written;
+}
+
+void trace_recorder::wait_for_room(uint64_t head)
+{
+    read_cached = read_index.load(std::memory_order_acquire);
+    if(head - read_cached < ring.size())
+    {
+        return;
+    }
+    stalls++;
+    do
+    {
+        std::this_thread::yield();
+        read_cached = read_index.load(std::memory_order_acquire);
+    }while(head - read_cached >= ring.size());
+}
+
+//copy whatever the producer has published, sleeping a little when the ring is empty
+void trace_recorder::flush_loop()
+{
+    uint64_t tail = read_index.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        bool last = stopping.load(std::memory_order_acquire);
+        uint64_t head = write_index.load(std::memory_order_acquire);
+        while(tail != head)
+        {
+            //up to the end of the ring at once
+            uint64_t count = std::min<uint64_t>(head - tail, ring.size() - (tail & ring_mask));
+            size_t bytes = static_cast<size_t>(count) * sizeof(trace_record);
+            if(!failed && used_size + bytes > mapped_size && !grow(std::max(mapped_size * 2, used_size + bytes)))
+            {
+                failed = true;
+            }
+            if(!failed)
+            {
+                std::memcpy(mapping + used_size, &ring[tail & ring_mask], bytes);
+                used_size += bytes;
+            }
+            tail += count;
+            read_index.store(tail, std::memory_order_release);
+        }
+        if(last)
+        {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+}
+
+bool trace_recorder::grow(size_t bytes)
+{
+#ifdef _WIN32
+    if(mapping != nullptr)
+    {
+        UnmapViewOfFile(mapping);
+        CloseHandle(mapping_handle);
+        mapping = nullptr;
+    }
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(bytes) >> 32),
+                                        static_cast<DWORD>(bytes & 0xFFFFFFFF), nullptr);
+    if(mapping_handle == nullptr)
+    {
+        return false;
+    }
+    mapping = static_cast<uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, bytes));
+    if(mapping == nullptr)
+    {
+        return false;
+    }
+#else
+    if(mapping != nullptr)
+    {
+        munmap(mapping, mapped_size);
+        mapping = nullptr;
+    }
+    if(ftruncate(file_descriptor, static_cast<off_t>(bytes)) != 0)
+    {
+        return false;
+    }
+    void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+    if(address == MAP_FAILED)
+    {
+        return false;
+    }
+    mapping = static_cast<uint8_t*>(address);
+#endif
+    mapped_size = bytes;
+    return true;
+}
+
+void trace_recorder::unmap()
+{
+#ifdef _WIN32
+    if(mapping != nullptr)
+    {
+        UnmapViewOfFile(mapping);
+    }
+    if(mapping_handle != nullptr)
+    {
+        CloseHandle(mapping_handle);
+    }
+    if(file_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file_handle);
+    }
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if(mapping != nullptr)
+    {
+        munmap(mapping, mapped_size);
+    }
+    if(file_descriptor >= 0)
+    {
+        ::close(file_descriptor);
+    }
+    file_descriptor = -1;
+#endif
+    mapping = nullptr;
+    mapped_size = 0;
+}
+
+bool trace_reader::open(const std::string& path)
+{
+    file.open(path, std::ios::binary);
+    if(!file.is_open())
+    {
+        std::cerr << "Error opening trace file " << path << std::endl;
+        return false;
+    }
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0)
+    {
+        std::cerr << path << " is not a trace file" << std::endl;
+        return false;
+    }
+    if(header.version != trace_version || header.record_size != sizeof(trace_record))
+    {
+        std::cerr << path << " is a trace of version " << header.version << ", this build reads version " << trace_version << std::endl;
+        return false;
+    }
+    read = 0;
+    return true;
+}
+
+bool trace_reader::next(trace_record& record)
+{
+    if(read >= header.records || !file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        return false;
+    }
+    read++;
+    return true;
+}
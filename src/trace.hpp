@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "opcode.hpp"
+
+//execution trace
+//a trace is one fixed size record per instruction run: the cycle it started at, its address and
+//opcode, the registers it changed and the memory it wrote. the table core takes a trace_probe as its
+//profiler policy, so tracing is a separate instance of the dispatch loop picked per run by
+//chip8::run_cycles, and the untraced loop is compiled without a trace of it
+//
+//records go into the ring of a trace_recorder, a single producer single consumer queue without
+//locks: the emulating thread appends, a thread of the recorder copies them into a memory mapped
+//file. every thread tracing a machine has a recorder of its own
+//
+//the file is a 16 byte header then the records, in host byte order
+
+//one instruction, 32 bytes
+struct trace_record
+{
+    uint64_t cycle; // cycle the instruction started at
+    uint16_t pc; // address of the instruction
+    uint16_t instruction;
+    uint16_t I; // index register after the instruction
+    uint16_t changed; // bit r set when the instruction changed VR
+    uint16_t write_address; // first byte written, when write_length is not 0
+    uint8_t write_length; // bytes written to memory (FX33, FX55, 5XY2)
+    uint8_t value; // new value of the lowest register in changed
+    std::array<uint8_t, 12> written; // the first bytes written
+};
+
+static_assert(sizeof(trace_record) == 32, "trace records are 32 bytes");
+
+struct trace_header
+{
+    char magic[4]; // "C8TR"
+    uint16_t version;
+    uint16_t record_size; // sizeof(trace_record)
+    uint64_t records; // records following the header
+};
+
+static_assert(sizeof(trace_header) == 16, "the trace header is 16 bytes");
+
+class trace_recorder
+{
+    public:
+        trace_recorder(); // constructor
+
+        ~trace_recorder(); // destructor, closes the trace
+
+        trace_recorder(const trace_recorder&) = delete;
+        trace_recorder& operator=(const trace_recorder&) = delete;
+
+        bool open(const std::string& path, size_t ring_records = 1 << 16); // start a trace file, false if it cannot be made
+
+        bool close(); // write the records still in the ring and finish the file, false if writing failed
+
+        bool is_open() const { return flusher.joinable(); } // true between open and close
+
+        //append a record, waiting for the flusher when the ring is full. only the thread that runs
+        //the machine may call it
+        void push(const trace_record& record)
+        {
+            uint64_t head = write_index.load(std::memory_order_relaxed);
+            if(head - read_cached >= ring.size())
+            {
+                wait_for_room(head);
+            }
+            ring[head & ring_mask] = record;
+            write_index.store(head + 1, std::memory_order_release);
+        }
+
+        uint64_t get_records() const { return write_index.load(std::memory_order_relaxed); } // records pushed since open
+
+        uint64_t get_stalls() const { return stalls; } // times push found the ring full
+
+    private:
+        void wait_for_room(uint64_t head); // spin until the flusher has made room for the record at head
+
+        void flush_loop(); // the flusher thread, copying records from the ring into the file
+
+        bool grow(size_t bytes); // map at least bytes of the file
+
+        void unmap(); // unmap the file and release its handles
+
+        std::vector<trace_record> ring;
+        uint64_t ring_mask;
+        std::atomic<uint64_t> write_index; // records pushed, written by the emulating thread
+        std::atomic<uint64_t> read_index; // records copied into the file, written by the flusher
+        uint64_t read_cached; // read_index as the producer last saw it
+        uint64_t stalls;
+
+        std::thread flusher;
+        std::atomic<bool> stopping;
+        bool failed; // the file could not be grown, records after it are dropped
+
+        //the mapped file
+        std::string path;
+        uint8_t* mapping;
+        size_t mapped_size;
+        size_t used_size; // header and records written so far
+#ifdef _WIN32
+        void* file_handle;
+        void* mapping_handle;
+#else
+        int file_descriptor;
+#endif
+};
+
+//profiler policy of the table core recording every instruction, a faulting one is not recorded
+//the machine's registers, memory and cycle count are read through pointers given by chip8::run_cycles
+struct trace_probe
+{
+    static constexpr bool enabled = true;
+
+    trace_recorder& recorder;
+    const uint8_t* V;
+    const uint16_t* I;
+    const uint8_t* memory;
+    const uint64_t* cycle;
+    uint16_t address_mask;
+    bool stores_registers; // 5XY2 writes memory, XO-CHIP only
+
+    trace_record record;
+    uint8_t op;
+    std::array<uint8_t, 16> before; // registers when the instruction started
+
+    void begin(uint16_t pc, uint8_t op_class)
+    {
+        op = op_class;
+        record.cycle = *cycle;
+        record.pc = pc & address_mask;
+        record.instruction = static_cast<uint16_t>((memory[pc & address_mask] << 8) | memory[(pc + 1) & address_mask]);
+        record.write_address = *I;
+        for(int r = 0; r < 16; r++)
+        {
+            before[r] = V[r];
+        }
+    }
+
+    void end()
+    {
+        record.I = *I;
+        record.changed = 0;
+        record.value = 0;
+        for(int r = 15; r >= 0; r--)
+        {
+            if(V[r] != before[r])
+            {
+                record.changed |= static_cast<uint16_t>(1 << r);
+                record.value = V[r];
+            }
+        }
+
+        uint32_t length = 0;
+        if(op == OP_FX33)
+        {
+            length = 3;
+        }else if(op == OP_FX55)
+        {
+            length = opcode_x(record.instruction) + 1;
+        }else if(op == OP_5XY2 && stores_registers)
+        {
+            int x = opcode_x(record.instruction), y = opcode_y(record.instruction);
+            length = (x > y ? x - y : y - x) + 1;
+        }
+        record.write_length = static_cast<uint8_t>(length);
+        for(uint32_t i = 0; i < record.written.size(); i++)
+        {
+            record.written[i] = i < length ? memory[(record.write_address + i) & address_mask] : 0;
+        }
+        if(length == 0)
+        {
+            record.write_address = 0;
+        }
+        recorder.push(record);
+    }
+};
+
+//reads the records of a trace file in order
+class trace_reader
+{
+    public:
+        bool open(const std::string& path); // read the header, false if the file is not a trace
+
+        bool next(trace_record& record); // the next record, false at the end of the trace
+
+        uint64_t get_records() const { return header.records; } // records in the trace
+
+    private:
+        std::ifstream file;
+        trace_header header;
+        uint64_t read = 0; // records returned so far
+};
@@ -0,0 +1,366 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "opcode.hpp"
+#include "trace.hpp"
+
+//trace tool
+//reads the binary traces written by chip8_headless --trace and the emulator, summarizing them,
+//printing the records a filter lets through, or finding the first record two traces differ at
+
+namespace
+{
+    //which records print shows
+    struct record_filter
+    {
+        uint64_t from = 0; // first cycle
+        uint64_t to = UINT64_MAX; // last cycle
+        int pc = -1; // only this address
+        int op = -1; // only this opcode class
+        int changed = -1; // only records changing this register
+        bool writes = false; // only records writing memory
+        uint64_t limit = UINT64_MAX; // records printed at most
+
+        bool accepts(const trace_record& record) const
+        {
+            return record.cycle >= from && record.cycle <= to && (pc < 0 || record.pc == pc) &&
+                   (op < 0 || opcode_table[record.instruction] == op) &&
+                   (changed < 0 || (record.changed >> changed & 1) != 0) && (!writes || record.write_length != 0);
+        }
+    };
+
+    //one line: cycle, address, instruction and its class, then what it changed
+    void print_record(std::ostream& out, const trace_record& record)
+    {
+        out << std::setw(10) << record.cycle << std::hex << std::uppercase << std::setfill('0')
+            << "  " << std::setw(3) << record.pc << "  " << std::setw(4) << record.instruction << std::setfill(' ')
+            << "  " << std::left << std::setw(5) << opcode_name(opcode_table[record.instruction]) << std::right
+            << " I=" << std::setfill('0') << std::setw(3) << record.I;
+
+        //only the value of the lowest register changed is recorded, the others are named
+        bool first = true;
+        for(int r = 0; r < 16; r++)
+        {
+            if(record.changed >> r & 1)
+            {
+                out << (first ? "  V" : " V") << r;
+                if(first)
+                {
+                    out << '=' << std::setw(2) << static_cast<int>(record.value);
+                }
+                first = false;
+            }
+        }
+        if(record.write_length != 0)
+        {
+            out << "  [" << std::setw(3) << record.write_address << "]";
+            for(uint32_t i = 0; i < std::min<uint32_t>(record.write_length, record.written.size()); i++)
+            {
+                out << ' ' << std::setw(2) << static_cast<int>(record.written[i]);
+            }
+            if(record.write_length > record.written.size())
+            {
+                out << " ..." << std::dec << " (" << static_cast<int>(record.write_length) << " bytes)";
+            }
+        }
+        out << std::dec << std::nouppercase << std::setfill(' ') << '\n';
+    }
+
+    int print_trace(const std::string& path, const record_filter& filter)
+    {
+        trace_reader reader;
+        if(!reader.open(path))
+        {
+            return 1;
+        }
+        trace_record record;
+        uint64_t printed = 0;
+        while(printed < filter.limit && reader.next(record))
+        {
+            if(filter.accepts(record))
+            {
+                print_record(std::cout, record);
+                printed++;
+            }
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    int summarize_trace(const std::string& path, size_t hot_pcs)
+    {
+        trace_reader reader;
+        if(!reader.open(path))
+        {
+            return 1;
+        }
+
+        std::array<uint64_t, OP_COUNT> counts{};
+        std::vector<uint64_t> pc_counts(65536, 0);
+        uint64_t records = 0, stretches = 0, writes = 0, written_bytes = 0;
+        uint64_t first_cycle = 0, last_cycle = 0;
+        uint32_t lowest_write = UINT32_MAX, highest_write = 0;
+        trace_record record;
+        while(reader.next(record))
+        {
+            //a trace stopped and started again, or a rewind, leaves a jump in the cycles
+            if(records == 0 || record.cycle != last_cycle + 1)
+            {
+                stretches++;
+            }
+            if(records == 0)
+            {
+                first_cycle = record.cycle;
+            }
+            last_cycle = record.cycle;
+            records++;
+            counts[opcode_table[record.instruction]]++;
+            pc_counts[record.pc]++;
+            if(record.write_length != 0)
+            {
+                writes++;
+                written_bytes += record.write_length;
+                lowest_write = std::min<uint32_t>(lowest_write, record.write_address);
+                highest_write = std::max<uint32_t>(highest_write, record.write_address + record.write_length - 1);
+            }
+        }
+
+        std::cout << records << " instructions";
+        if(records != 0)
+        {
+            std::cout << ", cycles " << first_cycle << " to " << last_cycle << " in " << stretches
+                      << (stretches == 1 ? " stretch" : " stretches");
+        }
+        std::cout << '\n' << writes << " memory writes, " << written_bytes << " bytes";
+        if(writes != 0)
+        {
+            std::cout << std::hex << std::uppercase << " between " << lowest_write << " and " << highest_write
+                      << std::dec << std::nouppercase;
+        }
+        std::cout << "\n\nopcode   instructions      %\n";
+
+        std::vector<uint8_t> ops;
+        for(uint8_t op = 0; op < OP_COUNT; op++)
+        {
+            if(counts[op] != 0)
+            {
+                ops.push_back(op);
+            }
+        }
+        std::sort(ops.begin(), ops.end(), [&counts](uint8_t a, uint8_t b) { return counts[a] > counts[b]; });
+        for(uint8_t op : ops)
+        {
+            std::cout << std::left << std::setw(8) << opcode_name(op) << std::right << std::setw(13) << counts[op]
+                      << std::fixed << std::setprecision(2) << std::setw(8) << 100.0 * counts[op] / records << '\n';
+        }
+
+        std::vector<uint32_t> pcs;
+        for(uint32_t pc = 0; pc < pc_counts.size(); pc++)
+        {
+            if(pc_counts[pc] != 0)
+            {
+                pcs.push_back(pc);
+            }
+        }
+        size_t shown = std::min(hot_pcs, pcs.size());
+        std::partial_sort(pcs.begin(), pcs.begin() + shown, pcs.end(), [&pc_counts](uint32_t a, uint32_t b) {
+            return pc_counts[a] > pc_counts[b];
+        });
+        std::cout << "\naddress  instructions\n";
+        for(size_t i = 0; i < shown; i++)
+        {
+            std::cout << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << pcs[i] << std::setfill(' ')
+                      << std::dec << std::nouppercase << std::setw(18) << pc_counts[pcs[i]] << '\n';
+        }
+        std::cout.flush();
+        return 0;
+    }
+
+    //the first record the traces differ at, with the records before it for context
+    int diff_traces(const std::string& path_a, const std::string& path_b, size_t context)
+    {
+        trace_reader a, b;
+        if(!a.open(path_a) || !b.open(path_b))
+        {
+            return 1;
+        }
+        std::deque<trace_record> before;
+        trace_record record_a, record_b;
+        uint64_t index = 0;
+        for(;; index++)
+        {
+            bool more_a = a.next(record_a);
+            bool more_b = b.next(record_b);
+            if(!more_a && !more_b)
+            {
+                std::cout << "The traces are the same, " << index << " instructions" << std::endl;
+                return 0;
+            }
+            if(more_a != more_b)
+            {
+                std::cout << (more_a ? path_b : path_a) << " ends after " << index << " instructions, the other goes on" << std::endl;
+                return 1;
+            }
+            if(std::memcmp(&record_a, &record_b, sizeof(trace_record)) != 0)
+            {
+                break;
+            }
+            before.push_back(record_a);
+            if(before.size() > context)
+            {
+                before.pop_front();
+            }
+        }
+
+        std::cout << "The traces differ at instruction " << index << ":";
+        if(record_a.cycle != record_b.cycle) std::cout << " cycle";
+        if(record_a.pc != record_b.pc) std::cout << " pc";
+        if(record_a.instruction != record_b.instruction) std::cout << " instruction";
+        if(record_a.I != record_b.I) std::cout << " I";
+        if(record_a.changed != record_b.changed || record_a.value != record_b.value) std::cout << " registers";
+        if(record_a.write_address != record_b.write_address || record_a.write_length != record_b.write_length ||
+           record_a.written != record_b.written) std::cout << " memory";
+        std::cout << '\n';
+        for(const trace_record& record : before)
+        {
+            std::cout << "  ";
+            print_record(std::cout, record);
+        }
+        std::cout << "< ";
+        print_record(std::cout, record_a);
+        std::cout << "> ";
+        print_record(std::cout, record_b);
+        std::cout.flush();
+        return 1;
+    }
+
+    void print_usage()
+    {
+        std::cout << "Usage: ./chip8_trace <command> [options], options as --option value or --option=value" << std::endl;
+        std::cout << "  summary FILE       instructions by opcode class, hottest addresses and memory writes" << std::endl;
+        std::cout << "    --hot N          addresses listed (default 16)" << std::endl;
+        std::cout << "  print FILE         one line per instruction: cycle, address, instruction, I, registers changed" << std::endl;
+        std::cout << "                     (the value of the lowest) and memory written" << std::endl;
+        std::cout << "    --from C         from cycle C" << std::endl;
+        std::cout << "    --to C           up to cycle C" << std::endl;
+        std::cout << "    --pc ADDR        only the instructions at ADDR (hex)" << std::endl;
+        std::cout << "    --op NAME        only one opcode class, such as DXYN or 8XY4" << std::endl;
+        std::cout << "    --register R     only the instructions changing VR (R in hex)" << std::endl;
+        std::cout << "    --writes         only the instructions writing memory" << std::endl;
+        std::cout << "    --limit N        at most N lines" << std::endl;
+        std::cout << "  diff A B           the first instruction two traces differ at" << std::endl;
+        std::cout << "    --context N      instructions shown before it (default 8)" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> files;
+    std::string command;
+    record_filter filter;
+    size_t hot_pcs = 16;
+    size_t context = 8;
+
+    //parse the arguments, options take their value as the next argument or after '='
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        if(arg.compare(0, 2, "--") != 0)
+        {
+            if(command.empty())
+            {
+                command = arg;
+            }else
+            {
+                files.push_back(arg);
+            }
+            continue;
+        }
+
+        std::string value;
+        size_t equals = arg.find('=');
+        if(equals != std::string::npos)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        }else if(arg != "--writes")
+        {
+            if(i + 1 >= argc)
+            {
+                std::cerr << "Missing value of " << arg << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+            value = argv[++i];
+        }
+
+        if(arg == "--from")
+        {
+            filter.from = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--to")
+        {
+            filter.to = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--pc")
+        {
+            filter.pc = static_cast<int>(std::strtoul(value.c_str(), nullptr, 16) & 0xFFFF);
+        }else if(arg == "--op")
+        {
+            for(uint8_t op = 0; op < OP_COUNT; op++)
+            {
+                if(value == opcode_name(op))
+                {
+                    filter.op = op;
+                }
+            }
+            if(filter.op < 0)
+            {
+                std::cerr << "Unknown opcode class " << value << "(use -h to get help)" << std::endl;
+                return 1;
+            }
+        }else if(arg == "--register")
+        {
+            filter.changed = static_cast<int>(std::strtoul(value.c_str(), nullptr, 16) & 0xF);
+        }else if(arg == "--writes")
+        {
+            filter.writes = true;
+        }else if(arg == "--limit")
+        {
+            filter.limit = std::strtoull(value.c_str(), nullptr, 10);
+        }else if(arg == "--hot")
+        {
+            hot_pcs = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        }else if(arg == "--context")
+        {
+            context = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        }else
+        {
+            std::cerr << "Unknown argument " << arg << "(use -h to get help)" << std::endl;
+            return 1;
+        }
+    }
+
+    if(command == "summary" && files.size() == 1)
+    {
+        return summarize_trace(files[0], hot_pcs);
+    }else if(command == "print" && files.size() == 1)
+    {
+        return print_trace(files[0], filter);
+    }else if(command == "diff" && files.size() == 2)
+    {
+        return diff_traces(files[0], files[1], context);
+    }
+    std::cerr << "Give summary or print and a trace file, or diff and two trace files(use -h to get help)" << std::endl;
+    return 1;
+}
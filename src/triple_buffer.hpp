@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+//triple buffer
+//one writer and one reader share three buffers: the writer fills its back buffer and swaps it with
+//the middle one, the reader swaps its front buffer with the middle one when the middle holds a newer
+//buffer. neither side ever waits, the writer never touches the buffer being read, and the reader
+//always gets the newest completed buffer, the ones it had no time to read being dropped
+template<typename T>
+class triple_buffer
+{
+    public:
+        triple_buffer() : middle(1), back(0), front(2) {} // constructor
+
+        T& get_back() { return buffers[back]; } // buffer the writer fills
+
+        void publish() // writer: make the back buffer the newest one
+        {
+            back = middle.exchange(static_cast<uint8_t>(back | fresh), std::memory_order_acq_rel) & index_mask;
+        }
+
+        bool update() // reader: take the newest buffer as the front one, false when there is none newer
+        {
+            if(!(middle.load(std::memory_order_relaxed) & fresh))
+            {
+                return false;
+            }
+            front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+            return true;
+        }
+
+        const T& get_front() const { return buffers[front]; } // buffer the reader last took
+
+    private:
+        static const uint8_t fresh = 4; // set in middle when it was published and not read yet
+        static const uint8_t index_mask = 3;
+
+        std::array<T, 3> buffers;
+        std::atomic<uint8_t> middle; // index of the middle buffer, with fresh
+        uint8_t back; // index of the writer's buffer
+        uint8_t front; // index of the reader's buffer
+};